@@ -43,10 +43,16 @@
  *	3ffe:ffff:0:f101::3
  *	3ffe:ffff:0:f101::3/64
  *
+ * A list of addresses, separated by blanks or commas, makes a group,
+ * each one "address[%nic][/prefix]", see group_parse():
+ *	3ffe:ffff:0:f101::3/64 3ffe:ffff:0:f101::4%eth1/64
+ *
  * It should be passed by environment variant:
  *	OCF_RESKEY_ipv6addr=3ffe:ffff:0:f101::3
  *	OCF_RESKEY_cidr_netmask=64
  *	OCF_RESKEY_nic=eth0
+ *	OCF_RESKEY_nodad=false
+ *	OCF_RESKEY_dad_timeout=5000
  *
  */
  
@@ -54,8 +60,12 @@
  * start:
  * 	1.IPv6addr will choice a proper interface for the new address.
  *	2.Then assign the new address to the interface.
- *	3.Wait until the new address is available (reply ICMPv6 ECHO packet)
- *	4.Send out the unsolicited advertisements.
+ *	3.Wait until duplicate address detection (DAD) finished, as told by
+ *	  the kernel address notifications, at most dad_timeout ms. With
+ *	  nodad the address is added without DAD and usable at once.
+ *	4.Send out the unsolicited advertisements: the first one right
+ *	  away, the other ua_count - 1 every ua_interval ms from a detached
+ *	  child, so that start does not wait for them.
  *
  *	return 0(OCF_SUCCESS) for success
  *	return 1(OCF_ERR_GENERIC) for failure
@@ -78,21 +88,31 @@
  *
  *
  * monitor:
- *	ping the address by ICMPv6 ECHO request.
+ *	ping the address by ICMPv6 ECHO request: probe_count requests spread
+ *	over probe_timeout ms, the first matching reply counts.
+ *	With monitor_mode=kernel, look at the kernel state instead: the
+ *	address is on the interface, neither tentative, deprecated nor DAD
+ *	failed, and the link is up with a carrier.
+ *	With monitor_neighbor, that neighbor must also answer a neighbor
+ *	solicitation sent from the address.
  *
  *	return 0(OCF_SUCCESS) for response correctly.
- *	return 1(OCF_NOT_RUNNING) for no response.
+ *	return 1(OCF_ERR_GENERIC) for an address not usable (kernel mode).
+ *	return 7(OCF_NOT_RUNNING) for no response.
  *	return 2(OCF_ERR_ARGS) for invalid or excess argument(s)
  */
 
 #include <config.h>
 #include <IPv6addr.h>
+#include <nl_util.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <malloc.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <netinet/icmp6.h>
 #include <arpa/inet.h> /* for inet_pton */
@@ -104,10 +124,15 @@
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <clplumbing/cl_log.h>
 
 
 #define PIDFILE_BASE HA_RSCTMPDIR  "/IPv6addr-"
+#define UA_PIDFILE_BASE HA_RSCTMPDIR  "/IPv6addr-ua-"
 
 /*
 0	No error, action succeeded completely
@@ -147,7 +172,53 @@ const char*	RELOAD_CMD 	= "reload";
 const char*	META_DATA_CMD 	= "meta-data";
 const char*	VALIDATE_CMD 	= "validate-all";
 
-const int	QUERY_COUNT	= 5;
+/* duplicate address detection, see start_addr6() */
+#define DAD_TIMEOUT_DEFAULT	5000
+static int	dad_nodad	= 0;
+static int	dad_timeout	= DAD_TIMEOUT_DEFAULT;	/* ms */
+
+/* ICMPv6 echo probes, see is_addr6_available() */
+#define PROBE_TIMEOUT_DEFAULT	500
+#define PROBE_COUNT_DEFAULT	3
+#define PROBE_COUNT_MAX		16
+static int	probe_timeout	= PROBE_TIMEOUT_DEFAULT;	/* ms */
+static int	probe_count	= PROBE_COUNT_DEFAULT;
+
+/* unsolicited advertisements, see announce_addr6s() */
+#define UA_INTERVAL_DEFAULT	1000
+static int	ua_count	= UA_REPEAT_COUNT;
+static int	ua_interval	= UA_INTERVAL_DEFAULT;	/* ms */
+
+/* monitor, see monitor_addr6() */
+static int		monitor_kernel	= 0;
+static int		monitor_nbr_set	= 0;
+static struct in6_addr	monitor_nbr;
+
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP	0x10000	/* linux/if.h, clashes with net/if.h */
+#endif
+
+/*
+ * An address managed here: the one of a plain resource, or one of a
+ * group. Groups add and remove their addresses with one batch of
+ * netlink requests, wait for DAD on all of them at once and announce
+ * them with one advertisement burst.
+ */
+struct addr6_member {
+	char*		spec;		/* as configured, for the logs */
+	struct in6_addr	addr;
+	int		prefix_len;
+	char*		nic;		/* configured, or NULL */
+	char		if_name[IF_NAMESIZE];	/* where it is, or goes */
+	int		ifindex;
+	int		state;		/* dad_state(), -1 not there */
+	int		up;		/* to be announced */
+};
+
+#define GROUP_SEP	" ,\t\n"
+#define GROUP_MAX	1024
+static struct addr6_member*	group = NULL;
+static int			group_count = 0;
 
 struct in6_ifreq {
 	struct in6_addr ifr6_addr;
@@ -158,8 +229,16 @@ struct in6_ifreq {
 static int start_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
 static int stop_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
 static int status_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
-static int monitor_addr6(struct in6_addr* addr6, int prefix_len);
+static int monitor_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
 static int advt_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname);
+static int announce_addr6s(struct addr6_member* m, int n);
+static void announce_stop(struct in6_addr* addr6);
+static int group_parse(char* list, int prefix_len, char* prov_ifname);
+static int group_start(void);
+static int group_stop(void);
+static int group_status(void);
+static int group_monitor(void);
+static int group_advt(void);
 static int meta_data_addr6(void);
 
 
@@ -175,6 +254,11 @@ static char* get_if(struct in6_addr* addr_target, int* plen_target, char* prov_i
 static int assign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name);
 static int unassign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name);
 int is_addr6_available(struct in6_addr* addr6);
+static int get_env_int(const char* name, int* value, int max);
+static int check_addr6(struct in6_addr* addr6, char* prov_ifname, int* ifindex);
+static int probe_neighbor(struct in6_addr* addr6, int ifindex, struct in6_addr* nbr);
+static int dad_watch_open(void);
+static int dad_wait(int fd, struct addr6_member* m, int n, int timeout);
 
 int
 main(int argc, char* argv[])
@@ -185,6 +269,10 @@ main(int argc, char* argv[])
 	int		ret;
 	char*		cp;
 	char*		prov_ifname = NULL;
+	char*		nodad;
+	char*		mode;
+	char		first[INET6_ADDRSTRLEN];
+	int		is_group;
 	int		prefix_len = -1;
 	struct in6_addr	addr6;
 	struct sigaction act;
@@ -223,8 +311,11 @@ main(int argc, char* argv[])
 		return OCF_ERR_ARGS;
 	}
 
+	/* a list of addresses is a group */
+	is_group = strpbrk(ipv6addr, GROUP_SEP) != NULL;
+
 	/* legacy option */
-	if ((cp = strchr(ipv6addr, '/'))) {
+	if (!is_group && (cp = strchr(ipv6addr, '/'))) {
 		prefix_len = atol(cp + 1);
 		if ((prefix_len < 0) || (prefix_len > 128)) {
 			cl_log(LOG_ERR, "Invalid prefix_len [%s], should be an integer in [0, 128]", cp+1);
@@ -257,7 +348,57 @@ main(int argc, char* argv[])
 	/* get provided interface name (optional) */
 	prov_ifname = getenv("OCF_RESKEY_nic");
 
-	if (inet_pton(AF_INET6, ipv6addr, &addr6) <= 0) {
+	/* skip duplicate address detection (optional) */
+	nodad = getenv("OCF_RESKEY_nodad");
+	if (nodad != NULL && (!strcmp(nodad, "1") || !strcasecmp(nodad, "yes")
+	    || !strcasecmp(nodad, "true") || !strcasecmp(nodad, "on")
+	    || !strcmp(nodad, "ja"))) {
+		dad_nodad = 1;
+	}
+
+	/* how long to wait for duplicate address detection and for
+	 * echo replies, how many echo requests and advertisements to
+	 * send (optional)
+	 */
+	if (get_env_int("dad_timeout", &dad_timeout, INT_MAX) < 0
+	    || get_env_int("probe_timeout", &probe_timeout, INT_MAX / 1000)
+	    < 0 || get_env_int("probe_count", &probe_count, PROBE_COUNT_MAX)
+	    < 0 || get_env_int("ua_count", &ua_count, INT_MAX) < 0
+	    || get_env_int("ua_interval", &ua_interval, INT_MAX) < 0) {
+		usage(argv[0]);
+		return OCF_ERR_ARGS;
+	}
+
+	/* how to monitor (optional) */
+	mode = getenv("OCF_RESKEY_monitor_mode");
+	if (mode != NULL && *mode != 0 && strcmp(mode, "ping") != 0) {
+		if (strcmp(mode, "kernel") != 0) {
+			cl_log(LOG_ERR, "Invalid monitor_mode [%s], "
+				"should be ping or kernel", mode);
+			usage(argv[0]);
+			return OCF_ERR_ARGS;
+		}
+		monitor_kernel = 1;
+	}
+	cp = getenv("OCF_RESKEY_monitor_neighbor");
+	if (cp != NULL && *cp != 0) {
+		if (inet_pton(AF_INET6, cp, &monitor_nbr) <= 0) {
+			cl_log(LOG_ERR, "Invalid monitor_neighbor [%s]", cp);
+			usage(argv[0]);
+			return OCF_ERR_ARGS;
+		}
+		monitor_nbr_set = 1;
+	}
+
+	if (is_group) {
+		if (group_parse(ipv6addr, prefix_len, prov_ifname) < 0) {
+			usage(argv[0]);
+			return OCF_ERR_ARGS;
+		}
+		/* the group goes by its first address */
+		inet_ntop(AF_INET6, &group[0].addr, first, sizeof(first));
+		ipv6addr = first;
+	} else if (inet_pton(AF_INET6, ipv6addr, &addr6) <= 0) {
 		cl_log(LOG_ERR, "Invalid IPv6 address [%s]", ipv6addr);
 		usage(argv[0]);
 		return OCF_ERR_ARGS;
@@ -285,13 +426,17 @@ main(int argc, char* argv[])
 
 	/* switch the command */
 	if (0 == strncmp(START_CMD,argv[1], strlen(START_CMD))) {
-		ret = start_addr6(&addr6, prefix_len, prov_ifname);
+		ret = is_group ? group_start()
+			: start_addr6(&addr6, prefix_len, prov_ifname);
 	}else if (0 == strncmp(STOP_CMD,argv[1], strlen(STOP_CMD))) {
-		ret = stop_addr6(&addr6, prefix_len, prov_ifname);
+		ret = is_group ? group_stop()
+			: stop_addr6(&addr6, prefix_len, prov_ifname);
 	}else if (0 == strncmp(STATUS_CMD,argv[1], strlen(STATUS_CMD))) {
-		ret = status_addr6(&addr6, prefix_len, prov_ifname);
+		ret = is_group ? group_status()
+			: status_addr6(&addr6, prefix_len, prov_ifname);
 	}else if (0 ==strncmp(MONITOR_CMD,argv[1], strlen(MONITOR_CMD))) {
-		ret = monitor_addr6(&addr6, prefix_len);
+		ret = is_group ? group_monitor()
+			: monitor_addr6(&addr6, prefix_len, prov_ifname);
 	}else if (0 ==strncmp(RELOAD_CMD,argv[1], strlen(RELOAD_CMD))) {
 		ret = OCF_ERR_UNIMPLEMENTED;
 	}else if (0 ==strncmp(RECOVER_CMD,argv[1], strlen(RECOVER_CMD))) {
@@ -300,7 +445,8 @@ main(int argc, char* argv[])
 	/* ipv6addr has been validated by inet_pton, hence a valid IPv6 address */
 		ret = OCF_SUCCESS;
 	}else if (0 ==strncmp(ADVT_CMD,argv[1], strlen(MONITOR_CMD))) {
-		ret = advt_addr6(&addr6, prefix_len, prov_ifname);
+		ret = is_group ? group_advt()
+			: advt_addr6(&addr6, prefix_len, prov_ifname);
 	}else{
 		usage(argv[0]);
 		ret = OCF_ERR_ARGS;
@@ -314,7 +460,8 @@ main(int argc, char* argv[])
 int
 start_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 {
-	int	i;
+	struct addr6_member m;
+	int	fd;
 	char*	if_name;
 	if(OCF_SUCCESS == status_addr6(addr6,prefix_len,prov_ifname)) {
 		return OCF_SUCCESS;
@@ -327,29 +474,53 @@ start_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 		return OCF_ERR_GENERIC;
 	}
 
+	/* Listen to the address notifications before there are any */
+	if ((fd = dad_watch_open()) < 0) {
+		cl_log(LOG_ERR, "Cannot watch the IPv6 addresses: %s",
+		       strerror(errno));
+		return OCF_ERR_GENERIC;
+	}
+
 	/* Assign the address */
 	if (0 != assign_addr6(addr6, prefix_len, if_name)) {
 		cl_log(LOG_ERR, "failed to assign the address to %s", if_name);
+		close(fd);
 		return OCF_ERR_GENERIC;
 	}
 
-	/* Check whether the address available */
-	for (i = 0; i < QUERY_COUNT; i++) {
-		if (0 == is_addr6_available(addr6)) {
-			break;
+	/* Wait until duplicate address detection is over */
+	memset(&m, 0, sizeof(m));
+	m.addr = *addr6;
+	m.ifindex = if_nametoindex(if_name);
+	snprintf(m.if_name, sizeof(m.if_name), "%s", if_name);
+	dad_wait(fd, &m, 1, dad_timeout);
+	close(fd);
+	switch (m.state) {
+	case 0:
+		break;
+	case 1:
+		cl_log(LOG_ERR, "IPv6 address collision [DAD] on %s", if_name);
+		if (0 != unassign_addr6(addr6, prefix_len, if_name)) {
+			cl_log(LOG_ERR, "Could not delete IPv6 address");
 		}
-		sleep(1);
+		return OCF_ERR_GENERIC;
+	case 2:
+		cl_log(LOG_ERR, "DAD still in tentative after %d ms", dad_timeout);
+		return OCF_ERR_GENERIC;
+	default:
+		cl_log(LOG_ERR, "address disappeared from %s", if_name);
+		return OCF_ERR_GENERIC;
 	}
-	if (i == QUERY_COUNT) {
+
+	/* Check whether the address available */
+	if (0 != is_addr6_available(addr6)) {
 		cl_log(LOG_ERR, "failed to ping the address");
 		return OCF_ERR_GENERIC;
 	}
 
 	/* Send unsolicited advertisement packet to neighbor */
-	for (i = 0; i < UA_REPEAT_COUNT; i++) {
-		send_ua(addr6, if_name);
-		sleep(1);
-	}
+	m.up = 1;
+	announce_addr6s(&m, 1);
 	return OCF_SUCCESS;
 }
 
@@ -358,23 +529,159 @@ advt_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 {
 	/* First, we need to find a proper device to assign the address */
 	char*	if_name = get_if(addr6, &prefix_len, prov_ifname);
-	int	i;
+	struct addr6_member m;
 	if (NULL == if_name) {
 		cl_log(LOG_ERR, "no valid mechanisms");
 		return OCF_ERR_GENERIC;
 	}
 	/* Send unsolicited advertisement packet to neighbor */
-	for (i = 0; i < UA_REPEAT_COUNT; i++) {
-		send_ua(addr6, if_name);
-		sleep(1);
-	}
+	memset(&m, 0, sizeof(m));
+	m.addr = *addr6;
+	snprintf(m.if_name, sizeof(m.if_name), "%s", if_name);
+	m.up = 1;
+	announce_addr6s(&m, 1);
 	return OCF_SUCCESS;
 }
 
+static int
+ua_pid_file(struct in6_addr* addr6, char* pid_file, size_t len)
+{
+	char	addr[INET6_ADDRSTRLEN];
+
+	inet_ntop(AF_INET6, addr6, addr, sizeof(addr));
+	if (snprintf(pid_file, len, "%s%s", UA_PIDFILE_BASE, addr) >= (int)len) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Send the unsolicited advertisements of the new addresses, those of
+ * m[] that are up: announced does it if it runs, otherwise the first
+ * round is sent now, the rest of the burst from a detached child,
+ * which keeps the sockets and the packets of the first one. A new burst for the same (first) address, and stop, end the one
+ * still running.
+ */
+static int
+announce_addr6s(struct addr6_member* m, int n)
+{
+	struct ua_group*	groups;
+	struct timespec		next;
+	char			pid_file[256];
+	int			ngroups = 0;
+	int			i;
+	int			g;
+	pid_t			pid;
+	int			fd;
+
+	if ((groups = calloc(n, sizeof(*groups))) == NULL) {
+		return -1;
+	}
+	/* one group per interface */
+	for (i = 0; i < n; i++) {
+		if (!m[i].up) {
+			continue;
+		}
+		for (g = 0; g < ngroups; g++) {
+			if (strcmp(groups[g].if_name, m[i].if_name) == 0) {
+				break;
+			}
+		}
+		if (g == ngroups) {
+			if (ua_group_open(&groups[g], m[i].if_name) < 0) {
+				cl_log(LOG_ERR, "Cannot send advertisements on %s",
+				       m[i].if_name);
+				continue;
+			}
+			ngroups++;
+		}
+		ua_group_add(&groups[g], &m[i].addr);
+	}
+
+	/* announced sends them, if it runs */
+	for (g = 0; g < ngroups; ) {
+		if (ua_group_delegate(&groups[g], ua_count, ua_interval) == 0) {
+			ua_group_close(&groups[g]);
+			groups[g] = groups[--ngroups];
+		} else {
+			g++;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (g = 0; g < ngroups; g++) {
+		if (ua_group_send(&groups[g]) < 0) {
+			cl_log(LOG_WARNING, "Cannot send advertisement on %s: %s",
+			       groups[g].if_name, strerror(errno));
+		}
+	}
+
+	pid = ua_count > 1 && ngroups > 0 ? fork() : 0;
+	if (pid != 0) {
+		for (g = 0; g < ngroups; g++) {
+			ua_group_close(&groups[g]);
+		}
+		free(groups);
+		while (pid > 0 && waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+			;
+		return 0;
+	}
+	if (ua_count <= 1 || ngroups == 0) {
+		free(groups);
+		return 0;
+	}
+
+	/* not a child of the caller, nor holding its stdout open */
+	setsid();
+	if (fork() > 0) {
+		_exit(0);
+	}
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO) {
+			close(fd);
+		}
+	}
+	for (i = 0; !m[i].up; i++)
+		;
+	if (ua_pid_file(&m[i].addr, pid_file, sizeof(pid_file)) < 0
+	    || write_pid_file(pid_file) < 0) {
+		_exit(1);
+	}
+	for (i = 1; i < ua_count; i++) {
+		ua_wait(&next, ua_interval);
+		for (g = 0; g < ngroups; g++) {
+			ua_group_send(&groups[g]);
+		}
+	}
+	unlink(pid_file);
+	_exit(0);
+}
+
+/* end the burst of announce_addr6s(), if it is still running */
+static void
+announce_stop(struct in6_addr* addr6)
+{
+	char	pid_file[256];
+
+	if (ua_pid_file(addr6, pid_file, sizeof(pid_file)) < 0
+	    || access(pid_file, F_OK) < 0) {
+		return;
+	}
+	/* write_pid_file() kills whoever holds the file */
+	if (write_pid_file(pid_file) == 0) {
+		unlink(pid_file);
+	}
+}
+
 int
 stop_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 {
 	char* if_name;
+
+	announce_stop(addr6);
 	if(OCF_NOT_RUNNING == status_addr6(addr6,prefix_len,prov_ifname)) {
 		return OCF_SUCCESS;
 	}
@@ -407,56 +714,207 @@ status_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 }
 
 int
-monitor_addr6(struct in6_addr* addr6, int prefix_len)
+monitor_addr6(struct in6_addr* addr6, int prefix_len, char* prov_ifname)
 {
-	if(0 == is_addr6_available(addr6)) {
-		return OCF_SUCCESS;
+	int	ifindex = 0;
+	int	ret;
+
+	if (monitor_kernel) {
+		ret = check_addr6(addr6, prov_ifname, &ifindex);
+	} else {
+		ret = is_addr6_available(addr6) == 0
+			? OCF_SUCCESS : OCF_NOT_RUNNING;
+	}
+	if (ret != OCF_SUCCESS || !monitor_nbr_set) {
+		return ret;
+	}
+
+	if (ifindex == 0) {
+		char* if_name = get_if(addr6, &prefix_len, prov_ifname);
+
+		if (if_name != NULL) {
+			ifindex = if_nametoindex(if_name);
+		}
+	}
+	if (ifindex == 0 || probe_neighbor(addr6, ifindex, &monitor_nbr) < 0) {
+		cl_log(LOG_ERR, "neighbor did not answer");
+		return OCF_ERR_GENERIC;
+	}
+	return OCF_SUCCESS;
+}
+
+/*
+ * The IPv6 addresses of the system, from one RTM_GETADDR dump, kept
+ * for the whole invocation: start, stop and status each look at them
+ * several times. assign_addr6() and unassign_addr6() drop the cache.
+ */
+struct addr6_entry {
+	struct in6_addr	addr;
+	unsigned int	plen;
+	unsigned int	scope;
+	unsigned int	flags;
+	int		ifindex;
+};
+
+static struct addr6_entry *addr6_cache = NULL;
+static size_t addr6_count = 0;
+static size_t addr6_max = 0;
+static int addr6_ifindex = -1;	/* what the cache holds: 0 all, -1 nothing */
+
+/* an RTM_NEWADDR or RTM_DELADDR message of an IPv6 address */
+static int
+addr6_parse(const struct nlmsghdr *h, struct addr6_entry *e)
+{
+	const struct ifaddrmsg *ifa = NLMSG_DATA(h);
+	const struct rtattr *a;
+	const void *addr = NULL, *local = NULL;
+	int len = IFA_PAYLOAD(h);
+
+	if ((h->nlmsg_type != RTM_NEWADDR && h->nlmsg_type != RTM_DELADDR)
+	    || len < 0 || ifa->ifa_family != AF_INET6) {
+		return -1;
+	}
+	e->flags = ifa->ifa_flags;
+	for (a = IFA_RTA(ifa); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		switch (a->rta_type) {
+		case IFA_ADDRESS:
+			addr = RTA_DATA(a);
+			break;
+		case IFA_LOCAL:
+			local = RTA_DATA(a);
+			break;
+		case IFA_FLAGS:
+			e->flags = *(const unsigned int *)RTA_DATA(a);
+			break;
+		}
 	}
-	return OCF_NOT_RUNNING;
+	if (local == NULL) {
+		local = addr;
+	}
+	if (local == NULL) {
+		return -1;
+	}
+	memcpy(&e->addr, local, sizeof(e->addr));
+	e->plen = ifa->ifa_prefixlen;
+	e->scope = ifa->ifa_scope;
+	e->ifindex = ifa->ifa_index;
+	return 0;
+}
+
+static void
+addr6_cache_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct addr6_entry entry, *e;
+	int *oom = arg;
+
+	if (h->nlmsg_type != RTM_NEWADDR || addr6_parse(h, &entry) < 0) {
+		return;
+	}
+	/* not every kernel filters the dump on ifa_index */
+	if (addr6_ifindex > 0 && entry.ifindex != addr6_ifindex) {
+		return;
+	}
+	if (addr6_count == addr6_max) {
+		size_t max = addr6_max ? addr6_max * 2 : 64;
+
+		e = realloc(addr6_cache, max * sizeof(*e));
+		if (e == NULL) {
+			*oom = 1;
+			return;
+		}
+		addr6_cache = e;
+		addr6_max = max;
+	}
+	addr6_cache[addr6_count++] = entry;
+}
+
+/* fill the cache with the addresses of ifindex, or of all links (0) */
+static int
+addr6_cache_load(int ifindex)
+{
+	struct {
+		struct nlmsghdr		h;
+		struct ifaddrmsg	ifa;
+	} req;
+	int fd, rc, oom = 0, one = 1;
+
+	if (addr6_ifindex == 0 || (ifindex != 0 && addr6_ifindex == ifindex)) {
+		return 0;
+	}
+	if ((fd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0) {
+		return -1;
+	}
+#ifdef NETLINK_GET_STRICT_CHK
+	/* let the kernel leave out the other links */
+	setsockopt(fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+#else
+	(void)one;
+#endif
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.h.nlmsg_type = RTM_GETADDR;
+	req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.ifa.ifa_family = AF_INET6;
+	req.ifa.ifa_index = ifindex;
+
+	addr6_count = 0;
+	addr6_ifindex = ifindex;
+	rc = nl_talk(fd, &req.h, addr6_cache_cb, &oom);
+	close(fd);
+	if (rc != 0 || oom) {
+		addr6_ifindex = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+addr6_cache_drop(void)
+{
+	addr6_ifindex = -1;
+	addr6_count = 0;
 }
 
 /* find the network interface associated with an address */
 char*
 scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov_ifname)
 {
-	FILE *f;
-	static char devname[21]="";
-	struct in6_addr addr;
+	static char devname[IF_NAMESIZE]="";
 	struct in6_addr mask;
-	unsigned int plen, scope, dad_status, if_idx;
-	unsigned int addr6p[4];
+	int ifindex = 0;
+	size_t k;
 
-	/* open /proc/net/if_inet6 file */
-	if ((f = fopen(IF_INET6, "r")) == NULL) {
+	/* If interface name provided, only that interface is considered */
+	if (prov_ifname != 0 && *prov_ifname != 0) {
+		if ((ifindex = if_nametoindex(prov_ifname)) == 0) {
+			return NULL;
+		}
+	}
+	if (addr6_cache_load(ifindex) < 0) {
+		cl_log(LOG_INFO, "Cannot read the IPv6 addresses: %s",
+		       strerror(errno));
 		return NULL;
 	}
 
 	/* Loop for each entry */
-	while (1) {
+	for (k = 0; k < addr6_count; k++) {
+		const struct addr6_entry *e = &addr6_cache[k];
+		unsigned int plen = e->plen;
 		int		i;
 		int		n;
 		int		s;
 		gboolean	same = TRUE;
 
-		i = fscanf(f, "%08x%08x%08x%08x %x %02x %02x %02x %20s\n",
-		       	   &addr6p[0], &addr6p[1], &addr6p[2], &addr6p[3],
-			   &if_idx, &plen, &scope, &dad_status, devname);
-		if (i == EOF) {
-			break;
-		}
-		else if (i != 9) {
-			cl_log(LOG_INFO, "Error parsing %s, "
-			       "perhaps the format has changed\n", IF_INET6);
-			break;
+		if (ifindex != 0 && e->ifindex != ifindex) {
+			continue;
 		}
 
-		/* Consider link-local addresses (scope == 0x20) only when
-		 * the inerface name is provided, and global addresses
-		 * (scope == 0). Skip everything else.
+		/* Consider link-local addresses only when the interface
+		 * name is provided, and global addresses. Skip everything
+		 * else.
 		 */
-		if (scope != 0) {
-			if (scope != 0x20 || prov_ifname == 0
-				|| *prov_ifname == 0)
+		if (e->scope != RT_SCOPE_UNIVERSE) {
+			if (e->scope != RT_SCOPE_LINK || ifindex == 0)
 				continue;
 		}
 
@@ -467,19 +925,6 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 			continue;
 		}
 
-		/* If interface name provided, only same devname entry
-		 * would be considered
-		 */
-		if (prov_ifname!=0 && *prov_ifname!=0)
-		{
-			if (strcmp(devname, prov_ifname))
-				continue;
-		}
-
-		for (i = 0; i< 4; i++) {
-			addr.s6_addr32[i] = htonl(addr6p[i]);
-		}
-
 		/* Make the mask based on prefix length */
 		memset(mask.s6_addr, 0xff, 16);
 		if (use_mask && plen < 128) {
@@ -496,7 +941,7 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 		/* compare addr and addr_target */
 		same = TRUE;
 		for (i = 0; i < 4; i++) {
-			if ((addr.s6_addr32[i]&mask.s6_addr32[i]) !=
+			if ((e->addr.s6_addr32[i]&mask.s6_addr32[i]) !=
 			    (addr_target->s6_addr32[i]&mask.s6_addr32[i])) {
 				same = FALSE;
 				break;
@@ -504,13 +949,11 @@ scan_if(struct in6_addr* addr_target, int* plen_target, int use_mask, char* prov
 		}
 		
 		/* We found it!	*/
-		if (same) {
-			fclose(f);
+		if (same && if_indextoname(e->ifindex, devname) != NULL) {
 			*plen_target = plen;
 			return devname;
 		}
 	}
-	fclose(f);
 	return NULL;
 }
 /* find a proper network interface to assign the address */
@@ -533,35 +976,112 @@ get_if(struct in6_addr* addr_target, int* plen_target, char* prov_ifname)
 {
 	return scan_if(addr_target, plen_target, 0, prov_ifname);
 }
+/* an RTM_NEWADDR or RTM_DELADDR request, in a buffer of ADDR6_MSG_SIZE */
+#define ADDR6_MSG_SIZE	NLMSG_SPACE(sizeof(struct ifaddrmsg) \
+				    + 2 * RTA_SPACE(sizeof(struct in6_addr)))
+static void
+addr6_msg(struct nlmsghdr* h, int type, struct in6_addr* addr6,
+	  int prefix_len, int ifindex)
+{
+	struct ifaddrmsg* ifa = NLMSG_DATA(h);
+
+	memset(h, 0, ADDR6_MSG_SIZE);
+	h->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	h->nlmsg_type = type;
+	h->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	if (type == RTM_NEWADDR) {
+		h->nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+		ifa->ifa_flags = dad_nodad ? IFA_F_NODAD : 0;
+	}
+	ifa->ifa_family = AF_INET6;
+	ifa->ifa_prefixlen = prefix_len;
+	ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa->ifa_index = ifindex;
+	nl_addattr(h, IFA_LOCAL, addr6, sizeof(*addr6));
+	nl_addattr(h, IFA_ADDRESS, addr6, sizeof(*addr6));
+}
+
 int
 assign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
 {
-	struct in6_ifreq ifr6;
-
-	/* Get socket first */
-	int		fd;
-	struct ifreq	ifr;
+	union {
+		struct nlmsghdr	h;
+		char		buf[ADDR6_MSG_SIZE];
+	} req;
+	int	ifindex;
+	int	fd;
+	int	rc;
+
+	/* RTM_NEWADDR rather than SIOCSIFADDR, which cannot skip DAD */
+	if ((ifindex = if_nametoindex(if_name)) == 0) {
+		return -1;
+	}
+	addr6_msg(&req.h, RTM_NEWADDR, addr6, prefix_len, ifindex);
 
-	fd = socket(AF_INET6, SOCK_DGRAM, 0);
-	if (fd < 0) {
+	if ((fd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0) {
 		return 1;
 	}
-
-	/* Query the index of the if */
-	strcpy(ifr.ifr_name, if_name);
-	if (ioctl(fd, SIOGIFINDEX, &ifr) < 0) {
+	rc = nl_talk(fd, &req.h, NULL, NULL);
+	close(fd);
+	if (rc != 0) {
+		if (rc > 0) {
+			errno = rc;
+		}
 		return -1;
 	}
+	addr6_cache_drop();
+	return 0;
+}
 
-	/* Assign the address to the if */
-	ifr6.ifr6_addr = *addr6;
-	ifr6.ifr6_ifindex = ifr.ifr_ifindex;
-	ifr6.ifr6_prefixlen = prefix_len;
-	if (ioctl(fd, SIOCSIFADDR, &ifr6) < 0) {
-		return -1;
+/*
+ * Add (RTM_NEWADDR) or remove (RTM_DELADDR) the n addresses of m[] that
+ * have an ifindex, with one batch of requests. errors[i] is what the
+ * kernel answered for m[i], 0 if skipped. Returns -1 if the exchange
+ * failed.
+ */
+static int
+addr6_batch(int type, struct addr6_member* m, int n, int* errors)
+{
+	char*	buf;
+	int*	err;
+	int	count = 0;
+	int	fd;
+	int	rc = -1;
+	int	i;
+
+	buf = calloc(n, ADDR6_MSG_SIZE);
+	err = calloc(n, sizeof(*err));
+	if (buf == NULL || err == NULL) {
+		goto out;
 	}
-	close (fd);
-	return 0;
+	for (i = 0; i < n; i++) {
+		errors[i] = 0;
+		if (m[i].ifindex == 0) {
+			continue;
+		}
+		addr6_msg((struct nlmsghdr *)(void *)(buf + count * ADDR6_MSG_SIZE),
+			  type, &m[i].addr, m[i].prefix_len, m[i].ifindex);
+		count++;
+	}
+	if (count == 0) {
+		rc = 0;
+		goto out;
+	}
+	if ((fd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0) {
+		goto out;
+	}
+	rc = nl_talk_batch(fd, buf, count * ADDR6_MSG_SIZE, count, err);
+	close(fd);
+	for (i = 0, count = 0; i < n; i++) {
+		if (m[i].ifindex != 0) {
+			errors[i] = err[count++];
+		}
+	}
+	addr6_cache_drop();
+out:
+	free(buf);
+	free(err);
+	return rc;
 }
 int
 unassign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
@@ -591,64 +1111,796 @@ unassign_addr6(struct in6_addr* addr6, int prefix_len, char* if_name)
 	}
 	
 	close (fd);
+	addr6_cache_drop();
+	return 0;
+}
+
+/* a socket on the IPv6 address notifications, see dad_wait() */
+static int
+dad_watch_open(void)
+{
+	unsigned group = RTNLGRP_IPV6_IFADDR;
+
+	return nl_open(NETLINK_ROUTE, &group, 1);
+}
+
+static long long
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long
+now_ms(void)
+{
+	return now_us() / 1000;
+}
+
+/* 0 DAD is over, 1 DAD failed, 2 still tentative */
+static int
+dad_state(unsigned int flags)
+{
+	if (flags & IFA_F_DADFAILED) {
+		return 1;
+	}
+	return (flags & IFA_F_TENTATIVE) ? 2 : 0;
+}
+
+/* find the DAD state of the addresses as they are now */
+static void
+dad_lookup(struct addr6_member* m, int n)
+{
+	size_t	k;
+	int	i;
+
+	addr6_cache_drop();
+	if (addr6_cache_load(n == 1 ? m[0].ifindex : 0) < 0) {
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		m[i].state = -1;
+		for (k = 0; k < addr6_count; k++) {
+			if (addr6_cache[k].ifindex == m[i].ifindex &&
+			    !memcmp(&addr6_cache[k].addr, &m[i].addr,
+				    sizeof(m[i].addr))) {
+				m[i].state = dad_state(addr6_cache[k].flags);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Wait at most timeout ms for the kernel to finish duplicate address
+ * detection of addresses just added, fd being a dad_watch_open()
+ * socket opened before. The kernel clears IFA_F_TENTATIVE when done,
+ * or sets IFA_F_DADFAILED, and tells either with an RTM_NEWADDR.
+ * Leaves dad_state(), or -1 if the address went away, in m[i].state and
+ * returns how many are still tentative.
+ */
+static int
+dad_wait(int fd, struct addr6_member* m, int n, int timeout)
+{
+	long	deadline = now_ms() + timeout;
+	char*	buf;
+	int	pending = 0;
+	int	i;
+
+	/* it may be over already, for one with nodad */
+	dad_lookup(m, n);
+	for (i = 0; i < n; i++) {
+		pending += m[i].state == 2;
+	}
+	if (pending == 0 || (buf = malloc(NL_BUFSIZE)) == NULL) {
+		return pending;
+	}
+	while (pending > 0) {
+		struct pollfd	pfd;
+		struct nlmsghdr* h;
+		long		left = deadline - now_ms();
+		int		len;
+
+		if (left <= 0) {
+			break;
+		}
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, left) <= 0) {
+			continue;
+		}
+		len = recv(fd, buf, NL_BUFSIZE, MSG_DONTWAIT);
+		if (len < 0 && errno != ENOBUFS) {
+			continue;
+		}
+		if (len < 0) {
+			/* lost notifications, look again */
+			dad_lookup(m, n);
+		}
+		for (h = (struct nlmsghdr *)(void *)buf; len > 0 &&
+		     NLMSG_OK(h, (unsigned)len); h = NLMSG_NEXT(h, len)) {
+			struct addr6_entry e;
+
+			if (addr6_parse(h, &e) < 0) {
+				continue;
+			}
+			for (i = 0; i < n; i++) {
+				if (e.ifindex == m[i].ifindex &&
+				    !memcmp(&e.addr, &m[i].addr, sizeof(e.addr))) {
+					m[i].state = h->nlmsg_type == RTM_DELADDR
+						? -1 : dad_state(e.flags);
+					break;
+				}
+			}
+		}
+		for (i = 0, pending = 0; i < n; i++) {
+			pending += m[i].state == 2;
+		}
+	}
+	free(buf);
+	addr6_cache_drop();
+	return pending;
+}
+
+/*
+ * Groups. ipv6addr is a list of "address[%nic][/prefix]", nic and
+ * cidr_netmask being the defaults for those without. Each action is
+ * done for all the members at once, and reported for each of them.
+ */
+static int
+group_parse(char* list, int prefix_len, char* prov_ifname)
+{
+	char*	spec;
+	char*	save = NULL;
+	char*	cp;
+
+	for (spec = strtok_r(list, GROUP_SEP, &save); spec != NULL;
+	     spec = strtok_r(NULL, GROUP_SEP, &save)) {
+		struct addr6_member* m;
+
+		if (group_count == GROUP_MAX) {
+			cl_log(LOG_ERR, "More than %d addresses", GROUP_MAX);
+			return -1;
+		}
+		if (group == NULL
+		    && (group = calloc(GROUP_MAX, sizeof(*group))) == NULL) {
+			cl_log(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		m = &group[group_count++];
+		m->spec = strdup(spec);
+		m->prefix_len = prefix_len;
+		m->nic = prov_ifname;
+		if ((cp = strchr(spec, '/')) != NULL) {
+			*cp++ = 0;
+			m->prefix_len = strtol(cp, &cp, 10);
+			if ((*cp != 0 && *cp != '%') || m->prefix_len < 0
+			    || m->prefix_len > 128) {
+				cl_log(LOG_ERR, "Invalid prefix_len in [%s]",
+				       m->spec);
+				return -1;
+			}
+			if (*cp == '%') {
+				m->nic = cp + 1;
+			}
+		}
+		if ((cp = strchr(spec, '%')) != NULL) {
+			*cp++ = 0;
+			m->nic = cp;
+		}
+		if (m->spec == NULL || inet_pton(AF_INET6, spec, &m->addr) <= 0) {
+			cl_log(LOG_ERR, "Invalid IPv6 address [%s]", spec);
+			return -1;
+		}
+	}
+	if (group_count == 0) {
+		cl_log(LOG_ERR, "No IPv6 address");
+		return -1;
+	}
 	return 0;
 }
 
+/* where each member is now: if_name, ifindex and prefix_len, or none */
+static int
+group_locate(void)
+{
+	int	found = 0;
+	int	i;
+
+	for (i = 0; i < group_count; i++) {
+		struct addr6_member* m = &group[i];
+		int	plen = m->prefix_len;
+		char*	if_name = get_if(&m->addr, &plen, m->nic);
+
+		m->ifindex = 0;
+		m->state = -1;
+		if (if_name != NULL) {
+			snprintf(m->if_name, sizeof(m->if_name), "%s", if_name);
+			m->ifindex = if_nametoindex(if_name);
+			m->prefix_len = plen;
+			m->state = 0;
+			found++;
+		}
+	}
+	return found;
+}
+
+static int
+group_start(void)
+{
+	struct addr6_member*	add;
+	int*			errors;
+	int			nadd = 0;
+	int			failed = 0;
+	int			rc = OCF_ERR_GENERIC;
+	int			fd;
+	int			i;
+
+	add = calloc(group_count, sizeof(*add));
+	errors = calloc(group_count, sizeof(*errors));
+	if (add == NULL || errors == NULL) {
+		cl_log(LOG_ERR, "Out of memory");
+		goto out;
+	}
+
+	/* where those not there yet go */
+	group_locate();
+	for (i = 0; i < group_count; i++) {
+		struct addr6_member* m = &group[i];
+		char*	if_name;
+
+		if (m->state == 0) {
+			continue;
+		}
+		if_name = find_if(&m->addr, &m->prefix_len, m->nic);
+		if (if_name == NULL) {
+			cl_log(LOG_ERR, "%s: no valid mechanisms", m->spec);
+			goto out;
+		}
+		snprintf(m->if_name, sizeof(m->if_name), "%s", if_name);
+		if ((m->ifindex = if_nametoindex(if_name)) == 0) {
+			cl_log(LOG_ERR, "%s: no interface %s", m->spec, if_name);
+			goto out;
+		}
+		add[nadd++] = *m;
+	}
+
+	/* Listen to the address notifications before there are any */
+	if ((fd = dad_watch_open()) < 0) {
+		cl_log(LOG_ERR, "Cannot watch the IPv6 addresses: %s",
+		       strerror(errno));
+		goto out;
+	}
+
+	/* Assign the addresses, all in one go */
+	if (addr6_batch(RTM_NEWADDR, add, nadd, errors) < 0) {
+		cl_log(LOG_ERR, "Cannot assign the addresses: %s",
+		       strerror(errno));
+		close(fd);
+		goto out;
+	}
+	for (i = 0; i < nadd; i++) {
+		if (errors[i] != 0) {
+			cl_log(LOG_ERR, "%s: failed to assign the address to %s: %s",
+			       add[i].spec, add[i].if_name, strerror(errors[i]));
+			add[i].ifindex = 0;
+		}
+	}
+
+	/* Wait until duplicate address detection is over for all */
+	dad_wait(fd, group, group_count, dad_timeout);
+	close(fd);
+	for (i = 0, nadd = 0; i < group_count; i++) {
+		struct addr6_member* m = &group[i];
+
+		m->up = 0;
+		switch (m->state) {
+		case 0:
+			if (0 != is_addr6_available(&m->addr)) {
+				cl_log(LOG_ERR, "%s: failed to ping the address",
+				       m->spec);
+				break;
+			}
+			cl_log(LOG_INFO, "%s: up on %s", m->spec, m->if_name);
+			m->up = 1;
+			continue;
+		case 1:
+			cl_log(LOG_ERR, "%s: IPv6 address collision [DAD] on %s",
+			       m->spec, m->if_name);
+			/* removed below */
+			add[nadd++] = *m;
+			break;
+		case 2:
+			cl_log(LOG_ERR, "%s: DAD still in tentative after %d ms",
+			       m->spec, dad_timeout);
+			break;
+		default:
+			cl_log(LOG_ERR, "%s: not on %s", m->spec, m->if_name);
+			break;
+		}
+		failed++;
+	}
+	if (nadd > 0 && addr6_batch(RTM_DELADDR, add, nadd, errors) < 0) {
+		cl_log(LOG_ERR, "Could not delete IPv6 addresses");
+	}
+
+	/* Send unsolicited advertisement packets to neighbor */
+	announce_addr6s(group, group_count);
+	rc = failed ? OCF_ERR_GENERIC : OCF_SUCCESS;
+out:
+	free(add);
+	free(errors);
+	return rc;
+}
+
+static int
+group_stop(void)
+{
+	int*	errors;
+	int	failed = 0;
+	int	i;
+
+	announce_stop(&group[0].addr);
+	if (group_locate() == 0) {
+		return OCF_SUCCESS;
+	}
+	if ((errors = calloc(group_count, sizeof(*errors))) == NULL
+	    || addr6_batch(RTM_DELADDR, group, group_count, errors) < 0) {
+		cl_log(LOG_ERR, "Cannot unassign the addresses: %s",
+		       strerror(errno));
+		free(errors);
+		return OCF_ERR_GENERIC;
+	}
+	for (i = 0; i < group_count; i++) {
+		struct addr6_member* m = &group[i];
+
+		if (m->ifindex == 0) {
+			continue;
+		}
+		if (errors[i] != 0 && errors[i] != EADDRNOTAVAIL) {
+			cl_log(LOG_ERR, "%s: failed to unassign the address from %s: %s",
+			       m->spec, m->if_name, strerror(errors[i]));
+			failed++;
+		} else {
+			cl_log(LOG_INFO, "%s: removed from %s", m->spec,
+			       m->if_name);
+		}
+	}
+	free(errors);
+	return failed ? OCF_ERR_GENERIC : OCF_SUCCESS;
+}
+
+/* all there is running, none is not, some is a failed resource */
+static int
+group_result(int ok, int missing)
+{
+	if (ok == group_count) {
+		return OCF_SUCCESS;
+	}
+	if (missing == group_count) {
+		return OCF_NOT_RUNNING;
+	}
+	return OCF_ERR_GENERIC;
+}
+
+static int
+group_status(void)
+{
+	int	found = group_locate();
+	int	i;
+
+	for (i = 0; found > 0 && i < group_count; i++) {
+		if (group[i].state < 0) {
+			cl_log(LOG_ERR, "%s: not assigned", group[i].spec);
+		}
+	}
+	return group_result(found, group_count - found);
+}
+
+static int
+group_monitor(void)
+{
+	int	ok = 0;
+	int	missing = 0;
+	int	ifindex = 0;
+	int	i;
+
+	for (i = 0; i < group_count; i++) {
+		struct addr6_member* m = &group[i];
+		int	ret;
+
+		if (monitor_kernel) {
+			ret = check_addr6(&m->addr, m->nic, &m->ifindex);
+		} else {
+			ret = is_addr6_available(&m->addr) == 0
+				? OCF_SUCCESS : OCF_NOT_RUNNING;
+		}
+		if (ret == OCF_SUCCESS) {
+			ok++;
+			if (ifindex == 0) {
+				ifindex = m->ifindex;
+			}
+			continue;
+		}
+		cl_log(LOG_ERR, "%s: %s", m->spec, ret == OCF_NOT_RUNNING
+		       ? "not running" : "failed");
+		missing += ret == OCF_NOT_RUNNING;
+	}
+	if (ok == group_count && monitor_nbr_set) {
+		int plen = group[0].prefix_len;
+		char* if_name = ifindex ? NULL
+			: get_if(&group[0].addr, &plen, group[0].nic);
+
+		if (if_name != NULL) {
+			ifindex = if_nametoindex(if_name);
+		}
+		if (ifindex == 0 || probe_neighbor(&group[0].addr, ifindex,
+						   &monitor_nbr) < 0) {
+			cl_log(LOG_ERR, "neighbor did not answer");
+			return OCF_ERR_GENERIC;
+		}
+	}
+	return group_result(ok, missing);
+}
+
+static int
+group_advt(void)
+{
+	int	i;
+
+	group_locate();
+	for (i = 0; i < group_count; i++) {
+		group[i].up = group[i].state == 0;
+		if (!group[i].up) {
+			cl_log(LOG_ERR, "%s: not assigned", group[i].spec);
+		}
+	}
+	announce_addr6s(group, group_count);
+	return OCF_SUCCESS;
+}
+
 #define	MINPACKSIZE	64
+
+/* one raw socket for all probes, passing nothing but echo replies */
+static int
+probe_open(void)
+{
+	static int		fd = -1;
+	struct icmp6_filter	filter;
+
+	if (fd >= 0) {
+		return fd;
+	}
+	if ((fd = socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMPV6)) < 0) {
+		return -1;
+	}
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+	ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter);
+	if (setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter,
+		       sizeof(filter)) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/*
+ * Ping the address: send up to probe_count echo requests, evenly spread
+ * over probe_timeout ms, and wait for a reply to any of them. Replies
+ * are told apart by the source address, the id (the pid) and the
+ * sequence numbers sent by this call. Returns 0 on a reply, -1 when
+ * none came in time.
+ */
 int
 is_addr6_available(struct in6_addr* addr6)
 {
+	static uint16_t			seq = 0;
 	struct sockaddr_in6		addr;
-	struct icmp6_hdr		icmph;
+	struct sockaddr_in6		from;
+	struct icmp6_hdr*		icmph;
 	u_char				outpack[MINPACKSIZE];
-	int				icmp_sock;
-	int				ret;
-	struct iovec			iov;
 	u_char				packet[MINPACKSIZE];
-	struct msghdr			msg;
-
-	if ((icmp_sock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) == -1) {
+	long long			sent[PROBE_COUNT_MAX];
+	long long			start = now_us();
+	long long			timeout = probe_timeout * 1000LL;
+	long long			next = start;
+	uint16_t			id = getpid() & 0xffff;
+	uint16_t			first = seq;
+	int				nsent = 0;
+	int				fd;
+
+	if ((fd = probe_open()) < 0) {
+		cl_log(LOG_ERR, "Cannot open ICMPv6 socket: %s",
+		       strerror(errno));
 		return -1;
 	}
 
-	memset(&icmph, 0, sizeof(icmph));
-	icmph.icmp6_type = ICMP6_ECHO_REQUEST;
-	icmph.icmp6_code = 0;
-	icmph.icmp6_cksum = 0;
-	icmph.icmp6_seq = htons(0);
-	icmph.icmp6_id = 0;
-
-	memset(&outpack, 0, sizeof(outpack));
-	memcpy(&outpack, &icmph, sizeof(icmph));
-
 	memset(&addr, 0, sizeof(struct sockaddr_in6));
 	addr.sin6_family = AF_INET6;
-	addr.sin6_port = htons(IPPROTO_ICMPV6);
 	memcpy(&addr.sin6_addr,addr6,sizeof(struct in6_addr));
 
-	/* Only the first 8 bytes of outpack are meaningful... */
-	ret = sendto(icmp_sock, (char *)outpack, sizeof(outpack), 0,
-			   (struct sockaddr *) &addr,
-			   sizeof(struct sockaddr_in6));
-	if (0 >= ret) {
+	/* the kernel fills in the checksum */
+	memset(&outpack, 0, sizeof(outpack));
+	icmph = (struct icmp6_hdr *)(void *)outpack;
+	icmph->icmp6_type = ICMP6_ECHO_REQUEST;
+	icmph->icmp6_id = htons(id);
+
+	for (;;) {
+		struct icmp6_hdr*	reply;
+		struct pollfd		pfd;
+		long long		now = now_us();
+		long long		wait;
+		socklen_t		fromlen;
+		int			ret;
+
+		if (now >= start + timeout) {
+			break;
+		}
+		if (nsent < probe_count && now >= next) {
+			icmph->icmp6_seq = htons((uint16_t)(first + nsent));
+			if (sendto(fd, outpack, sizeof(outpack), 0,
+				   (struct sockaddr *)&addr, sizeof(addr)) > 0) {
+				sent[nsent] = now;
+			} else {
+				sent[nsent] = -1;
+			}
+			seq++;
+			nsent++;
+			next = start + timeout * nsent / probe_count;
+		}
+		wait = (nsent < probe_count ? next : start + timeout) - now;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, (int)((wait + 999) / 1000)) <= 0) {
+			continue;
+		}
+
+		fromlen = sizeof(from);
+		ret = recvfrom(fd, packet, sizeof(packet), MSG_DONTWAIT,
+			       (struct sockaddr *)&from, &fromlen);
+		if (ret < (int)sizeof(struct icmp6_hdr)) {
+			continue;
+		}
+		reply = (struct icmp6_hdr *)(void *)packet;
+		ret = (uint16_t)(ntohs(reply->icmp6_seq) - first);
+		if (reply->icmp6_type != ICMP6_ECHO_REPLY
+		    || ntohs(reply->icmp6_id) != id || ret >= nsent
+		    || memcmp(&from.sin6_addr, addr6, sizeof(*addr6))) {
+			continue;
+		}
+		if (sent[ret] >= 0) {
+			cl_log(LOG_DEBUG, "echo reply %d of %d, rtt %lld us",
+			       ret + 1, nsent, now_us() - sent[ret]);
+		}
+		return 0;
+	}
+	return -1;
+}
+
+static void
+link_flags_cb(const struct nlmsghdr *h, void *arg)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+	if (h->nlmsg_type == RTM_NEWLINK) {
+		*(unsigned int *)arg = ifi->ifi_flags;
+	}
+}
+
+/* IFF_ flags of a link, IFF_LOWER_UP being the carrier */
+static int
+link_flags(int ifindex, unsigned int* flags)
+{
+	struct {
+		struct nlmsghdr		h;
+		struct ifinfomsg	ifi;
+	} req;
+	int fd, rc;
+
+	if ((fd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0) {
 		return -1;
 	}
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.h.nlmsg_type = RTM_GETLINK;
+	req.h.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	*flags = 0;
+	rc = nl_talk(fd, &req.h, link_flags_cb, flags);
+	close(fd);
+	return rc == 0 ? 0 : -1;
+}
 
-	iov.iov_base = (char *)packet;
-	iov.iov_len = sizeof(packet); 
+/*
+ * monitor_mode=kernel: the address and its link as the kernel has
+ * them, without sending anything. An address that is there but not
+ * usable, or on a link without carrier, is a failed resource.
+ */
+static int
+check_addr6(struct in6_addr* addr6, char* prov_ifname, int* ifindex)
+{
+	const struct addr6_entry* e = NULL;
+	unsigned int	flags;
+	size_t		k;
+
+	*ifindex = 0;
+	if (prov_ifname != 0 && *prov_ifname != 0) {
+		if ((*ifindex = if_nametoindex(prov_ifname)) == 0) {
+			cl_log(LOG_ERR, "no interface %s", prov_ifname);
+			return OCF_NOT_RUNNING;
+		}
+	}
+	if (addr6_cache_load(*ifindex) < 0) {
+		cl_log(LOG_ERR, "Cannot read the IPv6 addresses: %s",
+		       strerror(errno));
+		return OCF_ERR_GENERIC;
+	}
+	for (k = 0; k < addr6_count; k++) {
+		if ((*ifindex == 0 || addr6_cache[k].ifindex == *ifindex)
+		    && !memcmp(&addr6_cache[k].addr, addr6, sizeof(*addr6))) {
+			e = &addr6_cache[k];
+			break;
+		}
+	}
+	if (e == NULL) {
+		return OCF_NOT_RUNNING;
+	}
+	*ifindex = e->ifindex;
 
-	msg.msg_name = &addr;
-	msg.msg_namelen = sizeof(addr);
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = NULL;
-	msg.msg_controllen = 0;
+	if (e->flags & IFA_F_DADFAILED) {
+		cl_log(LOG_ERR, "IPv6 address collision [DAD]");
+		return OCF_ERR_GENERIC;
+	}
+	if (e->flags & IFA_F_TENTATIVE) {
+		cl_log(LOG_ERR, "address is tentative");
+		return OCF_ERR_GENERIC;
+	}
+	if (e->flags & IFA_F_DEPRECATED) {
+		cl_log(LOG_ERR, "address is deprecated");
+		return OCF_ERR_GENERIC;
+	}
+	if (link_flags(e->ifindex, &flags) < 0) {
+		cl_log(LOG_ERR, "Cannot read the link state: %s",
+		       strerror(errno));
+		return OCF_ERR_GENERIC;
+	}
+	if (!(flags & IFF_UP) || !(flags & IFF_LOWER_UP)) {
+		cl_log(LOG_ERR, "link is %s", (flags & IFF_UP)
+		       ? "without carrier" : "down");
+		return OCF_ERR_GENERIC;
+	}
+	return OCF_SUCCESS;
+}
+
+/*
+ * Neighbor discovery of nbr from addr6 on ifindex: probe_count neighbor
+ * solicitations to its solicited-node multicast address, spread over
+ * probe_timeout ms. Returns 0 once a neighbor advertisement for nbr
+ * came back, -1 otherwise.
+ */
+static int
+probe_neighbor(struct in6_addr* addr6, int ifindex, struct in6_addr* nbr)
+{
+	struct {
+		struct nd_neighbor_solicit	ns;
+		struct nd_opt_hdr		opt;
+		u_int8_t			hwaddr[HWADDR_LEN];
+	} out;
+	struct sockaddr_in6	src;
+	struct sockaddr_in6	dst;
+	struct icmp6_filter	filter;
+	struct ifreq		ifr;
+	u_char			packet[MINPACKSIZE];
+	long long		start = now_us();
+	long long		timeout = probe_timeout * 1000LL;
+	long long		next = start;
+	int			nsent = 0;
+	int			hop = 255;	/* see rfc4861 7.1.1 */
+	int			ret = -1;
+	int			fd;
 
-	ret = recvmsg(icmp_sock, &msg, MSG_DONTWAIT);
-	if (0 >= ret) {
+	if ((fd = socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMPV6)) < 0) {
+		cl_log(LOG_ERR, "Cannot open ICMPv6 socket: %s",
+		       strerror(errno));
 		return -1;
 	}
-	
+	ICMP6_FILTER_SETBLOCKALL(&filter);
+	ICMP6_FILTER_SETPASS(ND_NEIGHBOR_ADVERT, &filter);
+	memset(&src, 0, sizeof(src));
+	src.sin6_family = AF_INET6;
+	src.sin6_addr = *addr6;
+	if (IN6_IS_ADDR_LINKLOCAL(addr6)) {
+		src.sin6_scope_id = ifindex;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	if (setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) < 0
+	    || setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex)) < 0
+	    || setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hop, sizeof(hop)) < 0
+	    || bind(fd, (struct sockaddr *)&src, sizeof(src)) < 0
+	    || if_indextoname(ifindex, ifr.ifr_name) == NULL
+	    || ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+		cl_log(LOG_ERR, "Cannot set up neighbor solicitation: %s",
+		       strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	/* the kernel fills in the checksum */
+	memset(&out, 0, sizeof(out));
+	out.ns.nd_ns_type = ND_NEIGHBOR_SOLICIT;
+	out.ns.nd_ns_target = *nbr;
+	out.opt.nd_opt_type = ND_OPT_SOURCE_LINKADDR;
+	out.opt.nd_opt_len = 1;
+	memcpy(out.hwaddr, ifr.ifr_hwaddr.sa_data, HWADDR_LEN);
+
+	/* ff02::1:ffXX:XXXX */
+	memset(&dst, 0, sizeof(dst));
+	dst.sin6_family = AF_INET6;
+	dst.sin6_scope_id = ifindex;
+	dst.sin6_addr.s6_addr[0] = 0xff;
+	dst.sin6_addr.s6_addr[1] = 0x02;
+	dst.sin6_addr.s6_addr[11] = 0x01;
+	dst.sin6_addr.s6_addr[12] = 0xff;
+	memcpy(&dst.sin6_addr.s6_addr[13], &nbr->s6_addr[13], 3);
+
+	while (ret < 0) {
+		struct nd_neighbor_advert* na;
+		struct pollfd	pfd;
+		long long	now = now_us();
+		long long	wait;
+		int		len;
+
+		if (now >= start + timeout) {
+			break;
+		}
+		if (nsent < probe_count && now >= next) {
+			sendto(fd, &out, sizeof(out), 0,
+			       (struct sockaddr *)&dst, sizeof(dst));
+			nsent++;
+			next = start + timeout * nsent / probe_count;
+		}
+		wait = (nsent < probe_count ? next : start + timeout) - now;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, (int)((wait + 999) / 1000)) <= 0) {
+			continue;
+		}
+		len = recv(fd, packet, sizeof(packet), MSG_DONTWAIT);
+		na = (struct nd_neighbor_advert *)(void *)packet;
+		if (len >= (int)sizeof(*na) && na->nd_na_type == ND_NEIGHBOR_ADVERT
+		    && !memcmp(&na->nd_na_target, nbr, sizeof(*nbr))) {
+			cl_log(LOG_DEBUG, "neighbor advertisement after %lld us",
+			       now_us() - start);
+			ret = 0;
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+/* a positive integer from OCF_RESKEY_<name>, if set */
+static int
+get_env_int(const char* name, int* value, int max)
+{
+	char	env[64];
+	char*	str;
+	char*	end;
+	long	val;
+
+	snprintf(env, sizeof(env), "OCF_RESKEY_%s", name);
+	if ((str = getenv(env)) == NULL || *str == 0) {
+		return 0;
+	}
+	val = strtol(str, &end, 10);
+	if (*end != 0 || val <= 0 || val > max) {
+		cl_log(LOG_ERR, "Invalid %s [%s], should be an integer in [1, %d]",
+		       name, str, max);
+		return -1;
+	}
+	*value = val;
 	return 0;
 }
 
@@ -845,7 +2097,10 @@ meta_data_addr6(void)
 	"  <parameters>\n"
 	"    <parameter name=\"ipv6addr\" unique=\"0\" required=\"1\">\n"
 	"      <longdesc lang=\"en\">\n"
-	"	The IPv6 address this RA will manage \n"
+	"	The IPv6 address this RA will manage. A list of them,\n"
+	"	separated by blanks or commas, each one\n"
+	"	address[%nic][/prefix], is managed as one group: all of them\n"
+	"	are added and removed at once, and announced together.\n"
 	"      </longdesc>\n"
 	"      <shortdesc lang=\"en\">IPv6 address</shortdesc>\n"
 	"      <content type=\"string\" default=\"\" />\n"
@@ -867,6 +2122,76 @@ meta_data_addr6(void)
 	"      <shortdesc lang=\"en\">Network interface</shortdesc>\n"
 	"      <content type=\"string\" default=\"\" />\n"
 	"    </parameter>\n"
+	"    <parameter name=\"nodad\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	Add the address without duplicate address detection, so that\n"
+	"	it is usable at once. Only safe when nothing else on the link\n"
+	"	can have the address, e.g. the node that had it is fenced.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Skip duplicate address detection</shortdesc>\n"
+	"      <content type=\"boolean\" default=\"false\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"dad_timeout\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	How long start waits for duplicate address detection to\n"
+	"	finish, in milliseconds. A start fails when it is not over\n"
+	"	by then, and when DAD found the address in use elsewhere.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">DAD timeout</shortdesc>\n"
+	"      <content type=\"integer\" default=\"5000\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"probe_timeout\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	How long monitor and start wait for the address to answer\n"
+	"	an ICMPv6 echo request, in milliseconds.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Echo timeout</shortdesc>\n"
+	"      <content type=\"integer\" default=\"500\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"probe_count\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	How many echo requests to send within probe_timeout, one\n"
+	"	answer is enough (at most 16).\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Echo requests</shortdesc>\n"
+	"      <content type=\"integer\" default=\"3\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"ua_count\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	How many unsolicited neighbor advertisements to send for\n"
+	"	the address on start. Only the first one delays start.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Advertisements</shortdesc>\n"
+	"      <content type=\"integer\" default=\"5\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"ua_interval\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	Milliseconds between the unsolicited neighbor advertisements.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Advertisement interval</shortdesc>\n"
+	"      <content type=\"integer\" default=\"1000\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"monitor_mode\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	How monitor checks the address. ping: it answers an ICMPv6\n"
+	"	echo request. kernel: the kernel has it on the interface,\n"
+	"	neither tentative, deprecated nor DAD failed, and the link is\n"
+	"	up with a carrier; nothing is sent, which makes it cheap\n"
+	"	enough for short intervals on many addresses.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Monitor mode</shortdesc>\n"
+	"      <content type=\"string\" default=\"ping\" />\n"
+	"    </parameter>\n"
+	"    <parameter name=\"monitor_neighbor\" unique=\"0\">\n"
+	"      <longdesc lang=\"en\">\n"
+	"	An IPv6 address on the link, e.g. the router, that monitor\n"
+	"	also sends a neighbor solicitation from the address to. The\n"
+	"	monitor fails when no neighbor advertisement comes back\n"
+	"	within probe_timeout.\n"
+	"      </longdesc>\n"
+	"      <shortdesc lang=\"en\">Neighbor to probe</shortdesc>\n"
+	"      <content type=\"string\" default=\"\" />\n"
+	"    </parameter>\n"
 	"  </parameters>\n"
 	"  <actions>\n"
 	"    <action name=\"start\"   timeout=\"15s\" />\n"
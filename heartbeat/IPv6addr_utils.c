@@ -20,10 +20,13 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include <config.h>
 #include <IPv6addr.h>
+#include <announce.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <malloc.h>
 #include <unistd.h>
 #include <sys/socket.h>
@@ -33,38 +36,52 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/un.h>
 
-/* Send an unsolicited advertisement packet
- * Please refer to rfc4861 / rfc3542
- */
-int
-send_ua(struct in6_addr* src_ip, char* if_name)
+/* build a neighbor advertisement message */
+static void
+ua_payload_init(struct ua_payload* payload, struct in6_addr* target,
+		const void* hwaddr)
 {
-	int status = -1;
-	int fd;
-
-	int ifindex;
-	int hop;
-	struct ifreq ifr;
-	u_int8_t *payload = NULL;
-	int    payload_size;
 	struct nd_neighbor_advert *na;
 	struct nd_opt_hdr *opt;
-	struct sockaddr_in6 src_sin6;
-	struct sockaddr_in6 dst_sin6;
 
-	if ((fd = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6)) == -1) {
+	memset(payload, 0, sizeof(*payload));
+
+	na = &payload->na;
+	na->nd_na_type = ND_NEIGHBOR_ADVERT;
+	na->nd_na_code = 0;
+	na->nd_na_cksum = 0; /* calculated by kernel */
+	na->nd_na_flags_reserved = ND_NA_FLAG_OVERRIDE;
+	na->nd_na_target = *target;
+
+	/* options field; set the target link-layer address */
+	opt = &payload->opt;
+	opt->nd_opt_type = ND_OPT_TARGET_LINKADDR;
+	opt->nd_opt_len = 1; /* The length of the option in units of 8 octets */
+	memcpy(payload->hwaddr, hwaddr, HWADDR_LEN);
+}
+
+/* a socket sending to all nodes on the link, and where to */
+static int
+ua_socket(unsigned int ifindex, struct sockaddr_in6* dst)
+{
+	int fd;
+	int hop;
+
+	if ((fd = socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMPV6)) == -1) {
 		printf("ERROR: socket(IPPROTO_ICMPV6) failed: %s",
 		       strerror(errno));
-		return status;
+		return -1;
 	}
 	/* set the outgoing interface */
-	ifindex = if_nametoindex(if_name);
 	if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
 		       &ifindex, sizeof(ifindex)) < 0) {
 		printf("ERROR: setsockopt(IPV6_MULTICAST_IF) failed: %s",
 		       strerror(errno));
-		goto err;
+		close(fd);
+		return -1;
 	}
 	/* set the hop limit */
 	hop = 255; /* 255 is required. see rfc4861 7.1.2 */
@@ -72,9 +89,34 @@ send_ua(struct in6_addr* src_ip, char* if_name)
 		       &hop, sizeof(hop)) < 0) {
 		printf("ERROR: setsockopt(IPV6_MULTICAST_HOPS) failed: %s",
 		       strerror(errno));
-		goto err;
+		close(fd);
+		return -1;
 	}
 
+	/* sending an unsolicited neighbor advertisement to all */
+	memset(dst, 0, sizeof(*dst));
+	dst->sin6_family = AF_INET6;
+	inet_pton(AF_INET6, BCAST_ADDR, &dst->sin6_addr); /* should not fail */
+	return fd;
+}
+
+/* Prepare unsolicited advertisements of src_ip on if_name: the socket
+ * and the packet are set up once, ua_send() only sends it.
+ * Please refer to rfc4861 / rfc3542
+ */
+int
+ua_open(struct ua_sender* ua, struct in6_addr* src_ip, char* if_name)
+{
+	int ifindex;
+	struct ifreq ifr;
+	struct sockaddr_in6 src_sin6;
+
+	ifindex = if_nametoindex(if_name);
+	if ((ua->fd = ua_socket(ifindex, &ua->dst)) < 0) {
+		return -1;
+	}
+	ua->if_name = if_name;
+
 	/* set the source address */
 	memset(&src_sin6, 0, sizeof(src_sin6));
 	src_sin6.sin6_family = AF_INET6;
@@ -85,7 +127,7 @@ send_ua(struct in6_addr* src_ip, char* if_name)
 		src_sin6.sin6_scope_id = ifindex;
 	}
 
-	if (bind(fd, (struct sockaddr *)&src_sin6, sizeof(src_sin6)) < 0) {
+	if (bind(ua->fd, (struct sockaddr *)&src_sin6, sizeof(src_sin6)) < 0) {
 		printf("ERROR: bind() failed: %s", strerror(errno));
 		goto err;
 	}
@@ -94,54 +136,251 @@ send_ua(struct in6_addr* src_ip, char* if_name)
 	/* get the hardware address */
 	memset(&ifr, 0, sizeof(ifr));
 	strncpy(ifr.ifr_name, if_name, sizeof(ifr.ifr_name) - 1);
-	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+	if (ioctl(ua->fd, SIOCGIFHWADDR, &ifr) < 0) {
 		printf("ERROR: ioctl(SIOCGIFHWADDR) failed: %s", strerror(errno));
 		goto err;
 	}
 
-	/* build a neighbor advertisement message */
-	payload_size = sizeof(struct nd_neighbor_advert)
-			 + sizeof(struct nd_opt_hdr) + HWADDR_LEN;
-	payload = memalign(sysconf(_SC_PAGESIZE), payload_size);
-	if (!payload) {
-		printf("ERROR: malloc for payload failed");
-		goto err;
+	ua_payload_init(&ua->payload, src_ip, ifr.ifr_hwaddr.sa_data);
+	return 0;
+
+err:
+	close(ua->fd);
+	ua->fd = -1;
+	return -1;
+}
+
+int
+ua_send(struct ua_sender* ua)
+{
+	if (sendto(ua->fd, &ua->payload, sizeof(ua->payload), 0,
+		   (struct sockaddr *)&ua->dst, sizeof(ua->dst))
+	    != sizeof(ua->payload)) {
+		printf("ERROR: sendto(%s) failed: %s",
+		       ua->if_name, strerror(errno));
+		return -1;
 	}
-	memset(payload, 0, payload_size);
+	return 0;
+}
 
-	/* Ugly typecast from ia64 hell! */
-	na = (struct nd_neighbor_advert *)((void *)payload);
-	na->nd_na_type = ND_NEIGHBOR_ADVERT;
-	na->nd_na_code = 0;
-	na->nd_na_cksum = 0; /* calculated by kernel */
-	na->nd_na_flags_reserved = ND_NA_FLAG_OVERRIDE;
-	na->nd_na_target = *src_ip;
+/* move next on by interval ms (CLOCK_MONOTONIC) and sleep until then */
+void
+ua_wait(struct timespec* next, int interval)
+{
+	next->tv_sec += interval / 1000;
+	next->tv_nsec += (interval % 1000) * 1000000L;
+	if (next->tv_nsec >= 1000000000L) {
+		next->tv_sec++;
+		next->tv_nsec -= 1000000000L;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL)
+	       == EINTR)
+		;
+}
 
-	/* options field; set the target link-layer address */
-	opt = (struct nd_opt_hdr *)(payload + sizeof(struct nd_neighbor_advert));
-	opt->nd_opt_type = ND_OPT_TARGET_LINKADDR;
-	opt->nd_opt_len = 1; /* The length of the option in units of 8 octets */
-	memcpy(payload + sizeof(struct nd_neighbor_advert)
-			+ sizeof(struct nd_opt_hdr),
-	       &ifr.ifr_hwaddr.sa_data, HWADDR_LEN);
+void
+ua_close(struct ua_sender* ua)
+{
+	if (ua->fd >= 0) {
+		close(ua->fd);
+		ua->fd = -1;
+	}
+}
 
-	/* sending an unsolicited neighbor advertisement to all */
-	memset(&dst_sin6, 0, sizeof(dst_sin6));
-	dst_sin6.sin6_family = AF_INET6;
-	inet_pton(AF_INET6, BCAST_ADDR, &dst_sin6.sin6_addr); /* should not fail */
+/* Send one unsolicited advertisement packet */
+int
+send_ua(struct in6_addr* src_ip, char* if_name)
+{
+	struct ua_sender ua;
+	int status;
 
-	if (sendto(fd, payload, payload_size, 0,
-		   (struct sockaddr *)&dst_sin6, sizeof(dst_sin6))
-	    != payload_size) {
-		printf("ERROR: sendto(%s) failed: %s",
-		       if_name, strerror(errno));
-		goto err;
+	if (ua_open(&ua, src_ip, if_name) < 0) {
+		return -1;
 	}
+	status = ua_send(&ua);
+	ua_close(&ua);
+	return status;
+}
 
-	status = 0;
+/*
+ * Advertisements for a group of addresses of one interface. The socket
+ * is not bound: each packet carries its source address, the address it
+ * advertises, in IPV6_PKTINFO.
+ */
+int
+ua_group_open(struct ua_group* g, const char* if_name)
+{
+	struct ifreq ifr;
 
-err:
+	memset(g, 0, sizeof(*g));
+	g->fd = -1;
+	snprintf(g->if_name, sizeof(g->if_name), "%s", if_name);
+	if ((g->ifindex = if_nametoindex(if_name)) == 0) {
+		printf("ERROR: no interface %s", if_name);
+		return -1;
+	}
+	if ((g->fd = ua_socket(g->ifindex, &g->dst)) < 0) {
+		return -1;
+	}
+
+	/* get the hardware address */
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, if_name, sizeof(ifr.ifr_name) - 1);
+	if (ioctl(g->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		printf("ERROR: ioctl(SIOCGIFHWADDR) failed: %s", strerror(errno));
+		close(g->fd);
+		g->fd = -1;
+		return -1;
+	}
+	memcpy(g->hwaddr, ifr.ifr_hwaddr.sa_data, HWADDR_LEN);
+	return 0;
+}
+
+int
+ua_group_add(struct ua_group* g, struct in6_addr* addr)
+{
+	struct ua_target* t;
+
+	if (g->count == g->max) {
+		int max = g->max ? g->max * 2 : 16;
+
+		if ((t = realloc(g->targets, max * sizeof(*t))) == NULL) {
+			printf("ERROR: malloc for payload failed");
+			return -1;
+		}
+		g->targets = t;
+		g->max = max;
+	}
+	t = &g->targets[g->count++];
+	t->addr = *addr;
+	ua_payload_init(&t->payload, addr, g->hwaddr);
+	return 0;
+}
+
+/* one advertisement for every address, in as few sendmmsg() as it takes */
+#define UA_BATCH	64
+int
+ua_group_send(struct ua_group* g)
+{
+	struct mmsghdr msgs[UA_BATCH];
+	struct iovec iov[UA_BATCH];
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+	} cmsg[UA_BATCH];
+	int i, n, sent, failed = 0;
+
+	for (i = 0; i < g->count; i += n) {
+		n = g->count - i < UA_BATCH ? g->count - i : UA_BATCH;
+		memset(msgs, 0, n * sizeof(msgs[0]));
+		memset(cmsg, 0, n * sizeof(cmsg[0]));
+		for (sent = 0; sent < n; sent++) {
+			struct ua_target* t = &g->targets[i + sent];
+			struct msghdr* m = &msgs[sent].msg_hdr;
+			struct in6_pktinfo* info;
+
+			iov[sent].iov_base = &t->payload;
+			iov[sent].iov_len = sizeof(t->payload);
+			m->msg_name = &g->dst;
+			m->msg_namelen = sizeof(g->dst);
+			m->msg_iov = &iov[sent];
+			m->msg_iovlen = 1;
+			m->msg_control = cmsg[sent].buf;
+			m->msg_controllen = sizeof(cmsg[sent].buf);
+			cmsg[sent].hdr.cmsg_level = IPPROTO_IPV6;
+			cmsg[sent].hdr.cmsg_type = IPV6_PKTINFO;
+			cmsg[sent].hdr.cmsg_len = CMSG_LEN(sizeof(*info));
+			info = (struct in6_pktinfo *)(void *)CMSG_DATA(&cmsg[sent].hdr);
+			info->ipi6_addr = t->addr;
+			info->ipi6_ifindex = g->ifindex;
+		}
+
+		/* a short count means the next one failed, skip it */
+		for (sent = 0; sent < n; ) {
+			int rc = sendmmsg(g->fd, msgs + sent, n - sent, 0);
+
+			if (rc < 0 && errno == EINTR) {
+				continue;
+			}
+			if (rc <= 0) {
+				char addr[INET6_ADDRSTRLEN];
+
+				inet_ntop(AF_INET6, &g->targets[i + sent].addr,
+					  addr, sizeof(addr));
+				printf("ERROR: sendmmsg(%s, %s) failed: %s",
+				       g->if_name, addr, strerror(errno));
+				failed++;
+				rc = 1;
+			}
+			sent += rc;
+		}
+	}
+	return failed ? -1 : 0;
+}
+
+void
+ua_group_close(struct ua_group* g)
+{
+	if (g->fd >= 0) {
+		close(g->fd);
+		g->fd = -1;
+	}
+	free(g->targets);
+	g->targets = NULL;
+	g->count = g->max = 0;
+}
+
+/*
+ * Pass a request to announced (see announce.h). Returns 0 if it took
+ * it, -1 if it does not run or refused it.
+ */
+int
+announce_request(const char* req)
+{
+	struct sockaddr_un sun;
+	char reply[256];
+	int fd, n;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", ANNOUNCE_SOCKET);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0
+	    || send(fd, req, strlen(req), MSG_NOSIGNAL) < 0
+	    || (n = recv(fd, reply, sizeof(reply) - 1, 0)) <= 0) {
+		close(fd);
+		return -1;
+	}
 	close(fd);
-	free(payload);
-	return status;
+	reply[n] = 0;
+	return strncmp(reply, "ok", 2) == 0 ? 0 : -1;
+}
+
+/* hand the advertisements of the group over to announced, if it runs */
+int
+ua_group_delegate(struct ua_group* g, int count, int interval)
+{
+	char* req;
+	int len, i, rc;
+
+	if (g->count == 0) {
+		return 0;
+	}
+	if ((req = malloc(ANNOUNCE_MSG_MAX)) == NULL) {
+		return -1;
+	}
+	len = snprintf(req, ANNOUNCE_MSG_MAX, "announce %s %d %d",
+		       g->if_name, count, interval);
+	for (i = 0; i < g->count && len < ANNOUNCE_MSG_MAX - INET6_ADDRSTRLEN; i++) {
+		req[len++] = ' ';
+		inet_ntop(AF_INET6, &g->targets[i].addr, req + len,
+			  ANNOUNCE_MSG_MAX - len);
+		len += strlen(req + len);
+	}
+	/* too many for one request, send them here */
+	rc = i < g->count ? -1 : announce_request(req);
+	free(req);
+	return rc;
 }
@@ -0,0 +1,650 @@
+/*
+ * announced: announce addresses taken over, see announce.h
+ *
+ *	announced [-f] [-s socket]
+ *
+ * Keeps, for every device it was asked about, an AF_PACKET socket for
+ * the gratuitous ARPs and an ICMPv6 socket for the unsolicited neighbor
+ * advertisements. Every address has a schedule of its own (count and
+ * interval); those due at the same time go out together, in one
+ * sendmmsg() per device and family. Requests arriving together are
+ * taken in before the first round is sent. An rtnetlink subscription
+ * ends the schedules of addresses and devices removed meanwhile.
+ *
+ * Without -f, it goes to the background. Requests are refused with
+ * "error" when a device cannot be used, the clients (send_arp, send_ua
+ * and IPv6addr) then send the packets themselves.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <config.h>
+#include <IPv6addr.h>
+#include <announce.h>
+#include <nl_util.h>
+#include <arp_tx.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* ARPs built and sent at a time */
+#define ARP_BATCH	64
+
+struct ann_dev {
+	char			name[IF_NAMESIZE];
+	int			ifindex;
+	int			arp_fd;		/* -1 until needed */
+	struct arp_tx		arp;
+	unsigned char		hwaddr[ETH_ALEN];
+	struct ua_group		ua;		/* ua.fd -1 until needed */
+};
+
+struct ann_sched {
+	struct ann_dev*		dev;
+	int			family;
+	struct in_addr		v4;
+	struct in6_addr		v6;
+	int			left;		/* rounds */
+	int			interval;	/* ms */
+	long long		next;		/* us, CLOCK_MONOTONIC */
+};
+
+static struct ann_dev**		devs = NULL;
+static int			ndevs = 0;
+static struct ann_sched*	scheds = NULL;
+static int			nscheds = 0;
+static int			maxscheds = 0;
+
+/* clients of this pass, answered once their first round is out */
+#define PENDING_MAX	64
+static int			pending[PENDING_MAX];
+static int			npending = 0;
+
+static volatile sig_atomic_t	quit = 0;
+
+static long long
+now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static struct ann_dev*
+dev_get(const char* name)
+{
+	struct ann_dev*		dev;
+	struct ann_dev**	more;
+	int			i;
+
+	for (i = 0; i < ndevs; i++) {
+		if (strcmp(devs[i]->name, name) == 0) {
+			return devs[i];
+		}
+	}
+	if (strlen(name) >= IF_NAMESIZE || if_nametoindex(name) == 0) {
+		return NULL;
+	}
+	more = realloc(devs, (ndevs + 1) * sizeof(*more));
+	dev = calloc(1, sizeof(*dev));
+	if (more == NULL || dev == NULL) {
+		free(dev);
+		return NULL;
+	}
+	devs = more;
+	strcpy(dev->name, name);
+	dev->ifindex = if_nametoindex(name);
+	dev->arp_fd = -1;
+	dev->ua.fd = -1;
+	devs[ndevs++] = dev;
+	return dev;
+}
+
+static void
+dev_close(struct ann_dev* dev)
+{
+	if (dev->arp_fd >= 0) {
+		close(dev->arp_fd);
+		dev->arp_fd = -1;
+		arp_tx_free(&dev->arp);
+	}
+	ua_group_close(&dev->ua);
+}
+
+/* the ARP socket of the device, opened the first time */
+static int
+dev_arp(struct ann_dev* dev)
+{
+	struct ifreq ifr;
+	struct sockaddr_ll dst;
+
+	if (dev->arp_fd >= 0) {
+		return 0;
+	}
+	if ((dev->arp_fd = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+		syslog(LOG_ERR, "socket(PF_PACKET): %s", strerror(errno));
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	memcpy(ifr.ifr_name, dev->name, sizeof(ifr.ifr_name));
+	if (ioctl(dev->arp_fd, SIOCGIFHWADDR, &ifr) < 0
+	    || ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+		/* not Ethernet, send_arp knows the others */
+		syslog(LOG_WARNING, "%s: no Ethernet address", dev->name);
+		close(dev->arp_fd);
+		dev->arp_fd = -1;
+		return -1;
+	}
+	if (arp_tx_init(&dev->arp, ARP_BATCH) < 0) {
+		syslog(LOG_ERR, "%s: %s", dev->name, strerror(errno));
+		close(dev->arp_fd);
+		dev->arp_fd = -1;
+		return -1;
+	}
+	memcpy(dev->hwaddr, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	memset(&dst, 0, sizeof(dst));
+	dst.sll_family = AF_PACKET;
+	dst.sll_protocol = htons(ETH_P_ARP);
+	dst.sll_ifindex = dev->ifindex;
+	dst.sll_halen = ETH_ALEN;
+	memset(dst.sll_addr, 0xff, ETH_ALEN);
+	arp_tx_dest(&dev->arp, &dst);
+	return 0;
+}
+
+/* the ICMPv6 socket of the device, opened the first time */
+static int
+dev_ua(struct ann_dev* dev)
+{
+	if (dev->ua.fd >= 0) {
+		return 0;
+	}
+	if (ua_group_open(&dev->ua, dev->name) < 0) {
+		syslog(LOG_ERR, "%s: cannot send advertisements", dev->name);
+		return -1;
+	}
+	return 0;
+}
+
+static struct ann_sched*
+sched_find(struct ann_dev* dev, int family, const void* addr)
+{
+	int i;
+
+	for (i = 0; i < nscheds; i++) {
+		struct ann_sched* s = &scheds[i];
+
+		if (s->dev == dev && s->family == family && (family == AF_INET
+		    ? !memcmp(&s->v4, addr, sizeof(s->v4))
+		    : !memcmp(&s->v6, addr, sizeof(s->v6)))) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+static void
+sched_drop(struct ann_sched* s)
+{
+	*s = scheds[--nscheds];
+}
+
+/* announce <device> <count> <interval> <address>... */
+static int
+req_announce(char* args, char* err, size_t errlen)
+{
+	struct ann_dev*	dev;
+	char*		save = NULL;
+	char*		name = strtok_r(args, " ", &save);
+	char*		p;
+	int		count;
+	int		interval;
+	long long	now = now_us();
+
+	if (name == NULL || (p = strtok_r(NULL, " ", &save)) == NULL
+	    || (count = atoi(p)) <= 0
+	    || (p = strtok_r(NULL, " ", &save)) == NULL
+	    || (interval = atoi(p)) <= 0) {
+		snprintf(err, errlen, "usage: announce <device> <count> <interval> <address>...");
+		return -1;
+	}
+	if ((dev = dev_get(name)) == NULL) {
+		snprintf(err, errlen, "no device %s", name);
+		return -1;
+	}
+	while ((p = strtok_r(NULL, " \n", &save)) != NULL) {
+		struct ann_sched*	s;
+		struct in6_addr		addr;
+		int			family = strchr(p, ':') ? AF_INET6 : AF_INET;
+
+		if (inet_pton(family, p, &addr) <= 0) {
+			snprintf(err, errlen, "invalid address %s", p);
+			return -1;
+		}
+		if ((family == AF_INET ? dev_arp(dev) : dev_ua(dev)) < 0) {
+			snprintf(err, errlen, "cannot announce %s on %s", p, name);
+			return -1;
+		}
+		if ((s = sched_find(dev, family, &addr)) == NULL) {
+			if (nscheds == maxscheds) {
+				int max = maxscheds ? maxscheds * 2 : 64;
+
+				s = realloc(scheds, max * sizeof(*s));
+				if (s == NULL) {
+					snprintf(err, errlen, "out of memory");
+					return -1;
+				}
+				scheds = s;
+				maxscheds = max;
+			}
+			s = &scheds[nscheds++];
+			memset(s, 0, sizeof(*s));
+			s->dev = dev;
+			s->family = family;
+			memcpy(family == AF_INET ? (void *)&s->v4 : (void *)&s->v6,
+			       &addr, family == AF_INET ? sizeof(s->v4) : sizeof(s->v6));
+		}
+		s->left = count;
+		s->interval = interval;
+		s->next = now;
+	}
+	return 0;
+}
+
+/* cancel <device> <address>... */
+static int
+req_cancel(char* args, char* err, size_t errlen)
+{
+	struct ann_dev*	dev;
+	char*		save = NULL;
+	char*		name = strtok_r(args, " ", &save);
+	char*		p;
+	int		i;
+
+	if (name == NULL) {
+		snprintf(err, errlen, "usage: cancel <device> <address>...");
+		return -1;
+	}
+	for (i = 0, dev = NULL; i < ndevs; i++) {
+		if (strcmp(devs[i]->name, name) == 0) {
+			dev = devs[i];
+		}
+	}
+	while (dev != NULL && (p = strtok_r(NULL, " \n", &save)) != NULL) {
+		struct ann_sched*	s;
+		struct in6_addr		addr;
+		int			family = strchr(p, ':') ? AF_INET6 : AF_INET;
+
+		if (inet_pton(family, p, &addr) > 0
+		    && (s = sched_find(dev, family, &addr)) != NULL) {
+			sched_drop(s);
+		}
+	}
+	return 0;
+}
+
+/* take a request, the answer waits for the next round */
+static void
+client(int lfd)
+{
+	char	buf[ANNOUNCE_MSG_MAX + 1];
+	char	err[256];
+	char	reply[300];
+	int	fd;
+	int	n;
+	int	rc = -1;
+
+	while (npending < PENDING_MAX
+	       && (fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		struct timeval tv = { 1, 0 };
+
+		/* a client sends its request right after connect() */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		n = recv(fd, buf, sizeof(buf) - 1, 0);
+		if (n <= 0) {
+			close(fd);
+			continue;
+		}
+		buf[n] = 0;
+		snprintf(err, sizeof(err), "unknown request");
+		if (strncmp(buf, "announce ", 9) == 0) {
+			rc = req_announce(buf + 9, err, sizeof(err));
+		} else if (strncmp(buf, "cancel ", 7) == 0) {
+			rc = req_cancel(buf + 7, err, sizeof(err));
+		} else if (strncmp(buf, "status", 6) == 0) {
+			snprintf(err, sizeof(err), "%d devices, %d addresses",
+				 ndevs, nscheds);
+			rc = 0;
+		} else {
+			rc = -1;
+		}
+		if (rc < 0) {
+			snprintf(reply, sizeof(reply), "error %s", err);
+			send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+			close(fd);
+			continue;
+		}
+		if (strncmp(buf, "status", 6) == 0) {
+			snprintf(reply, sizeof(reply), "ok %s", err);
+			send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+			close(fd);
+			continue;
+		}
+		pending[npending++] = fd;
+	}
+}
+
+/* the ARPs of the device due now, in as few sendmmsg() as it takes */
+static void
+send_arps(struct ann_dev* dev, struct ann_sched** due, int n)
+{
+	static const unsigned char bcast[ETH_ALEN] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+	int			i;
+	int			k;
+	int			sent;
+
+	for (i = 0; i < n; i += k) {
+		arp_tx_clear(&dev->arp);
+		for (k = 0; k < ARP_BATCH && i + k < n; k++) {
+			arp_tx_add(&dev->arp, ARPOP_REQUEST, ARPHRD_ETHER, ETH_ALEN,
+				   dev->hwaddr, due[i + k]->v4,
+				   bcast, due[i + k]->v4);
+		}
+		if ((sent = arp_tx_send(&dev->arp, dev->arp_fd, 0, k)) < k) {
+			syslog(LOG_WARNING, "%s: %d of %d ARPs not sent: %s",
+			       dev->name, k - sent, k, strerror(errno));
+		}
+	}
+}
+
+/* send what is due, returns when the next round is, -1 for none */
+static long long
+rounds(void)
+{
+	struct ann_sched**	due;
+	long long		now = now_us();
+	long long		next = -1;
+	int			d;
+	int			i;
+	int			n;
+
+	if (nscheds == 0 || (due = malloc(nscheds * sizeof(*due))) == NULL) {
+		return -1;
+	}
+	for (d = 0; d < ndevs; d++) {
+		struct ann_dev* dev = devs[d];
+
+		/* the ARPs, then the advertisements */
+		for (i = 0, n = 0; i < nscheds; i++) {
+			if (scheds[i].dev == dev && scheds[i].family == AF_INET
+			    && scheds[i].next <= now) {
+				due[n++] = &scheds[i];
+			}
+		}
+		if (n > 0) {
+			send_arps(dev, due, n);
+		}
+		dev->ua.count = 0;
+		for (i = 0; i < nscheds; i++) {
+			if (scheds[i].dev == dev && scheds[i].family == AF_INET6
+			    && scheds[i].next <= now) {
+				ua_group_add(&dev->ua, &scheds[i].v6);
+			}
+		}
+		if (dev->ua.count > 0 && ua_group_send(&dev->ua) < 0) {
+			syslog(LOG_WARNING, "%s: advertisements not all sent",
+			       dev->name);
+		}
+	}
+	free(due);
+
+	for (i = 0; i < nscheds; ) {
+		struct ann_sched* s = &scheds[i];
+
+		if (s->next <= now) {
+			/* late rounds are not caught up with */
+			s->next += s->interval * 1000LL;
+			if (s->next < now) {
+				s->next = now + s->interval * 1000LL;
+			}
+			if (--s->left == 0) {
+				sched_drop(s);
+				continue;
+			}
+		}
+		if (next < 0 || s->next < next) {
+			next = s->next;
+		}
+		i++;
+	}
+	return next;
+}
+
+/* addresses and devices going away, from the rtnetlink groups */
+static void
+netlink_event(int fd)
+{
+	char	buf[8192];
+	int	len;
+
+	while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0
+	       || (len < 0 && errno == ENOBUFS)) {
+		struct nlmsghdr* h;
+
+		/* lost some, the schedules run out by themselves anyway */
+		if (len < 0) {
+			continue;
+		}
+		for (h = (struct nlmsghdr *)(void *)buf; NLMSG_OK(h, (unsigned)len);
+		     h = NLMSG_NEXT(h, len)) {
+			int i;
+
+			if (h->nlmsg_type == RTM_DELADDR) {
+				struct ifaddrmsg* ifa = NLMSG_DATA(h);
+				struct rtattr* rta = IFA_RTA(ifa);
+				int alen = IFA_PAYLOAD(h);
+
+				for (; RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen)) {
+					if (rta->rta_type != IFA_LOCAL && !(rta->rta_type
+					    == IFA_ADDRESS && ifa->ifa_family == AF_INET6)) {
+						continue;
+					}
+					for (i = 0; i < nscheds; i++) {
+						struct ann_sched* s = &scheds[i];
+
+						if (s->dev->ifindex == (int)ifa->ifa_index
+						    && s->family == ifa->ifa_family
+						    && !memcmp(s->family == AF_INET
+							? (void *)&s->v4 : (void *)&s->v6,
+							RTA_DATA(rta), RTA_PAYLOAD(rta))) {
+							sched_drop(s);
+							break;
+						}
+					}
+				}
+			} else if (h->nlmsg_type == RTM_DELLINK) {
+				struct ifinfomsg* ifi = NLMSG_DATA(h);
+
+				for (i = 0; i < nscheds; ) {
+					if (scheds[i].dev->ifindex == ifi->ifi_index) {
+						sched_drop(&scheds[i]);
+					} else {
+						i++;
+					}
+				}
+				for (i = 0; i < ndevs; i++) {
+					if (devs[i]->ifindex == ifi->ifi_index) {
+						dev_close(devs[i]);
+						free(devs[i]);
+						devs[i] = devs[--ndevs];
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+static int
+listen_open(const char* path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "announced: %s: path too long\n", path);
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) {
+		perror("announced: socket");
+		return -1;
+	}
+	/* one daemon only, the socket of a dead one is reused */
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+		fprintf(stderr, "announced: already running on %s\n", path);
+		close(fd);
+		return -1;
+	}
+	unlink(path);
+	umask(077);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0
+	    || listen(fd, PENDING_MAX) < 0) {
+		fprintf(stderr, "announced: %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+byebye(int nsig)
+{
+	(void)nsig;
+	quit = 1;
+}
+
+static void
+usage(const char* self)
+{
+	fprintf(stderr, "usage: %s [-f] [-s socket]\n", self);
+}
+
+int
+main(int argc, char* argv[])
+{
+	static const unsigned groups[] = {
+		RTNLGRP_LINK, RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV6_IFADDR,
+	};
+	const char*	path = ANNOUNCE_SOCKET;
+	struct pollfd	pfd[2];
+	struct sigaction act;
+	long long	next = -1;
+	int		foreground = 0;
+	int		ch;
+	int		i;
+
+	while ((ch = getopt(argc, argv, "fs:h")) != EOF) {
+		switch (ch) {
+		case 'f':
+			foreground = 1;
+			break;
+		case 's':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = byebye;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((pfd[0].fd = listen_open(path)) < 0) {
+		return 1;
+	}
+	pfd[1].fd = nl_open(NETLINK_ROUTE, groups, sizeof(groups) / sizeof(groups[0]));
+	if (pfd[1].fd < 0) {
+		perror("announced: netlink");
+		unlink(path);
+		return 1;
+	}
+	pfd[0].events = pfd[1].events = POLLIN;
+
+	openlog("announced", LOG_PID | (foreground ? LOG_PERROR : 0), LOG_DAEMON);
+	if (!foreground && daemon(0, 0) < 0) {
+		perror("announced: daemon");
+		unlink(path);
+		return 1;
+	}
+	syslog(LOG_INFO, "listening on %s", path);
+
+	while (!quit) {
+		long long	wait = next < 0 ? -1 : next - now_us();
+
+		if (poll(pfd, 2, wait < 0 ? (next < 0 ? -1 : 0)
+			 : (int)((wait + 999) / 1000)) < 0) {
+			continue;
+		}
+		if (pfd[1].revents & POLLIN) {
+			netlink_event(pfd[1].fd);
+		}
+		if (pfd[0].revents & POLLIN) {
+			client(pfd[0].fd);
+		}
+		next = rounds();
+		for (i = 0; i < npending; i++) {
+			send(pending[i], "ok", 2, MSG_NOSIGNAL);
+			close(pending[i]);
+		}
+		npending = 0;
+	}
+
+	for (i = 0; i < ndevs; i++) {
+		dev_close(devs[i]);
+	}
+	unlink(path);
+	syslog(LOG_INFO, "stopped");
+	return 0;
+}
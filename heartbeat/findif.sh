@@ -192,6 +192,34 @@ findif_check_params()
   return $OCF_SUCCESS
 }
 
+# Let the findif binary do all of the below in one go, it reads
+# the same OCF_RESKEY_* variables and prints shell assignments.
+# Returns 255 if there is no findif with -e.
+findif_exec()
+{
+  local validate= out rc
+  local family nic netmask broadcast warning errmsg
+  local assigned_nic assigned_netmask assigned_label
+
+  [ -x "$HA_BIN/findif" ] || return 255
+  case $__OCF_ACTION in
+      start|validate-all)	validate=-V;;
+  esac
+  out=`$HA_BIN/findif -e $validate 2>/dev/null`
+  rc=$?
+  case "$out" in
+      family=*)	eval "$out";;
+      *)	return 255;;
+  esac
+  [ -n "$warning" ] && ocf_log warn "$warning"
+  if [ $rc -ne $OCF_SUCCESS ] ; then
+    ocf_log err "$errmsg"
+    return $rc
+  fi
+  echo "$nic netmask $netmask broadcast $broadcast"
+  return $OCF_SUCCESS
+}
+
 findif()
 {
   local match="$OCF_RESKEY_ip"
@@ -200,6 +228,11 @@ findif()
   local nic="$OCF_RESKEY_nic"
   local netmask="$OCF_RESKEY_cidr_netmask"
   local brdcast="$OCF_RESKEY_broadcast"
+  local rc
+
+  findif_exec
+  rc=$?
+  [ $rc -ne 255 ] && return $rc
 
   echo $match | grep -qs ":"
   if [ $? = 0 ] ; then
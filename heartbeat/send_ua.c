@@ -20,6 +20,7 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
+#include <config.h>
 #include <IPv6addr.h>
 
 #include <stdio.h>
@@ -36,26 +37,28 @@
 
 static void usage_send_ua(const char* self);
 static void byebye(int nsig);
+static int add_target(const char* ipv6addr, const char* ifname);
+static int read_targets(const char* path);
+
+/* one group of addresses per interface */
+static struct ua_group*	groups = NULL;
+static int		ngroups = 0;
 
 int
 main(int argc, char* argv[])
 {
-	char*		ipv6addr;
 	int		count = UA_REPEAT_COUNT;
 	int		interval = 1000;	/* default 1000 msec */
 	int		ch;
 	int		i;
-	char*		cp;
-	char*		prov_ifname = NULL;
-	struct in6_addr	addr6;
+	int		g;
+	int		status = OCF_SUCCESS;
+	int		delegated = 0;
+	char*		file = NULL;
+	struct timespec	next;
 	struct sigaction act;
 
-	/* Check binary name */
-	if (argc < 4) {
-		usage_send_ua(argv[0]);
-		return OCF_ERR_ARGS;
-	}
-	while ((ch = getopt(argc, argv, "h?c:i:")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?c:i:f:")) != EOF) {
 		switch(ch) {
 		case 'c': /* count option */
 			count = atoi(optarg);
@@ -63,6 +66,9 @@ main(int argc, char* argv[])
 		case 'i': /* interval option */
 			interval = atoi(optarg);
 		    break;
+		case 'f': /* address list */
+			file = optarg;
+		    break;
 		case 'h':
 		case '?':
 		default:
@@ -70,6 +76,11 @@ main(int argc, char* argv[])
 			return OCF_ERR_ARGS;
 		}
 	}
+	/* IPv6-Address Prefix Interface, as many as needed */
+	if ((argc - optind) % 3 != 0 || (file == NULL && optind == argc)) {
+		usage_send_ua(argv[0]);
+		return OCF_ERR_ARGS;
+	}
 
 	/* set termination signal */
 	memset(&act, 0, sizeof(struct sigaction));
@@ -80,45 +91,133 @@ main(int argc, char* argv[])
 		return OCF_ERR_GENERIC;
 	}
 
-	ipv6addr = argv[optind];
+	/* Check whether this system supports IPv6 */
+	if (access(IF_INET6, R_OK)) {
+		printf("ERROR: No support for INET6 on this system.");
+		return OCF_ERR_GENERIC;
+	}
+
+	for (i = optind; i < argc; i += 3) {
+		if ((status = add_target(argv[i], argv[i + 2])) != OCF_SUCCESS) {
+			return status;
+		}
+	}
+	if (file != NULL && (status = read_targets(file)) != OCF_SUCCESS) {
+		return status;
+	}
 
-	if (ipv6addr == NULL) {
-		printf("ERROR: Please set OCF_RESKEY_ipv6addr to the IPv6 address you want to manage.");
-		usage_send_ua(argv[0]);
-		return OCF_ERR_ARGS;
+	/* announced sends them, if it runs */
+	for (g = 0; g < ngroups; g++) {
+		if (ua_group_delegate(&groups[g], count, interval) == 0) {
+			groups[g].count = 0;
+			delegated++;
+		}
+	}
+
+	/* Send unsolicited advertisement packets to neighbor, one round
+	 * for all the addresses every interval
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (i = 0; i < count && delegated < ngroups; i++) {
+		if (i > 0) {
+			ua_wait(&next, interval);
+		}
+		for (g = 0; g < ngroups; g++) {
+			if (ua_group_send(&groups[g]) < 0) {
+				status = OCF_ERR_GENERIC;
+			}
+		}
+	}
+
+	for (g = 0; g < ngroups; g++) {
+		ua_group_close(&groups[g]);
 	}
+	free(groups);
+	return status;
+}
+
+/* add an address to the group of its interface */
+static int
+add_target(const char* ipv6addr, const char* ifname)
+{
+	struct in6_addr	addr6;
+	char		buf[INET6_ADDRSTRLEN + 8];
+	char*		cp;
+	int		g;
 
 	/* legacy option */
-	if ((cp = strchr(ipv6addr, '/'))) {
+	snprintf(buf, sizeof(buf), "%s", ipv6addr);
+	if ((cp = strchr(buf, '/'))) {
 		*cp=0;
 	}
 
-	prov_ifname = argv[optind+2];
-
-	if (inet_pton(AF_INET6, ipv6addr, &addr6) <= 0) {
+	if (inet_pton(AF_INET6, buf, &addr6) <= 0) {
 		printf("ERROR: Invalid IPv6 address [%s]", ipv6addr);
-		usage_send_ua(argv[0]);
 		return OCF_ERR_ARGS;
 	}
 
-	/* Check whether this system supports IPv6 */
-	if (access(IF_INET6, R_OK)) {
-		printf("ERROR: No support for INET6 on this system.");
-		return OCF_ERR_GENERIC;
+	for (g = 0; g < ngroups; g++) {
+		if (strcmp(groups[g].if_name, ifname) == 0) {
+			break;
+		}
 	}
+	if (g == ngroups) {
+		struct ua_group* more = realloc(groups, (ngroups + 1) * sizeof(*more));
 
-	/* Send unsolicited advertisement packet to neighbor */
-	for (i = 0; i < count; i++) {
-		send_ua(&addr6, prov_ifname);
-		usleep(interval * 1000);
+		if (more == NULL) {
+			printf("ERROR: malloc for interfaces failed");
+			return OCF_ERR_GENERIC;
+		}
+		groups = more;
+		if (ua_group_open(&groups[g], ifname) < 0) {
+			return OCF_ERR_GENERIC;
+		}
+		ngroups++;
+	}
+	if (ua_group_add(&groups[g], &addr6) < 0) {
+		return OCF_ERR_GENERIC;
 	}
-
 	return OCF_SUCCESS;
 }
 
+/*
+ * Addresses from a file, "-" for stdin, one per line:
+ *	IPv6-Address[/Prefix] [Prefix] Interface
+ */
+static int
+read_targets(const char* path)
+{
+	FILE*	f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	char	line[256];
+	char	field[3][INET6_ADDRSTRLEN + 8];
+	int	n;
+	int	status = OCF_SUCCESS;
+
+	if (f == NULL) {
+		printf("ERROR: Cannot open %s: %s", path, strerror(errno));
+		return OCF_ERR_ARGS;
+	}
+	while (status == OCF_SUCCESS && fgets(line, sizeof(line), f) != NULL) {
+		n = sscanf(line, "%45s %45s %45s", field[0], field[1], field[2]);
+		if (n <= 0 || field[0][0] == '#') {
+			continue;
+		}
+		if (n < 2) {
+			printf("ERROR: No interface for [%s]", field[0]);
+			status = OCF_ERR_ARGS;
+			break;
+		}
+		status = add_target(field[0], field[n - 1]);
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+	return status;
+}
+
 static void usage_send_ua(const char* self)
 {
-	printf("usage: %s [-i[=Interval]] [-c[=Count]] [-h] IPv6-Address Prefix Interface\n",self);
+	printf("usage: %s [-i[=Interval]] [-c[=Count]] [-f File|-] [-h] [IPv6-Address Prefix Interface]...\n",self);
 	return;
 }
 
@@ -21,8 +21,10 @@
 
 #ifndef OCF_IPV6_HELPER_H
 #define OCF_IPV6_HELPER_H
-#include <netinet/icmp6.h>
 #include <config.h>
+#include <netinet/icmp6.h>
+#include <net/if.h>
+#include <time.h>
 /*
 0	No error, action succeeded completely
 1 	generic or unspecified error (current practice)
@@ -54,5 +56,44 @@
 #define  BCAST_ADDR "ff02::1"
 #define IF_INET6 "/proc/net/if_inet6"
 
+/* unsolicited neighbor advertisements */
+struct ua_payload {
+	struct nd_neighbor_advert	na;
+	struct nd_opt_hdr		opt;
+	u_int8_t			hwaddr[HWADDR_LEN];
+};
+struct ua_sender {
+	int			fd;
+	char*			if_name;
+	struct sockaddr_in6	dst;
+	struct ua_payload	payload;
+};
+int ua_open(struct ua_sender* ua, struct in6_addr* src_ip, char* if_name);
+int ua_send(struct ua_sender* ua);
+void ua_close(struct ua_sender* ua);
+void ua_wait(struct timespec* next, int interval);
+
+/* advertisements of many addresses of one interface, one socket and
+ * one sendmmsg() per round for all of them */
+struct ua_target {
+	struct ua_payload	payload;
+	struct in6_addr		addr;
+};
+struct ua_group {
+	int			fd;
+	char			if_name[IF_NAMESIZE];
+	unsigned int		ifindex;
+	u_int8_t		hwaddr[HWADDR_LEN];
+	struct sockaddr_in6	dst;
+	struct ua_target*	targets;
+	int			count;
+	int			max;
+};
+int ua_group_open(struct ua_group* g, const char* if_name);
+int ua_group_add(struct ua_group* g, struct in6_addr* addr);
+int ua_group_send(struct ua_group* g);
+void ua_group_close(struct ua_group* g);
+int ua_group_delegate(struct ua_group* g, int count, int interval);
+int announce_request(const char* req);
 int send_ua(struct in6_addr* src_ip, char* if_name);
 #endif
@@ -0,0 +1,39 @@
+/*
+ * announced: one daemon sending the gratuitous ARPs and the unsolicited
+ * neighbor advertisements of addresses taken over, rather than a
+ * send_arp or send_ua process for each of them.
+ *
+ * Requests are single messages on a SOCK_SEQPACKET unix socket,
+ * answered with "ok" or "error <why>":
+ *
+ *	announce <device> <count> <interval-ms> <address>...
+ *	cancel <device> <address>...
+ *	status
+ *
+ * The first round of an announce is sent before the answer. Another
+ * announce of an address already scheduled starts it over, and the
+ * schedule ends early when the address or the device goes away.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ANNOUNCE_H
+#define ANNOUNCE_H
+#include <config.h>
+
+#define ANNOUNCE_SOCKET		HA_RSCTMPDIR "/announced.sock"
+#define ANNOUNCE_MSG_MAX	65536
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * arp_tx: the packet socket ARP transmit path of send_arp (both builds),
+ * ethmonitor_check and announced.
+ *
+ * ARP frames are built once into a buffer that lives as long as the
+ * program, and sent, all of them or a slice, with one sendmmsg() on a
+ * PF_PACKET socket. The kernel adds the link layer header for the
+ * destination given with arp_tx_dest().
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ARP_TX_H
+#define ARP_TX_H
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <time.h>
+
+#define ARP_TX_FRAME_MAX	256
+
+struct arp_tx {
+	int n, max;
+	unsigned char (*frame)[ARP_TX_FRAME_MAX];
+	struct iovec *iov;
+	struct mmsghdr *msg;
+	struct sockaddr_storage dst;
+	socklen_t dstlen;
+};
+
+/* room for max frames; 0, or -1 with errno set */
+int arp_tx_init(struct arp_tx *tx, int max);
+void arp_tx_free(struct arp_tx *tx);
+
+/* where the frames go; the hardware address may be longer than sll_addr */
+void arp_tx_dest(struct arp_tx *tx, const struct sockaddr_ll *dst);
+
+/* drop the frames built so far, to build them again */
+void arp_tx_clear(struct arp_tx *tx);
+
+/* append one frame; its index, or -1 when full or too long */
+int arp_tx_add(struct arp_tx *tx, int op, int hrd, int halen,
+	       const unsigned char *sha, struct in_addr sip,
+	       const unsigned char *tha, struct in_addr tip);
+
+/*
+ * Send count frames from first on. A frame that fails is skipped;
+ * the number sent is returned, and errno tells about the last failure
+ * when it is short.
+ */
+int arp_tx_send(struct arp_tx *tx, int fd, int first, int count);
+
+/* sleep until ms after t0 on CLOCK_MONOTONIC, through signals */
+void arp_tx_sleep_until(const struct timespec *t0, long ms);
+
+#endif /* __linux__ */
+#endif
@@ -0,0 +1,55 @@
+/*
+ * nl_util: the netlink requests shared by findif, IPv6addr, announced,
+ * send_arp, ethmonitor_check and tickle_tcp.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NL_UTIL_H
+#define NL_UTIL_H
+#ifdef __linux__
+
+#include <linux/netlink.h>
+
+#define NL_BUFSIZE	32768
+
+/*
+ * A bound netlink socket of protocol proto (NETLINK_ROUTE, ...), a
+ * member of the ngroups multicast groups (RTNLGRP_LINK, ...) given.
+ * -1 with errno set on failure.
+ */
+int nl_open(int proto, const unsigned *groups, int ngroups);
+
+/* append an attribute to a request built in a large enough buffer */
+void nl_addattr(struct nlmsghdr *n, int type, const void *data, int alen);
+
+/*
+ * Send one request and feed every reply message to cb (if any), until
+ * the end of the dump, or the single answer to a plain request.
+ * Returns 0, or the (positive) errno reported by the kernel, or -1.
+ */
+int nl_talk(int fd, struct nlmsghdr *req,
+	    void (*cb)(const struct nlmsghdr *, void *), void *arg);
+
+/*
+ * Send count requests, laid out one after the other in req, with one
+ * send() and collect the acknowledgement of each: errors[i] is 0 or the
+ * (positive) errno the kernel answered request i with. The requests
+ * must ask for NLM_F_ACK. Returns 0, or -1 if the exchange failed.
+ */
+int nl_talk_batch(int fd, char *req, int len, int count, int *errors);
+
+#endif /* __linux__ */
+#endif
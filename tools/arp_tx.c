@@ -0,0 +1,163 @@
+/*
+ * arp_tx: the packet socket ARP transmit path of send_arp (both builds),
+ * ethmonitor_check and announced.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <net/if_arp.h>
+#include <linux/if_ether.h>
+
+#include <arp_tx.h>
+
+#ifdef __linux__
+
+int
+arp_tx_init(struct arp_tx *tx, int max)
+{
+	memset(tx, 0, sizeof(*tx));
+	tx->frame = calloc(max, sizeof(*tx->frame));
+	tx->iov = calloc(max, sizeof(*tx->iov));
+	tx->msg = calloc(max, sizeof(*tx->msg));
+	if (!tx->frame || !tx->iov || !tx->msg) {
+		arp_tx_free(tx);
+		errno = ENOMEM;
+		return -1;
+	}
+	tx->max = max;
+	return 0;
+}
+
+void
+arp_tx_free(struct arp_tx *tx)
+{
+	free(tx->frame);
+	free(tx->iov);
+	free(tx->msg);
+	memset(tx, 0, sizeof(*tx));
+}
+
+void
+arp_tx_dest(struct arp_tx *tx, const struct sockaddr_ll *dst)
+{
+	socklen_t len = offsetof(struct sockaddr_ll, sll_addr) + dst->sll_halen;
+
+	if (len < sizeof(struct sockaddr_ll))
+		len = sizeof(struct sockaddr_ll);
+	if (len > sizeof(tx->dst))
+		len = sizeof(tx->dst);
+	memcpy(&tx->dst, dst, len);
+	tx->dstlen = len;
+}
+
+void
+arp_tx_clear(struct arp_tx *tx)
+{
+	tx->n = 0;
+}
+
+int
+arp_tx_add(struct arp_tx *tx, int op, int hrd, int halen,
+	   const unsigned char *sha, struct in_addr sip,
+	   const unsigned char *tha, struct in_addr tip)
+{
+	unsigned char *buf, *p;
+	struct arphdr *ah;
+	int i = tx->n;
+
+	if (i >= tx->max || sizeof(*ah) + 2 * (halen + 4) > ARP_TX_FRAME_MAX)
+		return -1;
+
+	buf = tx->frame[i];
+	ah = (struct arphdr *)buf;
+	p = (unsigned char *)(ah + 1);
+	ah->ar_hrd = htons(hrd);
+	ah->ar_pro = htons(ETH_P_IP);
+	ah->ar_hln = halen;
+	ah->ar_pln = 4;
+	ah->ar_op = htons(op);
+	memcpy(p, sha, halen);
+	p += halen;
+	memcpy(p, &sip, 4);
+	p += 4;
+	memcpy(p, tha, halen);
+	p += halen;
+	memcpy(p, &tip, 4);
+	p += 4;
+
+	tx->iov[i].iov_base = buf;
+	tx->iov[i].iov_len = p - buf;
+	memset(&tx->msg[i], 0, sizeof(tx->msg[i]));
+	/* the destination is read at send time, arp_tx_dest() may follow */
+	tx->msg[i].msg_hdr.msg_name = &tx->dst;
+	tx->msg[i].msg_hdr.msg_iov = &tx->iov[i];
+	tx->msg[i].msg_hdr.msg_iovlen = 1;
+	tx->n++;
+	return i;
+}
+
+int
+arp_tx_send(struct arp_tx *tx, int fd, int first, int count)
+{
+	int done = 0, sent = 0, failed = 0, rc, i;
+
+	if (first < 0 || first + count > tx->n)
+		count = first < 0 || first >= tx->n ? 0 : tx->n - first;
+	for (i = first; i < first + count; i++)
+		tx->msg[i].msg_hdr.msg_namelen = tx->dstlen;
+
+	while (done < count) {
+		rc = sendmmsg(fd, tx->msg + first + done, count - done, 0);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			/* a short count means the next one failed, skip it */
+			failed = errno;
+			done++;
+			continue;
+		}
+		done += rc;
+		sent += rc;
+	}
+	if (failed)
+		errno = failed;
+	return sent;
+}
+
+void
+arp_tx_sleep_until(const struct timespec *t0, long ms)
+{
+	struct timespec t = *t0;
+
+	t.tv_sec += ms / 1000;
+	t.tv_nsec += (ms % 1000) * 1000000L;
+	if (t.tv_nsec >= 1000000000L) {
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000L;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+		;
+}
+
+#endif /* __linux__ */
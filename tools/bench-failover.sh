@@ -0,0 +1,284 @@
+#!/bin/sh
+
+# Benchmark of the network tools run on IP failover: tickle_tcp,
+# send_arp and send_ua. Everything happens in throwaway network
+# namespaces connected by a veth pair, no external network is used.
+#
+# Topology: a "client" namespace talks to the service address in an
+# "active" namespace. Failover moves the server end of the veth pair,
+# together with the service address, to a "standby" namespace which
+# has none of the connection state, exactly like a cluster node
+# taking over an IP address.
+#
+#   tickle_tcp  COUNT connections are established, failover happens,
+#               tickle_tcp is run on the standby with the state file
+#               saved on the active node; measured until the client
+#               saw the last connection reset. tickle_tcp6 is the
+#               same over IPv6.
+#   send_arp    the standby uses a new MAC address; measured until
+#               the client neighbour table has it.
+#   send_ua     the same for IPv6 unsolicited neighbour advertisements.
+#
+# Runs unprivileged in a user+net+mount namespace (unshare -Urnm),
+# as root it only unshares the net and mount namespaces.
+#
+# Usage: bench-failover.sh [-n count[,count...]] [test...]
+
+export LC_ALL=C
+test -n "$BASH_VERSION" && set -o posix
+set -u
+
+die() { echo "$*" >&2; exit 255; }
+warn() { echo "> $*" >&2; }
+
+HERE="$(dirname "$0")"
+
+#
+# soft-config
+#
+
+: "${BUILDDIR:=${HERE}}"
+: "${TICKLE_TCP:=${BUILDDIR}/tickle_tcp}"
+: "${SEND_ARP:=${BUILDDIR}/send_arp}"
+: "${SEND_UA:=${BUILDDIR}/../heartbeat/send_ua}"
+: "${BENCH_CONNS:=${BUILDDIR}/bench_conns}"
+: "${VERSION:=unknown}"
+
+: ${CONNS:=1000,10000}
+: ${TICKLE_NUM:=1}
+: ${ARP_REPEAT:=5}
+: ${ARP_INTERVAL:=200}
+: ${PORT:=20000}
+: ${IDLE:=5}
+: ${TIMEOUT:=10000}
+
+: ${VIP4:=198.51.100.100}
+: ${CLIENT4:=198.51.100.1}
+: ${VIP6:=2001:db8::100}
+: ${CLIENT6:=2001:db8::1}
+: ${ACTIVE_MAC:=02:00:00:00:00:0a}
+: ${STANDBY_MAC:=02:00:00:00:00:0b}
+
+#
+# command-line config
+#
+
+while getopts "n:h" opt; do
+	case $opt in
+	n) CONNS=$OPTARG ;;
+	*) die "Usage: $0 [-n count[,count...]] [tickle_tcp] [tickle_tcp6] [send_arp] [send_ua]" ;;
+	esac
+done
+shift $((OPTIND - 1))
+TESTS="${*:-tickle_tcp tickle_tcp6 send_arp send_ua}"
+
+#
+# get a private network (and mount) namespace
+#
+
+if [ -z "${BENCH_NS:-}" ]; then
+	export BENCH_NS=1
+	if [ "$(id -u)" -eq 0 ]; then
+		exec unshare -nm --propagation private "$0" -n "$CONNS" $TESTS
+	fi
+	exec unshare -Urnm --propagation private "$0" -n "$CONNS" $TESTS
+fi
+# "ip netns" keeps its mounts under /run/netns
+mount -t tmpfs bench /run || die "Cannot mount tmpfs on /run"
+
+TMP=$(mktemp -d) || die "Cannot create temporary directory"
+trap 'kill $(jobs -p) 2>/dev/null; ip -all netns delete 2>/dev/null; rm -rf "$TMP"' EXIT
+
+#
+# helpers
+#
+
+# ns NAME command... (not for background jobs, $! would be the subshell)
+ns () {
+	_ns=$1; shift
+	ip netns exec bench-$_ns "$@"
+}
+
+now () {
+	"$BENCH_CONNS" now
+}
+
+# ms_between START_NS END_NS
+ms_between () {
+	awk -v a="$1" -v b="$2" 'BEGIN { printf "%.1f", (b - a) / 1000000 }'
+}
+
+# wait_for FILE PATTERN: wait for a background helper to report
+wait_for () {
+	_i=0
+	while ! grep -q "$2" "$1" 2>/dev/null; do
+		_i=$((_i + 1))
+		[ $_i -gt $((TIMEOUT / 50)) ] && return 1
+		sleep 0.05
+	done
+}
+
+ns_sysctl () {
+	ns $1 sh -c "echo '$3' > /proc/sys/$2" 2>/dev/null \
+		|| warn "Cannot set $2 in $1, results may suffer."
+}
+
+setup () {
+	for n in client active standby; do
+		ip netns add bench-$n || die "Cannot create namespace bench-$n."
+		ip -n bench-$n link set lo up
+	done
+	ip link add c0 netns bench-client type veth \
+		peer name a0 netns bench-active address $ACTIVE_MAC \
+		|| die "Cannot create veth pair."
+
+	ip -n bench-client addr add $CLIENT4/24 dev c0
+	ip -n bench-client addr add $CLIENT6/64 dev c0 nodad
+	ip -n bench-client link set c0 up
+	ip -n bench-active addr add $VIP4/24 dev a0
+	ip -n bench-active addr add $VIP6/64 dev a0 nodad
+	ip -n bench-active link set a0 up
+
+	ns_sysctl client net/ipv4/tcp_challenge_ack_limit 2147483647
+	ns_sysctl active net/core/somaxconn 2147483647
+	ns_sysctl active net/ipv4/tcp_max_syn_backlog 2147483647
+}
+
+teardown () {
+	ip -all netns delete
+}
+
+# failover [MAC]: move the service address over to the standby
+failover () {
+	ip -n bench-active link set a0 netns bench-standby || die "Cannot move a0."
+	[ -n "${1:-}" ] && ip -n bench-standby link set a0 address $1
+	ip -n bench-standby addr add $VIP4/24 dev a0
+	ip -n bench-standby addr add $VIP6/64 dev a0 nodad
+	ip -n bench-standby link set a0 up
+}
+
+# row test family count setup_ms tool_ms effect_ms result
+row () {
+	printf "%-12s %-6s %9s %10s %10s %10s  %s\n" "$@"
+}
+
+#
+# tests
+#
+
+# bench_tickle_tcp count family vip
+bench_tickle_tcp () {
+	count=$1 family=$2 vip=$3
+	nports=$(( (count + 59999) / 60000 ))
+
+	[ -x "$TICKLE_TCP" ] || { warn "No $TICKLE_TCP, skipping."; return; }
+	setup
+	ip netns exec bench-active "$BENCH_CONNS" serve $vip $PORT $nports $count > $TMP/serve &
+	spid=$!
+	wait_for $TMP/serve ready || die "Server did not start."
+
+	t0=$(now)
+	ip netns exec bench-client "$BENCH_CONNS" connect $vip $PORT $nports $count $IDLE > $TMP/conn &
+	cpid=$!
+	wait_for $TMP/conn ready || die "Connections were not established."
+	t1=$(now)
+
+	# what portblock saves on the active node
+	case $vip in
+	*:*) filter="[$vip]" ;;
+	*) filter=$vip ;;
+	esac
+	ns active ss -Htn state established src "$filter" \
+		| awk '{ gsub(/[][]/, ""); print $3 "\t" $4 }' \
+		| "$TICKLE_TCP" -d $TMP/state || die "Cannot save connections."
+
+	failover
+	kill $spid
+
+	t2=$(now)
+	ns standby "$TICKLE_TCP" -n $TICKLE_NUM -f $TMP/state
+	t3=$(now)
+	wait $cpid
+	set -- $(tail -n1 $TMP/conn)
+	if [ "$1" = done ]; then
+		resets=$2 last=$3
+	else
+		resets=0 last=0
+	fi
+
+	if [ "$last" -eq 0 ]; then
+		effect=-
+	else
+		effect=$(ms_between $t2 $last)
+	fi
+	row tickle_tcp $family $count $(ms_between $t0 $t1) \
+		$(ms_between $t2 $t3) $effect "$resets/$count reset"
+	teardown
+}
+
+# bench_announce test family tool args...
+bench_announce () {
+	name=$1 family=$2 vip=$3 tool=$4
+	shift 4
+
+	[ -x "$tool" ] || { warn "No $tool, skipping."; return; }
+	setup
+	failover $STANDBY_MAC
+	# the client still knows the old address
+	ip -n bench-client neigh replace $vip lladdr $ACTIVE_MAC dev c0 nud stale
+	# updates within locktime (1s) of the last one are ignored
+	sleep 1.1
+
+	ip netns exec bench-client "$BENCH_CONNS" neighwait $vip $STANDBY_MAC $TIMEOUT > $TMP/neigh &
+	npid=$!
+	wait_for $TMP/neigh ready || die "Neighbour watcher did not start."
+
+	t0=$(now)
+	ns standby "$tool" "$@" >/dev/null
+	t1=$(now)
+	if wait $npid; then
+		effect=$(ms_between $t0 $(tail -n1 $TMP/neigh))
+		result=updated
+	else
+		effect=-
+		result="not updated"
+	fi
+	row $name $family 1 - $(ms_between $t0 $t1) $effect "$result"
+	teardown
+}
+
+#
+# main
+#
+
+[ -x "$BENCH_CONNS" ] || die "Forgot to compile $BENCH_CONNS?"
+
+echo "# resource-agents $VERSION, kernel $(uname -r), $(date -u +%Y-%m-%dT%H:%M:%SZ)"
+row "# test" family count setup_ms tool_ms effect_ms result
+
+for t in $TESTS; do
+	case $t in
+	tickle_tcp)
+		for count in $(echo $CONNS | tr , ' '); do
+			bench_tickle_tcp $count inet $VIP4
+		done
+		;;
+	tickle_tcp6)
+		for count in $(echo $CONNS | tr , ' '); do
+			bench_tickle_tcp $count inet6 $VIP6
+		done
+		;;
+	send_arp)
+		bench_announce send_arp inet $VIP4 "$SEND_ARP" \
+			-i $ARP_INTERVAL -r $ARP_REPEAT -p $TMP/send_arp.pid \
+			a0 $VIP4 auto not_used not_used
+		;;
+	send_ua)
+		bench_announce send_ua inet6 $VIP6 "$SEND_UA" \
+			-i $ARP_INTERVAL -c $ARP_REPEAT $VIP6 64 a0
+		;;
+	*)
+		warn "Unknown test $t"
+		;;
+	esac
+done
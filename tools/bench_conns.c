@@ -0,0 +1,429 @@
+/*
+   Helper for bench-failover.sh: synthetic TCP connections and
+   neighbour table watching, with CLOCK_MONOTONIC timestamps so that
+   the script can relate events in different network namespaces.
+
+	bench_conns now
+		print the current time (ns)
+
+	bench_conns serve ADDR PORT NPORTS COUNT
+		listen on ADDR, ports PORT .. PORT+NPORTS-1, with a backlog
+		big enough for COUNT connections. Connections are never
+		accepted: the handshake completes in the kernel and the
+		sockets sit in the accept queue, so the server holds no
+		file descriptors for them.
+
+	bench_conns connect ADDR PORT NPORTS COUNT IDLE
+		open COUNT connections to ADDR, spread over the ports
+		(at most 60000 per port), print
+		"ready COUNT" once all are established, then wait for them
+		to be reset. Exits after all of them were reset, or IDLE
+		seconds after the last reset, printing
+		"done RESETS LAST_RESET_NS".
+
+	bench_conns neighwait ADDR LLADDR TIMEOUT
+		print "ready" once subscribed to neighbour updates, then
+		wait until the neighbour entry of ADDR has the link layer
+		address LLADDR and print the time it happened (ns).
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include <nl_util.h>
+#include "tickle_state.h"
+
+#define BENCH_BATCH	1024
+#define BENCH_NLBUF	65536
+#define BENCH_SPORT	1024	/* first source port, 60000 per server port */
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int serve(const char *addr, unsigned port, unsigned nports, unsigned long count)
+{
+	sock_addr sa;
+	unsigned i;
+	int one = 1;
+	int backlog = count / nports + 1;
+
+	for (i = 0; i < nports; i++) {
+		int s;
+
+		if (parse_ip(addr, NULL, port + i, &sa) != 0) {
+			fprintf(stderr, "Bad address '%s'\n", addr);
+			return -1;
+		}
+		s = socket(sa.sa.sa_family, SOCK_STREAM, 0);
+		if (s == -1) {
+			fprintf(stderr, "Failed to open socket (%s)\n", strerror(errno));
+			return -1;
+		}
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(s, &sa.sa, sa.sa.sa_family == AF_INET ?
+			 sizeof(sa.ip) : sizeof(sa.ip6)) != 0
+		||  listen(s, backlog) != 0) {
+			fprintf(stderr, "Failed to listen on %s:%u (%s)\n",
+				addr, port + i, strerror(errno));
+			return -1;
+		}
+	}
+	printf("ready\n");
+	fflush(stdout);
+	for (;;)
+		pause();
+	return 0;
+}
+
+/*
+ * Open count connections from one process and wait for them to be
+ * reset. Reports through the pipe fd "ready N" and "done N NS".
+ */
+static int connect_worker(const char *addr, unsigned port, unsigned nports,
+			  unsigned long first, unsigned long count, int idle, int out)
+{
+	struct epoll_event ev[BENCH_BATCH];
+	unsigned long opened = 0, established = 0, resets = 0;
+	unsigned long long last = 0;
+	unsigned long idx;
+	sock_addr sa, local;
+	socklen_t alen;
+	char line[64];
+	int ep, n, i, one = 1;
+
+	if (parse_ip(addr, NULL, port, &sa) != 0) {
+		fprintf(stderr, "Bad address '%s'\n", addr);
+		return -1;
+	}
+	alen = sa.sa.sa_family == AF_INET ? sizeof(sa.ip) : sizeof(sa.ip6);
+
+	ep = epoll_create1(0);
+	if (ep == -1) {
+		fprintf(stderr, "Failed epoll_create1() (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	/* keep a bounded number of handshakes in flight */
+	while (established < count) {
+		while (opened < count && opened - established < BENCH_BATCH) {
+			struct epoll_event e;
+			int s;
+
+			idx = first + opened;
+			s = socket(sa.sa.sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+			if (s == -1) {
+				fprintf(stderr, "Failed to open socket (%s)\n",
+					strerror(errno));
+				return -1;
+			}
+			/*
+			 * Pick the source port ourselves: with many thousand
+			 * connections the kernel's search for a free ephemeral
+			 * port gets slower with every connect().
+			 */
+			memset(&local, 0, sizeof(local));
+			local.sa.sa_family = sa.sa.sa_family;
+			if (sa.sa.sa_family == AF_INET) {
+				local.ip.sin_port = htons(BENCH_SPORT + idx / nports);
+				sa.ip.sin_port = htons(port + idx % nports);
+			} else {
+				local.ip6.sin6_port = htons(BENCH_SPORT + idx / nports);
+				sa.ip6.sin6_port = htons(port + idx % nports);
+			}
+			setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(s, &local.sa, alen) != 0) {
+				fprintf(stderr, "Failed to bind (%s)\n", strerror(errno));
+				return -1;
+			}
+			if (connect(s, &sa.sa, alen) != 0
+			&&  errno != EINPROGRESS) {
+				fprintf(stderr, "Failed to connect (%s)\n", strerror(errno));
+				return -1;
+			}
+			e.events = EPOLLOUT;
+			e.data.fd = s;
+			epoll_ctl(ep, EPOLL_CTL_ADD, s, &e);
+			opened++;
+		}
+		n = epoll_wait(ep, ev, BENCH_BATCH, -1);
+		for (i = 0; i < n; i++) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+
+			getsockopt(ev[i].data.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			if (err) {
+				fprintf(stderr, "Failed to connect (%s)\n", strerror(err));
+				return -1;
+			}
+			ev[i].events = EPOLLRDHUP;
+			epoll_ctl(ep, EPOLL_CTL_MOD, ev[i].data.fd, &ev[i]);
+			established++;
+		}
+	}
+	n = snprintf(line, sizeof(line), "ready %lu\n", count);
+	if (write(out, line, n) != n)
+		return -1;
+
+	/* EPOLLERR and EPOLLHUP are always reported */
+	while (resets < count) {
+		n = epoll_wait(ep, ev, BENCH_BATCH, last ? idle * 1000 : -1);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		last = now_ns();
+		for (i = 0; i < n; i++) {
+			epoll_ctl(ep, EPOLL_CTL_DEL, ev[i].data.fd, NULL);
+			close(ev[i].data.fd);
+		}
+		resets += n;
+	}
+	n = snprintf(line, sizeof(line), "done %lu %llu\n", resets, last);
+	return write(out, line, n) == n ? 0 : -1;
+}
+
+/*
+ * One process can only hold RLIMIT_NOFILE descriptors, so fan the
+ * connections out over as many workers as needed and sum up.
+ */
+static int connect_all(const char *addr, unsigned port, unsigned nports,
+		       unsigned long count, int idle)
+{
+	struct rlimit rl;
+	unsigned long per, first, ready = 0, resets = 0;
+	unsigned long long last = 0;
+	int pfd[2];
+	int workers = 0, rc = 0;
+	FILE *in;
+	char line[64];
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	per = rl.rlim_cur > 64 ? rl.rlim_cur - 32 : 32;
+	if (per > count)
+		per = count;
+
+	if (pipe(pfd) != 0) {
+		fprintf(stderr, "Failed pipe() (%s)\n", strerror(errno));
+		return -1;
+	}
+	for (first = 0; first < count; first += per) {
+		unsigned long n = count - first < per ? count - first : per;
+
+		switch (fork()) {
+		case -1:
+			fprintf(stderr, "Failed fork() (%s)\n", strerror(errno));
+			return -1;
+		case 0:
+			close(pfd[0]);
+			_exit(connect_worker(addr, port, nports, first, n, idle, pfd[1])
+			      ? 1 : 0);
+		}
+		workers++;
+	}
+	close(pfd[1]);
+
+	/* lines are shorter than PIPE_BUF, so writes do not interleave */
+	in = fdopen(pfd[0], "r");
+	while (fgets(line, sizeof(line), in)) {
+		unsigned long n;
+		unsigned long long t;
+
+		if (sscanf(line, "ready %lu", &n) == 1) {
+			ready += n;
+			if (ready == count) {
+				printf("ready %lu\n", ready);
+				fflush(stdout);
+			}
+		} else if (sscanf(line, "done %lu %llu", &n, &t) == 2) {
+			resets += n;
+			if (t > last)
+				last = t;
+		}
+	}
+	while (workers--) {
+		int status;
+
+		if (wait(&status) > 0 && (!WIFEXITED(status) || WEXITSTATUS(status)))
+			rc = -1;
+	}
+	if (ready != count) {
+		fprintf(stderr, "Only %lu of %lu connections established\n",
+			ready, count);
+		return -1;
+	}
+	printf("done %lu %llu\n", resets, last);
+	return rc;
+}
+
+static int parse_lladdr(const char *s, unsigned char *ll)
+{
+	unsigned v[6];
+	int i;
+
+	if (sscanf(s, "%x:%x:%x:%x:%x:%x", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6)
+		return -1;
+	for (i = 0; i < 6; i++)
+		ll[i] = v[i];
+	return 0;
+}
+
+/* returns 1 if the message is a neighbour entry for addr with lladdr ll */
+static int neigh_match(const struct nlmsghdr *h, const sock_addr *addr, const unsigned char *ll)
+{
+	const struct ndmsg *nd = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len, alen, dst = 0, lla = 0;
+
+	if (h->nlmsg_type != RTM_NEWNEIGH || nd->ndm_family != addr->sa.sa_family)
+		return 0;
+	alen = addr->sa.sa_family == AF_INET ? 4 : 16;
+	len = RTM_PAYLOAD(h);
+	for (a = RTM_RTA(nd); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		if (a->rta_type == NDA_DST && RTA_PAYLOAD(a) == (unsigned)alen)
+			dst = memcmp(RTA_DATA(a), addr->sa.sa_family == AF_INET ?
+				     (const void *)&addr->ip.sin_addr :
+				     (const void *)&addr->ip6.sin6_addr, alen) == 0;
+		else if (a->rta_type == NDA_LLADDR && RTA_PAYLOAD(a) == 6)
+			lla = memcmp(RTA_DATA(a), ll, 6) == 0;
+	}
+	return dst && lla;
+}
+
+static int neighwait(const char *addr, const char *lladdr, int timeout)
+{
+	struct {
+		struct nlmsghdr	h;
+		struct ndmsg	nd;
+	} req;
+	unsigned group = RTNLGRP_NEIGH;
+	unsigned long long deadline;
+	unsigned char ll[6];
+	sock_addr sa;
+	char *buf;
+	int fd;
+
+	if (parse_ip(addr, NULL, 0, &sa) != 0 || parse_lladdr(lladdr, ll) != 0) {
+		fprintf(stderr, "Bad address '%s' '%s'\n", addr, lladdr);
+		return -1;
+	}
+
+	fd = nl_open(NETLINK_ROUTE, &group, 1);
+	if (fd == -1) {
+		fprintf(stderr, "Failed to open netlink socket (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	/* subscribe first, then dump, so that no update is missed */
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = sizeof(req);
+	req.h.nlmsg_type = RTM_GETNEIGH;
+	req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nd.ndm_family = sa.sa.sa_family;
+	if (send(fd, &req, sizeof(req), 0) != sizeof(req)) {
+		fprintf(stderr, "Failed to send netlink request (%s)\n", strerror(errno));
+		return -1;
+	}
+	printf("ready\n");
+	fflush(stdout);
+
+	buf = malloc(BENCH_NLBUF);
+	if (!buf) {
+		fprintf(stderr, "Failed malloc()\n");
+		return -1;
+	}
+	deadline = now_ns() + (unsigned long long)timeout * 1000000ULL;
+	for (;;) {
+		struct pollfd pfd;
+		struct nlmsghdr *h;
+		unsigned long long t = now_ns();
+		int len;
+
+		if (t >= deadline) {
+			fprintf(stderr, "Timed out waiting for %s at %s\n", addr, lladdr);
+			return -1;
+		}
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, (deadline - t) / 1000000 + 1) <= 0)
+			continue;
+		len = recv(fd, buf, BENCH_NLBUF, 0);
+		t = now_ns();
+		if (len < 0)
+			continue;
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, (unsigned)len);
+		     h = NLMSG_NEXT(h, len)) {
+			if (neigh_match(h, &sa, ll)) {
+				printf("%llu\n", t);
+				return 0;
+			}
+		}
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: bench_conns now\n"
+		"       bench_conns serve ADDR PORT NPORTS COUNT\n"
+		"       bench_conns connect ADDR PORT NPORTS COUNT IDLE\n"
+		"       bench_conns neighwait ADDR LLADDR TIMEOUT\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "now") == 0) {
+		printf("%llu\n", now_ns());
+		return 0;
+	}
+	if (argc == 6 && strcmp(argv[1], "serve") == 0)
+		return serve(argv[2], atoi(argv[3]), atoi(argv[4]),
+			     strtoul(argv[5], NULL, 10)) ? 1 : 0;
+	if (argc == 7 && strcmp(argv[1], "connect") == 0)
+		return connect_all(argv[2], atoi(argv[3]), atoi(argv[4]),
+				   strtoul(argv[5], NULL, 10), atoi(argv[6])) ? 1 : 0;
+	if (argc == 5 && strcmp(argv[1], "neighwait") == 0)
+		return neighwait(argv[2], argv[3], atoi(argv[4])) ? 1 : 0;
+	usage();
+	return 1;
+}
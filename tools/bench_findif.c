@@ -0,0 +1,311 @@
+/*
+ * bench_findif.c: route lookup benchmark for findif
+ *
+ *	bench_findif [-q lookups] [-s seed] count...
+ *
+ * For each count, generates a synthetic IPv4 routing table of that
+ * many routes in /proc/net/route format (prefix lengths distributed
+ * roughly like a full Internet table, a default route, a few
+ * interfaces and metrics), then compares
+ *
+ *	trie	findif_lpm: parse the file once, build the trie, look up
+ *	scan	the scanner findif used before: one pass over the parsed
+ *		routes per lookup, "metric <= best && mask >= best"
+ *	file	what one findif run did: read and scan the whole file
+ *
+ * reporting parse and build time, memory of the trie and lookups per
+ * second. Every trie answer is checked against a plain longest prefix
+ * scan for as many lookups as the scan is run for.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "findif_lpm.h"
+
+/* time spent on the slow scanners per table, they get the same budget */
+#define SCAN_BUDGET_NS	1000000000ULL
+#define SCAN_MIN	3
+
+static unsigned long long
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift, reproducible across runs and libcs */
+static uint32_t rnd_state = 2463534242U;
+
+static uint32_t
+rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static unsigned
+rnd_plen(void)
+{
+	unsigned r = rnd() % 1000;
+
+	/* about 60% /24, the rest mostly /16 .. /23, a few shorter */
+	if (r < 600) {
+		return 24;
+	}
+	if (r < 950) {
+		return 16 + r % 8;
+	}
+	return 8 + r % 8;
+}
+
+/* write count routes to a temporary file, return it rewound */
+static FILE *
+make_table(size_t count)
+{
+	char path[] = "/tmp/bench_findif.XXXXXX";
+	FILE *f;
+	size_t i;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0 || (f = fdopen(fd, "w+")) == NULL) {
+		perror("mkstemp");
+		exit(1);
+	}
+	unlink(path);
+	fprintf(f, "Iface\tDestination\tGateway \tFlags\tRefCnt\tUse\t"
+		"Metric\tMask\t\tMTU\tWindow\tIRTT\n");
+	fprintf(f, "eth0\t00000000\t0100000A\t0003\t0\t0\t100\t00000000"
+		"\t0\t0\t0\n");
+	for (i = 1; i < count; i++) {
+		unsigned plen = rnd_plen();
+		uint32_t mask = 0xffffffffU << (32 - plen);
+		uint32_t dest = rnd() & mask;
+
+		/* the columns are network order values printed as integers */
+		fprintf(f, "eth%u\t%08X\t00000000\t0001\t0\t0\t%u\t%08X\t0\t0\t0\n"
+		,	rnd() % 8, htonl(dest), rnd() % 4 * 100, htonl(mask));
+	}
+	if (fflush(f) != 0 || fseek(f, 0, SEEK_SET) != 0) {
+		perror("write");
+		exit(1);
+	}
+	return f;
+}
+
+/* the loop SearchUsingProcRoute had, over parsed routes */
+static const struct proc_route *
+scan_lookup(const struct proc_route *r, size_t n, uint32_t addr)
+{
+	const struct proc_route *best = NULL;
+	long best_metric = LONG_MAX;
+	unsigned long best_netmask = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		unsigned long mask = htonl(r[i].plen
+		?	0xffffffffU << (32 - r[i].plen) : 0);
+
+		if ((addr & mask) == r[i].dest
+		&&	r[i].metric <= best_metric && mask >= best_netmask) {
+			best_metric = r[i].metric;
+			best_netmask = mask;
+			best = &r[i];
+		}
+	}
+	return best;
+}
+
+/* a plain longest prefix match, the reference for the trie */
+static const struct proc_route *
+ref_lookup(const struct proc_route *r, size_t n, uint32_t addr)
+{
+	const struct proc_route *best = NULL;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		uint32_t mask = htonl(r[i].plen
+		?	0xffffffffU << (32 - r[i].plen) : 0);
+
+		if ((addr & mask) != r[i].dest) {
+			continue;
+		}
+		if (best == NULL || r[i].plen > best->plen
+		||	(r[i].plen == best->plen && r[i].metric < best->metric)) {
+			best = &r[i];
+		}
+	}
+	return best;
+}
+
+/* the whole of what one findif run did: read the file, scan it */
+static int
+file_lookup(FILE *f, uint32_t addr)
+{
+	unsigned long	flags, refcnt, use, gw, mask, dest;
+	unsigned long	best_netmask = 0;
+	long		metric, best_metric = LONG_MAX;
+	char		buf[2048];
+	char		interface[128];
+
+	rewind(f);
+	if (fgets(buf, sizeof(buf), f) == NULL) {
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		if (sscanf(buf, "%127[^\t]\t%lx%lx%lx%lx%lx%lx%lx"
+		,	interface, &dest, &gw, &flags, &refcnt, &use
+		,	&metric, &mask) != 8) {
+			return -1;
+		}
+		if ((addr & mask) == (dest & mask)
+		&&	metric <= best_metric && mask >= best_netmask) {
+			best_metric = metric;
+			best_netmask = mask;
+		}
+	}
+	return best_metric == LONG_MAX ? -1 : 0;
+}
+
+static void
+bench(size_t count, size_t nlookups)
+{
+	struct proc_route *routes;
+	size_t nroutes, i, nscan, nfile, mismatch = 0, scandiff = 0;
+	unsigned long long t0, t1, t2, t3;
+	uint32_t *addrs;
+	char errmsg[128];
+	struct lpm lpm;
+	const struct proc_route *hit;
+	volatile size_t sink = 0;
+	FILE *f;
+
+	f = make_table(count);
+	if ((addrs = malloc(nlookups * sizeof(*addrs))) == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < nlookups; i++) {
+		addrs[i] = rnd();
+	}
+
+	t0 = now_ns();
+	if (proc_route_read(f, &routes, &nroutes, errmsg, sizeof(errmsg)) < 0) {
+		fprintf(stderr, "%s\n", errmsg);
+		exit(1);
+	}
+	t1 = now_ns();
+	if (proc_route_lpm(&lpm, routes, nroutes) < 0) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	t2 = now_ns();
+	for (i = 0; i < nlookups; i++) {
+		hit = proc_route_lookup(&lpm, routes, addrs[i]);
+		sink += hit != NULL;
+	}
+	t3 = now_ns();
+	printf("%-8zu %-5s %10.1f %10.1f %10zu %12.0f\n", nroutes, "trie"
+	,	(t1 - t0) / 1e6, (t2 - t1) / 1e6, lpm_memory(&lpm) / 1024
+	,	nlookups / ((t3 - t2) / 1e9));
+
+	/* the scanners get a time budget rather than all the lookups */
+	t0 = now_ns();
+	for (nscan = 0; nscan < nlookups
+	&&	(nscan < SCAN_MIN || now_ns() - t0 < SCAN_BUDGET_NS); nscan++) {
+		hit = scan_lookup(routes, nroutes, addrs[nscan]);
+		sink += hit != NULL;
+	}
+	t1 = now_ns();
+	printf("%-8zu %-5s %10s %10s %10s %12.0f\n", nroutes, "scan"
+	,	"-", "-", "-", nscan / ((t1 - t0) / 1e9));
+
+	for (i = 0; i < nscan; i++) {
+		const struct proc_route *r = ref_lookup(routes, nroutes, addrs[i]);
+		const struct proc_route *s = scan_lookup(routes, nroutes, addrs[i]);
+
+		if (proc_route_lookup(&lpm, routes, addrs[i]) != r) {
+			mismatch++;
+		}
+		if (s == NULL || r == NULL || s->plen != r->plen) {
+			scandiff++;
+		}
+	}
+
+	t0 = now_ns();
+	for (nfile = 0; nfile < nlookups
+	&&	(nfile < SCAN_MIN || now_ns() - t0 < SCAN_BUDGET_NS); nfile++) {
+		file_lookup(f, addrs[nfile]);
+	}
+	t1 = now_ns();
+	printf("%-8zu %-5s %10s %10s %10s %12.1f\n", nroutes, "file"
+	,	"-", "-", "-", nfile / ((t1 - t0) / 1e9));
+	printf("# %zu trie answers checked, %zu wrong;"
+		" the scan picked a shorter prefix %zu times\n"
+	,	nscan, mismatch, scandiff);
+
+	lpm_free(&lpm);
+	free(routes);
+	free(addrs);
+	fclose(f);
+	if (mismatch) {
+		exit(1);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t nlookups = 1000000;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "q:s:")) != EOF) {
+		switch (ch) {
+		case 'q':
+			nlookups = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			rnd_state = strtoul(optarg, NULL, 0) | 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-q lookups] [-s seed]"
+				" count...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind == argc || nlookups == 0) {
+		fprintf(stderr, "Usage: %s [-q lookups] [-s seed] count...\n"
+		,	argv[0]);
+		return 1;
+	}
+	printf("# %-6s %-5s %10s %10s %10s %12s\n", "routes", "impl"
+	,	"parse_ms", "build_ms", "mem_kb", "lookups_s");
+	for (i = optind; i < argc; i++) {
+		bench(strtoul(argv[i], NULL, 0), nlookups);
+	}
+	return 0;
+}
@@ -0,0 +1,697 @@
+/*
+ * ethmonitor_check: one monitor run of the ethmonitor resource agent.
+ *
+ *	The checks are those of if_check in heartbeat/ethmonitor, in the
+ *	same order, each attempt repeated like if_monitor does:
+ *
+ *	- the link must be up and have carrier,
+ *	- the rx packet counter must move within the packet timeout,
+ *	- or else one of the most recently confirmed ARP cache entries
+ *	  must answer an ARP request.
+ *
+ *	Link state and counters are read over rtnetlink, every 100 ms
+ *	while the counter is watched, and a carrier loss reported on
+ *	RTNLGRP_LINK ends the watch at once. The cache entries are probed
+ *	all together through the send_arp packet code (arp_tx.c) rather
+ *	than one arping after the other.
+ *
+ *	The messages for the agent to log come out on stdout as
+ *	"<level> <text>" lines, then, with -m, a "value <n>" line with the
+ *	attribute value. The exit code is the OCF code of the run.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include <nl_util.h>
+#include <arp_tx.h>
+
+#define OCF_SUCCESS		0
+#define OCF_ERR_GENERIC		1
+#define OCF_ERR_ARGS		2
+#define OCF_NOT_RUNNING		7
+
+#define TICK_MS			100
+#define HWADDR_MAX		32
+
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP		0x10000
+#endif
+
+static const char *cmdname = "ethmonitor_check";
+
+static int repeat_count = 5;
+static long repeat_interval = 10;	/* s */
+static long pktcnt_timeout = 5;		/* s */
+static int arping_count = 1;
+static long arping_timeout = 1;		/* s */
+static int arping_cache_entries = 5;
+static int link_only;
+
+static const char *nic;
+static int ifindex;
+static int qfd = -1;	/* requests */
+static int efd = -1;	/* RTNLGRP_LINK events */
+
+struct link_state {
+	int			exists;
+	unsigned		flags;
+	unsigned short		type;
+	unsigned long long	rx_packets;
+	int			halen;
+	unsigned char		addr[HWADDR_MAX];
+	unsigned char		brd[HWADDR_MAX];
+};
+
+struct neigh {
+	struct in_addr		ip;
+	unsigned		confirmed;
+};
+
+struct neigh_list {
+	struct neigh		*v;
+	int			n, max;
+};
+
+static void say(const char *level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void
+say(const char *level, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("%s ", level);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+}
+
+static long long
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* RTM_NEWLINK or RTM_DELLINK, from a request or an event */
+static void
+nl_link_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct link_state *ls = arg;
+	const struct ifinfomsg *ifi = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len = IFLA_PAYLOAD(h);
+	int have64 = 0;
+
+	if (ifi->ifi_index != ifindex) {
+		return;
+	}
+	if (h->nlmsg_type == RTM_DELLINK) {
+		ls->exists = 0;
+		return;
+	}
+	if (h->nlmsg_type != RTM_NEWLINK) {
+		return;
+	}
+	ls->exists = 1;
+	ls->flags = ifi->ifi_flags;
+	ls->type = ifi->ifi_type;
+	for (a = IFLA_RTA(ifi); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		int alen = RTA_PAYLOAD(a);
+
+		switch (a->rta_type) {
+		case IFLA_ADDRESS:
+			if (alen <= HWADDR_MAX) {
+				memcpy(ls->addr, RTA_DATA(a), alen);
+				ls->halen = alen;
+			}
+			break;
+		case IFLA_BROADCAST:
+			if (alen <= HWADDR_MAX) {
+				memcpy(ls->brd, RTA_DATA(a), alen);
+			}
+			break;
+		case IFLA_STATS64:
+			if (alen >= (int)sizeof(struct rtnl_link_stats64)) {
+				struct rtnl_link_stats64 st;
+
+				memcpy(&st, RTA_DATA(a), sizeof(st));
+				ls->rx_packets = st.rx_packets;
+				have64 = 1;
+			}
+			break;
+		case IFLA_STATS:
+			if (!have64
+			&&	alen >= (int)sizeof(struct rtnl_link_stats)) {
+				struct rtnl_link_stats st;
+
+				memcpy(&st, RTA_DATA(a), sizeof(st));
+				ls->rx_packets = st.rx_packets;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Fresh state of the interface. One that does not exist (yet) is
+ * down; a bond may come back under the same name.
+ */
+static int
+get_link(struct link_state *ls)
+{
+	struct {
+		struct nlmsghdr		h;
+		struct ifinfomsg	ifi;
+	} req;
+
+	memset(ls, 0, sizeof(*ls));
+	if (!ifindex && !(ifindex = if_nametoindex(nic))) {
+		return 0;
+	}
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.h.nlmsg_type = RTM_GETLINK;
+	req.h.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+	if (nl_talk(qfd, &req.h, nl_link_cb, ls) == ENODEV) {
+		ifindex = 0;
+	}
+	return 0;
+}
+
+/* what "ip link show up" without NO-CARRIER means */
+static int
+link_up(const struct link_state *ls)
+{
+	return ls->exists && (ls->flags & IFF_UP) && (ls->flags & IFF_LOWER_UP);
+}
+
+/*
+ * Read the queued link events for our interface into ls.
+ * Returns 1 if there was one.
+ */
+static int
+drain_events(struct link_state *ls)
+{
+	static char buf[NL_BUFSIZE];
+	int seen = 0, len;
+
+	while ((len = recv(efd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		struct nlmsghdr *h;
+
+		for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, (unsigned)len)
+		;	h = NLMSG_NEXT(h, len)) {
+			const struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+			if ((h->nlmsg_type == RTM_NEWLINK
+			||	h->nlmsg_type == RTM_DELLINK)
+			&&	ifi->ifi_index == ifindex) {
+				nl_link_cb(h, ls);
+				seen = 1;
+			}
+		}
+	}
+	if (len < 0 && errno == ENOBUFS) {
+		/* events were lost, ask for the state instead */
+		get_link(ls);
+		seen = 1;
+	}
+	return seen;
+}
+
+/*
+ * Watch the rx packet counter for pktcnt_timeout seconds, reading it
+ * every TICK_MS. Returns 1 as soon as it moved, 0 when it did not,
+ * -1 when the link went down meanwhile.
+ */
+static int
+watch_pkt_counter(const struct link_state *start)
+{
+	struct link_state ls = *start;
+	unsigned long long base = start->rx_packets;
+	long long t0 = now_ms(), next = TICK_MS, t;
+	struct pollfd pfd;
+
+	pfd.fd = efd;
+	pfd.events = POLLIN;
+	while ((t = now_ms() - t0) < pktcnt_timeout * 1000) {
+		int wait = next - t;
+
+		if (wait > 0 && poll(&pfd, 1, wait) > 0
+		&&	drain_events(&ls) && !link_up(&ls)) {
+			return -1;
+		}
+		if (now_ms() - t0 < next) {
+			continue;
+		}
+		next += TICK_MS;
+		get_link(&ls);
+		if (!link_up(&ls)) {
+			return -1;
+		}
+		if (ls.rx_packets != base) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+nl_neigh_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct neigh_list *nl = arg;
+	const struct ndmsg *ndm = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len = NLMSG_PAYLOAD(h, sizeof(*ndm));
+	struct neigh n;
+	int have_dst = 0;
+
+	if (h->nlmsg_type != RTM_NEWNEIGH || ndm->ndm_family != AF_INET
+	||	ndm->ndm_ifindex != ifindex || (ndm->ndm_state & NUD_NOARP)) {
+		return;
+	}
+	memset(&n, 0, sizeof(n));
+	a = (const struct rtattr *)((const char *)ndm + NLMSG_ALIGN(sizeof(*ndm)));
+	for (; RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		if (a->rta_type == NDA_DST && RTA_PAYLOAD(a) == 4) {
+			memcpy(&n.ip, RTA_DATA(a), 4);
+			have_dst = 1;
+		}
+		else if (a->rta_type == NDA_CACHEINFO
+		&&	RTA_PAYLOAD(a) >= sizeof(struct nda_cacheinfo)) {
+			const struct nda_cacheinfo *ci = RTA_DATA(a);
+			n.confirmed = ci->ndm_confirmed;
+		}
+	}
+	if (!have_dst) {
+		return;
+	}
+	if (nl->n == nl->max) {
+		int max = nl->max ? 2 * nl->max : 64;
+		struct neigh *v = realloc(nl->v, max * sizeof(*v));
+
+		if (!v) {
+			return;
+		}
+		nl->v = v;
+		nl->max = max;
+	}
+	nl->v[nl->n++] = n;
+}
+
+static int
+neigh_cmp(const void *a, const void *b)
+{
+	const struct neigh *x = a, *y = b;
+
+	return x->confirmed < y->confirmed ? -1 : x->confirmed > y->confirmed;
+}
+
+/*
+ * The IPv4 ARP cache entries of the interface, the most recently
+ * confirmed first, at most arping_cache_entries of them, as
+ * `ip -s neighbour show | sort | head` gave them.
+ */
+static int
+get_arp_list(struct neigh_list *nl)
+{
+	struct {
+		struct nlmsghdr	h;
+		struct ndmsg	ndm;
+	} req;
+
+	memset(nl, 0, sizeof(*nl));
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+	req.h.nlmsg_type = RTM_GETNEIGH;
+	req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.ndm.ndm_family = AF_INET;
+	if (nl_talk(qfd, &req.h, nl_neigh_cb, nl) != 0) {
+		return -1;
+	}
+	qsort(nl->v, nl->n, sizeof(*nl->v), neigh_cmp);
+	if (nl->n > arping_cache_entries) {
+		nl->n = arping_cache_entries;
+	}
+	return 0;
+}
+
+static void
+nl_addr_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct in_addr *src = arg;
+	const struct ifaddrmsg *ifa = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len = IFA_PAYLOAD(h);
+
+	if (h->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET
+	||	(int)ifa->ifa_index != ifindex || src->s_addr) {
+		return;
+	}
+	for (a = IFA_RTA(ifa); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		if (a->rta_type == IFA_LOCAL && RTA_PAYLOAD(a) == 4) {
+			memcpy(src, RTA_DATA(a), 4);
+		}
+	}
+}
+
+/* the first IPv4 address of the interface, or 0.0.0.0 */
+static struct in_addr
+get_src(void)
+{
+	struct {
+		struct nlmsghdr		h;
+		struct ifaddrmsg	ifa;
+	} req;
+	struct in_addr src;
+
+	src.s_addr = 0;
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.h.nlmsg_type = RTM_GETADDR;
+	req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.ifa.ifa_family = AF_INET;
+	nl_talk(qfd, &req.h, nl_addr_cb, &src);
+	return src;
+}
+
+/*
+ * ARP requests to all the entries at once, a round every second like
+ * arping sends them, for arping_timeout seconds. It stops as soon as
+ * one of them answered arping_count times; one answer at all is a
+ * success, as it is for arping.
+ * Returns the index of an entry that answered, or -1.
+ */
+static int
+do_arping(const struct link_state *ls, const struct neigh_list *nl)
+{
+	struct arp_tx tx;
+	struct sockaddr_ll sll;
+	struct in_addr src = get_src();
+	struct pollfd pfd;
+	unsigned char buf[ARP_TX_FRAME_MAX];
+	int *replies;
+	int fd, i, found = -1, hrd = ls->type;
+	long long t0, next = 0, t;
+
+	if (ls->halen <= 0 || ls->halen > (int)sizeof(sll.sll_addr)) {
+		say("info", "%s: cannot arping on this link type", nic);
+		return -1;
+	}
+	fd = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, htons(ETH_P_ARP));
+	if (fd < 0) {
+		say("err", "socket(PF_PACKET): %s", strerror(errno));
+		return -1;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_ifindex = ifindex;
+	sll.sll_halen = ls->halen;
+	memcpy(sll.sll_addr, ls->brd, ls->halen);
+	replies = calloc(nl->n, sizeof(*replies));
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0
+	||	!replies || arp_tx_init(&tx, nl->n) < 0) {
+		say("err", "arping on %s: %s", nic, strerror(errno));
+		free(replies);
+		close(fd);
+		return -1;
+	}
+	if (hrd == ARPHRD_FDDI) {
+		hrd = ARPHRD_ETHER;
+	}
+	arp_tx_dest(&tx, &sll);
+	for (i = 0; i < nl->n; i++) {
+		arp_tx_add(&tx, ARPOP_REQUEST, hrd, ls->halen, ls->addr, src
+		,	ls->brd, nl->v[i].ip);
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	t0 = now_ms();
+	while (found < 0 && (t = now_ms() - t0) < arping_timeout * 1000) {
+		struct sockaddr_ll from;
+		socklen_t fromlen = sizeof(from);
+		const struct arphdr *ah = (const struct arphdr *)buf;
+		struct in_addr spa;
+		int len, wait;
+
+		if (t >= next) {
+			arp_tx_send(&tx, fd, 0, tx.n);
+			next += 1000;
+		}
+		wait = (next < arping_timeout * 1000 ? next : arping_timeout * 1000) - t;
+		if (poll(&pfd, 1, wait) <= 0) {
+			continue;
+		}
+		len = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT
+		,	(struct sockaddr *)&from, &fromlen);
+		if (len < (int)sizeof(*ah) || from.sll_pkttype == PACKET_OUTGOING
+		||	ah->ar_op != htons(ARPOP_REPLY)
+		||	ah->ar_pro != htons(ETH_P_IP) || ah->ar_pln != 4
+		||	ah->ar_hln != ls->halen
+		||	len < (int)sizeof(*ah) + 2 * (ls->halen + 4)) {
+			continue;
+		}
+		memcpy(&spa, buf + sizeof(*ah) + ls->halen, 4);
+		for (i = 0; i < nl->n; i++) {
+			if (nl->v[i].ip.s_addr == spa.s_addr
+			&&	++replies[i] >= arping_count) {
+				found = i;
+			}
+		}
+	}
+	for (i = 0; found < 0 && i < nl->n; i++) {
+		if (replies[i]) {
+			found = i;
+		}
+	}
+	arp_tx_free(&tx);
+	free(replies);
+	close(fd);
+	return found;
+}
+
+/*
+ * One attempt, like if_check: link, counter, then the ARP cache.
+ */
+static int
+if_check(void)
+{
+	struct link_state ls;
+	struct neigh_list nl;
+	int rc;
+
+	get_link(&ls);
+	say("debug", "link_status: %d (1=up, 0=down)", link_up(&ls));
+	if (!link_up(&ls)) {
+		say("notice", "link_status: DOWN");
+		return OCF_NOT_RUNNING;
+	}
+	if (link_only) {
+		return OCF_SUCCESS;
+	}
+
+	say("debug", "watch for packet counter changes");
+	rc = watch_pkt_counter(&ls);
+	if (rc > 0) {
+		say("debug", "we received some packets.");
+		return OCF_SUCCESS;
+	}
+	if (rc < 0) {
+		say("notice", "link_status: DOWN");
+		return OCF_NOT_RUNNING;
+	}
+	say("debug", "No packets received during packet watch timeout");
+
+	say("debug", "check arping ARP cache entries");
+	if (get_arp_list(&nl) < 0 || !nl.n) {
+		say("info", "No ARP cache entries found to arping");
+		free(nl.v);
+		return OCF_NOT_RUNNING;
+	}
+	rc = do_arping(&ls, &nl);
+	if (rc >= 0) {
+		say("debug", "%s answered ARP", inet_ntoa(nl.v[rc].ip));
+	}
+	free(nl.v);
+	return rc >= 0 ? OCF_SUCCESS : OCF_NOT_RUNNING;
+}
+
+/*
+ * Sleep until ms since the epoch of now_ms(), but no longer than
+ * the link takes to come up again: then the next attempt may as
+ * well start.
+ */
+static void
+pause_until(long long until)
+{
+	struct link_state ls;
+	struct pollfd pfd;
+	long long t;
+
+	get_link(&ls);
+	pfd.fd = efd;
+	pfd.events = POLLIN;
+	while ((t = now_ms()) < until) {
+		int was_up = link_up(&ls);
+
+		if (poll(&pfd, 1, until - t) > 0 && drain_events(&ls)
+		&&	!was_up && link_up(&ls)) {
+			return;
+		}
+	}
+}
+
+static void
+usage(int ec)
+{
+	fprintf(stderr, "\n"
+		"Usage: %s [-l] [-r repeat_count] [-i repeat_interval]\n"
+		"       [-t pktcnt_timeout] [-c arping_count] [-w arping_timeout]\n"
+		"       [-e arping_cache_entries] [-m multiplier] interface\n"
+		"Options, the ethmonitor parameters of the same name:\n"
+		"    -l: link_status_only\n"
+		"    -r: repeat_count (default 5)\n"
+		"    -i: repeat_interval, seconds (default 10)\n"
+		"    -t: pktcnt_timeout, seconds (default 5)\n"
+		"    -c: arping_count (default 1)\n"
+		"    -w: arping_timeout, seconds (default 1)\n"
+		"    -e: arping_cache_entries (default 5)\n"
+		"    -m: multiplier; print \"value <n>\", the attribute\n"
+		"        value, after the run\n"
+		"Each message to log is a \"<level> <text>\" line on stdout.\n"
+		"The exit code is the OCF code of the run.\n"
+	,	cmdname);
+	exit(ec);
+}
+
+static long
+number(const char *s)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (errno || end == s || *end || v < 0) {
+		fprintf(stderr, "%s: invalid number [%s]\n", cmdname, s);
+		usage(OCF_ERR_ARGS);
+	}
+	return v;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned link_group = RTNLGRP_LINK;
+	long multiplier = -1;
+	int ch, rc = OCF_NOT_RUNNING, left, runs = 0;
+	long long start;
+
+	while ((ch = getopt(argc, argv, "lr:i:t:c:w:e:m:h")) != -1) {
+		switch (ch) {
+		case 'l':
+			link_only = 1;
+			break;
+		case 'r':
+			repeat_count = number(optarg);
+			break;
+		case 'i':
+			repeat_interval = number(optarg);
+			break;
+		case 't':
+			pktcnt_timeout = number(optarg);
+			break;
+		case 'c':
+			arping_count = number(optarg);
+			break;
+		case 'w':
+			arping_timeout = number(optarg);
+			break;
+		case 'e':
+			arping_cache_entries = number(optarg);
+			break;
+		case 'm':
+			multiplier = number(optarg);
+			break;
+		case 'h':
+			usage(OCF_SUCCESS);
+		default:
+			usage(OCF_ERR_ARGS);
+		}
+	}
+	if (optind != argc - 1 || repeat_count < 1) {
+		usage(OCF_ERR_ARGS);
+	}
+	nic = argv[optind];
+
+	if ((qfd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0
+	||	(efd = nl_open(NETLINK_ROUTE, &link_group, 1)) < 0) {
+		say("err", "cannot open rtnetlink: %s", strerror(errno));
+		return OCF_ERR_GENERIC;
+	}
+
+	for (left = repeat_count; left > 0; ) {
+		start = now_ms();
+		rc = if_check();
+		left--;
+		if (rc == OCF_SUCCESS) {
+			if (runs) {
+				say("info", "Monitoring of %s recovered from error"
+				,	nic);
+			}
+			break;
+		}
+		if (left) {
+			say("warn", "Monitoring of %s failed, %d retries left."
+			,	nic, left);
+			pause_until(start + repeat_interval * 1000);
+			runs++;
+		}
+	}
+	if (multiplier >= 0) {
+		printf("value %ld\n", rc == OCF_SUCCESS ? multiplier : 0);
+	}
+	return rc;
+}
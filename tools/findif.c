@@ -3,8 +3,8 @@
  *
  *	It's really simple to write in C, but hard to write in the shell...
  *
- *	This code is dependent on IPV4 addressing conventions...
- *		Sorry.
+ *	This code was dependent on IPV4 addressing conventions...
+ *	IPv6 addresses are now handled on Linux, using rtnetlink.
  *
  * Copyright (C) 2000 Alan Robertson <alanr@unix.sh>
  * Copyright (C) 2001 Matt Soffen <matt@soffen.com>
@@ -57,7 +57,12 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #ifdef HAVE_SYS_SOCKET_H
 #include <sys/socket.h>
 #endif
@@ -78,12 +83,19 @@
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <nl_util.h>
+#endif
 #include <agent_config.h>
 #include <config.h>
+#include "findif_lpm.h"
 
 #define DEBUG 0
 #define	EOS			'\0'
 #define	PROCROUTE	"/proc/net/route"
+#define FI_SOCKET	HA_RSCTMPDIR "/findif.sock"
 #define ROUTEPARM	"-n get"
 
 #ifndef HAVE_STRNLEN
@@ -110,6 +122,13 @@
 
 static int OutputInCIDR=0;
 
+/* Policy routing: look up in this table / with this fwmark (-t, -m) */
+static unsigned long RouteTable=0;
+static unsigned long RouteMark=0;
+
+/* IPv4 routes from this /proc/net/route style file rather than the kernel (-R) */
+static const char *RouteFile=NULL;
+
 
 /*
  * Different OSes offer different mechnisms to obtain this information.
@@ -128,10 +147,16 @@ typedef int SearchRoute (char *address, struct in_addr *in
 ,        unsigned long *best_netmask, char *errmsg
 ,	int errmsglen);
 
+#ifdef __linux__
+static SearchRoute SearchUsingNetlink;
+#endif
 static SearchRoute SearchUsingProcRoute;
 static SearchRoute SearchUsingRouteCmd;
 
 static SearchRoute *search_mechs[] = {
+#ifdef __linux__
+	&SearchUsingNetlink,
+#endif
 	&SearchUsingProcRoute,
 	&SearchUsingRouteCmd,
 	NULL
@@ -170,64 +195,344 @@ void usage(int ec);
 #define	BAD_BROADCAST	(0L)
 #define	MAXSTR	128
 
+#ifdef __linux__
+/*
+ * Ask the kernel instead of scanning the routing table ourselves.
+ *
+ * Without -t, one RTM_GETROUTE request with RTM_F_FIB_MATCH returns
+ * the route the FIB itself selects for the address (policy rules and
+ * fwmark included), with the prefix length of that route rather than
+ * a /32 cache entry. With -t, that table is dumped and searched for
+ * the longest matching prefix.
+ *
+ * If the address is already configured here, the match is the host
+ * route in the local table: the prefix length is then the one of the
+ * address itself (RTM_GETADDR). The interface name comes from
+ * RTM_GETLINK.
+ */
+
+struct nl_route {
+	int		found;
+	unsigned char	type;
+	unsigned char	dst_len;
+	unsigned	table;
+	unsigned	metric;
+	int		oif;
+};
+
+struct nl_route_query {
+	int		family;
+	unsigned char	addr[16];
+	int		oif;
+	struct nl_route	*best;
+};
+
+/* do the first bits of a and b match? */
+static int
+prefix_match(const unsigned char *a, const unsigned char *b, int bits)
+{
+	int n = bits / 8;
+
+	if (memcmp(a, b, n) != 0) {
+		return 0;
+	}
+	if (bits % 8) {
+		unsigned char m = 0xff << (8 - bits % 8);
+		return (a[n] & m) == (b[n] & m);
+	}
+	return 1;
+}
+
+static void
+nl_route_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct nl_route_query *q = arg;
+	const struct rtmsg *r = NLMSG_DATA(h);
+	const struct rtattr *a;
+	struct nl_route rt;
+	unsigned char dst[16];
+	int len = RTM_PAYLOAD(h);
+
+	if (h->nlmsg_type != RTM_NEWROUTE || r->rtm_family != q->family) {
+		return;
+	}
+	memset(&rt, 0, sizeof(rt));
+	memset(dst, 0, sizeof(dst));
+	rt.found = 1;
+	rt.type = r->rtm_type;
+	rt.dst_len = r->rtm_dst_len;
+	rt.table = r->rtm_table;
+	for (a = RTM_RTA(r); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		switch (a->rta_type) {
+		case RTA_DST:
+			if (RTA_PAYLOAD(a) <= sizeof(dst)) {
+				memcpy(dst, RTA_DATA(a), RTA_PAYLOAD(a));
+			}
+			break;
+		case RTA_OIF:
+			rt.oif = *(const int *)RTA_DATA(a);
+			break;
+		case RTA_PRIORITY:
+			rt.metric = *(const unsigned *)RTA_DATA(a);
+			break;
+		case RTA_TABLE:
+			rt.table = *(const unsigned *)RTA_DATA(a);
+			break;
+		case RTA_MULTIPATH:
+			/* first next hop */
+			if (!rt.oif && RTA_PAYLOAD(a) >= sizeof(struct rtnexthop)) {
+				rt.oif = ((const struct rtnexthop *)RTA_DATA(a))->rtnh_ifindex;
+			}
+			break;
+		}
+	}
+
+	if (r->rtm_flags & RTM_F_CLONED) {
+		/* a kernel without RTM_F_FIB_MATCH: no prefix length */
+		return;
+	}
+	if (RouteTable && h->nlmsg_flags & NLM_F_MULTI) {
+		/* table dump: keep the longest prefix, then lowest metric */
+		if (rt.table != RouteTable || rt.type != RTN_UNICAST
+		||	(q->oif && rt.oif != q->oif)
+		||	!prefix_match(q->addr, dst, rt.dst_len)) {
+			return;
+		}
+		if (q->best->found && (rt.dst_len < q->best->dst_len
+		||	(rt.dst_len == q->best->dst_len
+		&&	rt.metric >= q->best->metric))) {
+			return;
+		}
+	}
+	*q->best = rt;
+}
+
+struct nl_addr_query {
+	int		family;
+	unsigned char	addr[16];
+	int		prefixlen;
+	int		ifindex;
+};
+
+static void
+nl_addr_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct nl_addr_query *q = arg;
+	const struct ifaddrmsg *ifa = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len = IFA_PAYLOAD(h);
+	/* IFA_LOCAL is the address itself, IFA_ADDRESS may be the peer */
+	int type = q->family == AF_INET ? IFA_LOCAL : IFA_ADDRESS;
+
+	if (h->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != q->family) {
+		return;
+	}
+	for (a = IFA_RTA(ifa); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		if (a->rta_type == type && RTA_PAYLOAD(a) <= sizeof(q->addr)
+		&&	memcmp(RTA_DATA(a), q->addr, RTA_PAYLOAD(a)) == 0) {
+			q->prefixlen = ifa->ifa_prefixlen;
+			q->ifindex = ifa->ifa_index;
+		}
+	}
+}
+
+static void
+nl_link_cb(const struct nlmsghdr *h, void *arg)
+{
+	char *name = arg;
+	const struct ifinfomsg *ifi = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len = IFLA_PAYLOAD(h);
+
+	if (h->nlmsg_type != RTM_NEWLINK) {
+		return;
+	}
+	for (a = IFLA_RTA(ifi); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		if (a->rta_type == IFLA_IFNAME) {
+			strncpy(name, RTA_DATA(a), IFNAMSIZ - 1);
+			name[IFNAMSIZ - 1] = EOS;
+		}
+	}
+}
+
+/*
+ * Route lookup for either family. oif restricts the lookup to routes
+ * through that interface (needed for link-local addresses).
+ * Returns like a SearchRoute mechanism.
+ */
+static int
+NetlinkLookup(int family, const void *addr, int oif
+,	char *best_if, size_t best_iflen, int *best_prefixlen
+,	char *errmsg, int errmsglen)
+{
+	struct {
+		struct nlmsghdr	h;
+		union {
+			struct rtmsg		r;
+			struct ifaddrmsg	ifa;
+			struct ifinfomsg	ifi;
+		} u;
+		char		attrs[64];
+	} req;
+	struct nl_route best;
+	struct nl_route_query rq;
+	struct nl_addr_query aq;
+	char ifname[IFNAMSIZ];
+	char straddr[INET6_ADDRSTRLEN];
+	int alen = family == AF_INET ? 4 : 16;
+	int fd, rc;
+	int prefixlen, ifindex;
+
+	if ((fd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0) {
+		return -1;
+	}
+
+	memset(&best, 0, sizeof(best));
+	memset(&rq, 0, sizeof(rq));
+	rq.family = family;
+	memcpy(rq.addr, addr, alen);
+	rq.oif = oif;
+	rq.best = &best;
+
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+	req.h.nlmsg_type = RTM_GETROUTE;
+	req.h.nlmsg_flags = NLM_F_REQUEST;
+	req.u.r.rtm_family = family;
+	if (RouteTable) {
+		req.h.nlmsg_flags |= NLM_F_DUMP;
+	} else {
+		req.u.r.rtm_flags = RTM_F_FIB_MATCH;
+		req.u.r.rtm_dst_len = alen * 8;
+		nl_addattr((struct nlmsghdr *)(void *)&req, RTA_DST, addr, alen);
+		if (oif) {
+			nl_addattr((struct nlmsghdr *)(void *)&req, RTA_OIF, &oif, sizeof(oif));
+		}
+		if (RouteMark) {
+			uint32_t mark = RouteMark;
+			nl_addattr((struct nlmsghdr *)(void *)&req, RTA_MARK, &mark, sizeof(mark));
+		}
+	}
+	rc = nl_talk(fd, &req.h, nl_route_cb, &rq);
+	if (rc < 0 || (rc == 0 && !best.found && !RouteTable)) {
+		/* could not ask, or could not understand the answer */
+		close(fd);
+		return -1;
+	}
+	if (rc > 0 || !best.found || best.type == RTN_UNREACHABLE
+	||	best.type == RTN_PROHIBIT || best.type == RTN_BLACKHOLE) {
+		inet_ntop(family, addr, straddr, sizeof(straddr));
+		snprintf(errmsg, errmsglen, "No route to %s\n", straddr);
+		close(fd);
+		return OCF_ERR_GENERIC;
+	}
+
+	prefixlen = best.dst_len;
+	ifindex = best.oif;
+	if (best.type == RTN_LOCAL) {
+		/* the address is ours already */
+		memset(&req, 0, sizeof(req));
+		req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		req.h.nlmsg_type = RTM_GETADDR;
+		req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		req.u.ifa.ifa_family = family;
+		memset(&aq, 0, sizeof(aq));
+		aq.family = family;
+		memcpy(aq.addr, addr, alen);
+		if (nl_talk(fd, &req.h, nl_addr_cb, &aq) == 0 && aq.ifindex) {
+			prefixlen = aq.prefixlen;
+			ifindex = aq.ifindex;
+		}
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.h.nlmsg_type = RTM_GETLINK;
+	req.h.nlmsg_flags = NLM_F_REQUEST;
+	req.u.ifi.ifi_family = AF_UNSPEC;
+	req.u.ifi.ifi_index = ifindex;
+	ifname[0] = EOS;
+	rc = nl_talk(fd, &req.h, nl_link_cb, ifname);
+	close(fd);
+	if (rc != 0 || ifname[0] == EOS) {
+		snprintf(errmsg, errmsglen, "No interface found.");
+		return OCF_ERR_GENERIC;
+	}
+
+	*best_prefixlen = prefixlen;
+	strncpy(best_if, ifname, best_iflen);
+	return OCF_SUCCESS;
+}
+
+static int
+SearchUsingNetlink (char *address, struct in_addr *in
+, 	struct in_addr *addr_out, char *best_if, size_t best_iflen
+,	unsigned long *best_netmask
+,	char *errmsg, int errmsglen)
+{
+	int prefixlen, rc;
+
+	if (RouteFile) {
+		return -1;
+	}
+	rc = NetlinkLookup(AF_INET, in, 0, best_if, best_iflen, &prefixlen
+	,	errmsg, errmsglen);
+	if (rc == OCF_SUCCESS) {
+		*best_netmask = prefixlen
+		?	htonl(~0UL << (32 - prefixlen) & 0xffffffffUL) : 0;
+	}
+	return rc;
+}
+#endif /* __linux__ */
+
+/*
+ * The longest matching prefix in /proc/net/route (or the -R file),
+ * the lowest metric among routes with that prefix.
+ */
 static int
 SearchUsingProcRoute (char *address, struct in_addr *in
 , 	struct in_addr *addr_out, char *best_if, size_t best_iflen
 ,	unsigned long *best_netmask
 ,	char *errmsg, int errmsglen)
 {
-	unsigned long	flags, refcnt, use, gw, mask;
-	unsigned long   dest;
-	long		metric = LONG_MAX;
-	long		best_metric = LONG_MAX;
-	int		rc = OCF_SUCCESS;
-	
-	char	buf[2048];
-	char	interface[MAXSTR];
+	const char *path = RouteFile ? RouteFile : PROCROUTE;
+	const struct proc_route *best;
+	struct proc_route *routes = NULL;
+	size_t	nroutes;
+	struct lpm lpm;
+	char	err[MAXSTR];
+	int	rc = OCF_SUCCESS;
 	FILE *routefd = NULL;
 
-	if ((routefd = fopen(PROCROUTE, "r")) == NULL) {
+	if ((routefd = fopen(path, "r")) == NULL) {
 		snprintf(errmsg, errmsglen
 		,	"Cannot open %s for reading"
-		,	PROCROUTE);
-		rc = OCF_ERR_GENERIC; goto out;
+		,	path);
+		return OCF_ERR_GENERIC;
 	}
-
-	/* Skip first (header) line */
-	if (fgets(buf, sizeof(buf), routefd) == NULL) {
-		snprintf(errmsg, errmsglen
-		,	"Cannot skip first line from %s"
-		,	PROCROUTE);
-		rc = OCF_ERR_GENERIC; goto out;
+	if (proc_route_read(routefd, &routes, &nroutes, err, sizeof(err)) < 0) {
+		snprintf(errmsg, errmsglen, "%s: %s", path, err);
+		fclose(routefd);
+		return OCF_ERR_GENERIC;
 	}
-	*best_netmask = 0;
-	while (fgets(buf, sizeof(buf), routefd) != NULL) {
-		if (sscanf(buf, "%[^\t]\t%lx%lx%lx%lx%lx%lx%lx"
-		,	interface, &dest, &gw, &flags, &refcnt, &use
-		,	&metric, &mask)
-		!= 8) {
-			snprintf(errmsg, errmsglen, "Bad line in %s: %s"
-			,	PROCROUTE, buf);
-			rc = OCF_ERR_GENERIC; goto out;
-		}
-		if ( (in->s_addr&mask) == (in_addr_t)(dest&mask)
-		&&	metric <= best_metric && mask >= *best_netmask) {
-			best_metric = metric;
-			*best_netmask = mask;
-			strncpy(best_if, interface, best_iflen);
-		}
+	fclose(routefd);
+	if (proc_route_lpm(&lpm, routes, nroutes) < 0) {
+		snprintf(errmsg, errmsglen, "Out of memory");
+		free(routes);
+		return OCF_ERR_GENERIC;
 	}
 
-	if (best_metric == LONG_MAX) {
+	*best_netmask = 0;
+	if ((best = proc_route_lookup(&lpm, routes, in->s_addr)) != NULL) {
+		*best_netmask = best->plen
+		?	htonl(~0UL << (32 - best->plen) & 0xffffffffUL) : 0;
+		strncpy(best_if, best->ifname, best_iflen);
+	} else {
 		snprintf(errmsg, errmsglen, "No route to %s\n", address);
 		rc = OCF_ERR_GENERIC; 
 	}
-
-  out:
-	if (routefd) {
-		fclose(routefd);
-	}
-
+	lpm_free(&lpm);
+	free(routes);
 	return(rc);
 }
 
@@ -559,56 +864,1546 @@ int ConvertQuadToInt(char *dest)
 	return netmask_bits(ntohl(ad.s_addr));
 }
 
-int
-main(int argc, char ** argv) {
-
-	char *	address = NULL;
-	char *	bcast_arg = NULL;
-	char *	netmaskbits = NULL;
-	struct in_addr	in;
-	struct in_addr	addr_out;
-	unsigned long	netmask = 0;
-	char	best_if[MAXSTR];
-	char *	if_specified = NULL;
+#ifdef __linux__
+/*
+ * The IPv6 flavour of the below: no broadcast address, prefixes up to
+ * 128 bits, link-local addresses need the interface to be given, and
+ * routes only come from rtnetlink.
+ */
+static int
+FindIf6(char *address, char *netmaskbits, char *if_specified)
+{
+	struct in6_addr	in6;
 	struct ifreq	ifr;
-	unsigned long	best_netmask = UINT_MAX;
-	int		argerrs	= 0;
-	int		nmbits;
-
-	cmdname=argv[0];
+	char	best_if[MAXSTR];
+	char	errmsg[MAXSTR] = "";
+	int	prefixlen = -1;
+	int	oif = 0;
+	int	rc;
 
+	if (inet_pton(AF_INET6, address, (void *)&in6) <= 0) {
+		fprintf(stderr, "IP address [%s] not valid.", address);
+		usage(OCF_ERR_CONFIGURED);
+		/* not reached */
+	}
 
-	memset(&addr_out, 0, sizeof(addr_out));
-	memset(&in, 0, sizeof(in));
-	memset(&ifr, 0, sizeof(ifr));
+	if (netmaskbits != NULL && *netmaskbits != EOS) {
+		size_t nmblen = strnlen(netmaskbits, 4);
 
-	switch (argc) {
-	case 1:	/* No -C argument */
-		break;
-	case 2: /* Hopefully a -C argument */
-		if (strncmp(argv[1], "-C", sizeof("-C")) != 0) {
-			argerrs=1;
+		if (nmblen <= 3 && strspn(netmaskbits, "0123456789") == nmblen) {
+			prefixlen = atoi(netmaskbits);
+		}
+		if (prefixlen < 1 || prefixlen > 128) {
+			fprintf(stderr, "Invalid netmask specification"
+			" [%s]", netmaskbits);
+			usage(OCF_ERR_CONFIGURED);
+			/*not reached */
 		}
-		OutputInCIDR=1;
-		break;
-	default:
-		argerrs=1;
-		break;
-	}
-	if (argerrs) {
-		usage(OCF_ERR_ARGS);
-		/* not reached */
-		return(1);
 	}
 
-	GetAddress (&address, &netmaskbits, &bcast_arg
-	,	 &if_specified);
-	if (address == NULL || *address == EOS) {
-		fprintf(stderr, "ERROR: IP address parameter is mandatory.");
+	if (if_specified != NULL && *if_specified != EOS) {
+		memset(&ifr, 0, sizeof(ifr));
+		if (ValidateIFName(if_specified, &ifr) < 0) {
+			usage(OCF_ERR_CONFIGURED);
+			/* not reached */
+		}
+		oif = if_nametoindex(if_specified);
+		strncpy(best_if, if_specified, sizeof(best_if) - 1);
+		*(best_if + sizeof(best_if) - 1) = '\0';
+	} else if (IN6_IS_ADDR_LINKLOCAL(&in6)) {
+		fprintf(stderr, "'nic' parameter is mandatory for a link local"
+		" address [%s].", address);
 		usage(OCF_ERR_CONFIGURED);
 		/* not reached */
 	}
 
+	if (!oif || prefixlen < 0) {
+		char	route_if[MAXSTR];
+		int	route_prefixlen;
+
+		rc = NetlinkLookup(AF_INET6, &in6, oif, route_if
+		,	sizeof(route_if), &route_prefixlen
+		,	errmsg, sizeof(errmsg));
+		if (rc != 0) {
+			fprintf(stderr, "%s", *errmsg ? errmsg
+			:	"Cannot look up IPv6 routes\n");
+			return rc < 0 ? OCF_ERR_GENERIC : rc;
+		}
+		if (!oif) {
+			strncpy(best_if, route_if, sizeof(best_if) - 1);
+			*(best_if + sizeof(best_if) - 1) = '\0';
+		}
+		if (prefixlen < 0) {
+			prefixlen = route_prefixlen;
+		}
+	}
+	if (prefixlen == 0) {
+		fprintf(stderr
+		,	"ERROR: Cannot use default route w/o netmask [%s]\n"
+		,	 address);
+		return(OCF_ERR_GENERIC);
+	}
+
+	printf("%s\tnetmask %d\tbroadcast \n", best_if, prefixlen);
+	return(0);
+}
+
+/*
+ * findif -e: everything findif.sh works out with ip, awk and grep
+ * (parameter checks, route match, prefix length, broadcast address,
+ * and whether the address is configured already), from one dump each
+ * of the links, addresses and routes, printed as shell assignments.
+ */
+struct fi_route {
+	unsigned char	family;
+	unsigned char	dst_len;
+	unsigned char	type;
+	unsigned char	scope;
+	unsigned	table;
+	unsigned	metric;
+	int		oif;
+	int		has_prefsrc;
+	int		dead;		/* deleted, slot on the free list */
+	unsigned char	dst[16];
+	unsigned char	prefsrc[16];
+};
+
+struct fi_addr {
+	unsigned char	family;
+	unsigned char	prefixlen;
+	int		ifindex;
+	int		has_brd;
+	unsigned char	addr[16];
+	unsigned char	brd[4];
+	char		label[IFNAMSIZ];
+};
+
+struct fi_link {
+	int		ifindex;
+	unsigned	flags;
+	char		name[IFNAMSIZ];
+};
+
+struct fi_tables {
+	struct fi_route	*routes;
+	size_t		nroutes, maxroutes;
+	int32_t		*freeroutes;	/* indices of dead routes */
+	size_t		nfree, maxfree;
+	struct fi_addr	*addrs;
+	size_t		naddrs, maxaddrs;
+	struct fi_link	*links;
+	size_t		nlinks, maxlinks;
+	int		oom;
+	/* the main table unicast routes, by prefix */
+	struct lpm	lpm4, lpm6;
+};
+
+/* one resource: its OCF_RESKEY_ip, cidr_netmask, nic and broadcast */
+struct fi_query {
+	const char	*ip;
+	const char	*netmask;
+	const char	*nic;
+	const char	*broadcast;
+};
+
+struct fi_result {
+	const char	*family;
+	char		nic[IFNAMSIZ];
+	char		netmask[INET_ADDRSTRLEN];
+	char		broadcast[INET_ADDRSTRLEN];
+	char		assigned_nic[IFNAMSIZ];
+	int		assigned_netmask;
+	char		assigned_label[IFNAMSIZ];
+	char		warning[MAXSTR];
+	char		errmsg[MAXSTR];
+};
+
+static void *
+fi_grow(void *v, size_t n, size_t *max, size_t size, int *oom)
+{
+	void *nv;
+
+	if (n < *max) {
+		return v;
+	}
+	nv = realloc(v, (*max ? *max * 2 : 64) * size);
+	if (nv == NULL) {
+		*oom = 1;
+		return NULL;
+	}
+	*max = *max ? *max * 2 : 64;
+	return nv;
+}
+
+/*
+ * Only the main table unicast routes, and the local table loopback
+ * networks for 127.x, are of any use to fi_resolve().
+ */
+static int
+fi_route_parse(const struct nlmsghdr *h, struct fi_route *rt)
+{
+	const struct rtmsg *r = NLMSG_DATA(h);
+	const struct rtattr *a;
+	int len = RTM_PAYLOAD(h);
+
+	if ((h->nlmsg_type != RTM_NEWROUTE && h->nlmsg_type != RTM_DELROUTE)
+	||	(r->rtm_family != AF_INET && r->rtm_family != AF_INET6)) {
+		return -1;
+	}
+	memset(rt, 0, sizeof(*rt));
+	rt->family = r->rtm_family;
+	rt->dst_len = r->rtm_dst_len;
+	rt->type = r->rtm_type;
+	rt->scope = r->rtm_scope;
+	rt->table = r->rtm_table;
+	for (a = RTM_RTA(r); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		switch (a->rta_type) {
+		case RTA_DST:
+			if (RTA_PAYLOAD(a) <= sizeof(rt->dst)) {
+				memcpy(rt->dst, RTA_DATA(a), RTA_PAYLOAD(a));
+			}
+			break;
+		case RTA_PREFSRC:
+			if (RTA_PAYLOAD(a) <= sizeof(rt->prefsrc)) {
+				memcpy(rt->prefsrc, RTA_DATA(a), RTA_PAYLOAD(a));
+				rt->has_prefsrc = 1;
+			}
+			break;
+		case RTA_OIF:
+			rt->oif = *(const int *)RTA_DATA(a);
+			break;
+		case RTA_PRIORITY:
+			rt->metric = *(const unsigned *)RTA_DATA(a);
+			break;
+		case RTA_TABLE:
+			rt->table = *(const unsigned *)RTA_DATA(a);
+			break;
+		}
+	}
+	if (rt->table == RT_TABLE_MAIN && rt->type == RTN_UNICAST) {
+		return 0;
+	}
+	if (rt->family == AF_INET && rt->table == RT_TABLE_LOCAL
+	&&	rt->type == RTN_LOCAL && rt->scope == RT_SCOPE_HOST
+	&&	rt->dst_len > 0 && rt->dst_len < 32) {
+		return 0;
+	}
+	return -1;
+}
+
+static int
+fi_route_add(struct fi_tables *t, const struct fi_route *rt)
+{
+	struct fi_route *v;
+	int32_t id;
+
+	if (t->nfree > 0) {
+		id = t->freeroutes[--t->nfree];
+	} else {
+		v = fi_grow(t->routes, t->nroutes, &t->maxroutes, sizeof(*v)
+		,	&t->oom);
+		if (v == NULL) {
+			return -1;
+		}
+		t->routes = v;
+		id = t->nroutes++;
+	}
+	t->routes[id] = *rt;
+	if (rt->table == RT_TABLE_MAIN
+	&&	lpm_insert(rt->family == AF_INET ? &t->lpm4 : &t->lpm6
+		,	rt->dst, rt->dst_len, id) < 0) {
+		t->oom = 1;
+		return -1;
+	}
+	return 0;
+}
+
+static void
+fi_route_del(struct fi_tables *t, int32_t id)
+{
+	struct fi_route *rt = &t->routes[id];
+	int32_t *v;
+
+	if (rt->table == RT_TABLE_MAIN) {
+		lpm_remove(rt->family == AF_INET ? &t->lpm4 : &t->lpm6
+		,	rt->dst, rt->dst_len, id);
+	}
+	rt->dead = 1;
+	v = fi_grow(t->freeroutes, t->nfree, &t->maxfree, sizeof(*v), &t->oom);
+	if (v != NULL) {
+		t->freeroutes = v;
+		t->freeroutes[t->nfree++] = id;
+	}
+}
+
+/*
+ * The route the kernel means by rt: same destination, table, type
+ * and metric, and with exact also the same interface.
+ */
+static int32_t
+fi_route_find(const struct fi_tables *t, const struct fi_route *rt, int exact)
+{
+	int32_t id;
+	size_t i;
+
+	if (rt->table == RT_TABLE_MAIN) {
+		const struct lpm *lpm = rt->family == AF_INET ? &t->lpm4 : &t->lpm6;
+
+		for (id = lpm_find(lpm, rt->dst, rt->dst_len); id != LPM_NONE
+		;	id = lpm->next[id]) {
+			const struct fi_route *r = &t->routes[id];
+
+			if (r->type == rt->type && r->metric == rt->metric
+			&&	(!exact || r->oif == rt->oif)) {
+				return id;
+			}
+		}
+		return LPM_NONE;
+	}
+	for (i = 0; i < t->nroutes; i++) {
+		const struct fi_route *r = &t->routes[i];
+
+		if (!r->dead && r->family == rt->family && r->table == rt->table
+		&&	r->dst_len == rt->dst_len && r->type == rt->type
+		&&	memcmp(r->dst, rt->dst, sizeof(r->dst)) == 0
+		&&	(!exact || r->oif == rt->oif)) {
+			return (int32_t)i;
+		}
+	}
+	return LPM_NONE;
+}
+
+static void
+fi_route_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct fi_tables *t = arg;
+	struct fi_route rt;
+
+	if (fi_route_parse(h, &rt) == 0) {
+		fi_route_add(t, &rt);
+	}
+}
+
+static int
+fi_addr_parse(const struct nlmsghdr *h, struct fi_addr *fa)
+{
+	const struct ifaddrmsg *ifa = NLMSG_DATA(h);
+	const struct rtattr *a;
+	const void *addr = NULL, *local = NULL;
+	int len = IFA_PAYLOAD(h);
+	int alen = ifa->ifa_family == AF_INET ? 4 : 16;
+
+	if ((h->nlmsg_type != RTM_NEWADDR && h->nlmsg_type != RTM_DELADDR)
+	||	(ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) {
+		return -1;
+	}
+	memset(fa, 0, sizeof(*fa));
+	fa->family = ifa->ifa_family;
+	fa->prefixlen = ifa->ifa_prefixlen;
+	fa->ifindex = ifa->ifa_index;
+	for (a = IFA_RTA(ifa); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+		if ((int)RTA_PAYLOAD(a) < (a->rta_type == IFA_LABEL ? 1 : alen)) {
+			continue;
+		}
+		switch (a->rta_type) {
+		case IFA_ADDRESS:
+			addr = RTA_DATA(a);
+			break;
+		case IFA_LOCAL:
+			local = RTA_DATA(a);
+			break;
+		case IFA_BROADCAST:
+			if (alen == 4) {
+				memcpy(fa->brd, RTA_DATA(a), 4);
+				fa->has_brd = 1;
+			}
+			break;
+		case IFA_LABEL:
+			strncpy(fa->label, RTA_DATA(a), IFNAMSIZ - 1);
+			break;
+		}
+	}
+	/* IFA_LOCAL is the address itself, IFA_ADDRESS may be the peer */
+	if (local == NULL) {
+		local = addr;
+	}
+	if (local == NULL) {
+		return -1;
+	}
+	memcpy(fa->addr, local, alen);
+	return 0;
+}
+
+static void
+fi_addr_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct fi_tables *t = arg;
+	struct fi_addr fa;
+	struct fi_addr *v;
+
+	if (fi_addr_parse(h, &fa) < 0) {
+		return;
+	}
+	v = fi_grow(t->addrs, t->naddrs, &t->maxaddrs, sizeof(*v), &t->oom);
+	if (v == NULL) {
+		return;
+	}
+	t->addrs = v;
+	t->addrs[t->naddrs++] = fa;
+}
+
+static int
+fi_link_parse(const struct nlmsghdr *h, struct fi_link *link)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(h);
+
+	if (h->nlmsg_type != RTM_NEWLINK && h->nlmsg_type != RTM_DELLINK) {
+		return -1;
+	}
+	link->ifindex = ifi->ifi_index;
+	link->flags = ifi->ifi_flags;
+	link->name[0] = EOS;
+	nl_link_cb(h, link->name);
+	return 0;
+}
+
+static void
+fi_link_cb(const struct nlmsghdr *h, void *arg)
+{
+	struct fi_tables *t = arg;
+	struct fi_link link;
+	struct fi_link *v;
+
+	if (fi_link_parse(h, &link) < 0) {
+		return;
+	}
+	v = fi_grow(t->links, t->nlinks, &t->maxlinks, sizeof(*v), &t->oom);
+	if (v == NULL) {
+		return;
+	}
+	t->links = v;
+	t->links[t->nlinks++] = link;
+}
+
+static void
+fi_free(struct fi_tables *t)
+{
+	lpm_free(&t->lpm4);
+	lpm_free(&t->lpm6);
+	free(t->routes);
+	free(t->freeroutes);
+	free(t->addrs);
+	free(t->links);
+	memset(t, 0, sizeof(*t));
+}
+
+static const struct fi_link *
+fi_link_by_index(const struct fi_tables *t, int ifindex)
+{
+	size_t i;
+
+	for (i = 0; i < t->nlinks; i++) {
+		if (t->links[i].ifindex == ifindex) {
+			return &t->links[i];
+		}
+	}
+	return NULL;
+}
+
+static const struct fi_link *
+fi_link_by_name(const struct fi_tables *t, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < t->nlinks; i++) {
+		if (strncmp(t->links[i].name, name, IFNAMSIZ) == 0) {
+			return &t->links[i];
+		}
+	}
+	return NULL;
+}
+
+static const struct fi_addr *
+fi_addr_find(const struct fi_tables *t, int family, const unsigned char *addr)
+{
+	size_t i;
+
+	for (i = 0; i < t->naddrs; i++) {
+		if (t->addrs[i].family == family
+		&&	memcmp(t->addrs[i].addr, addr
+			,	family == AF_INET ? 4 : 16) == 0) {
+			return &t->addrs[i];
+		}
+	}
+	return NULL;
+}
+
+/* -R: the IPv4 main table from a file, as if dumped from the kernel */
+static int
+fi_load_route_file(struct fi_tables *t)
+{
+	struct proc_route *pr;
+	size_t npr, i;
+	char errmsg[MAXSTR];
+	FILE *f;
+	int rc;
+
+	if ((f = fopen(RouteFile, "r")) == NULL) {
+		return -1;
+	}
+	rc = proc_route_read(f, &pr, &npr, errmsg, sizeof(errmsg));
+	fclose(f);
+	if (rc < 0) {
+		fprintf(stderr, "%s: %s\n", RouteFile, errmsg);
+		return -1;
+	}
+	for (i = 0; i < npr && rc == 0; i++) {
+		const struct fi_link *link = fi_link_by_name(t, pr[i].ifname);
+		struct fi_route rt;
+
+		memset(&rt, 0, sizeof(rt));
+		rt.family = AF_INET;
+		rt.dst_len = pr[i].plen;
+		rt.type = RTN_UNICAST;
+		rt.scope = pr[i].gateway ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+		rt.table = RT_TABLE_MAIN;
+		rt.metric = pr[i].metric;
+		rt.oif = link ? link->ifindex : 0;
+		memcpy(rt.dst, &pr[i].dest, 4);
+		rc = fi_route_add(t, &rt);
+	}
+	free(pr);
+	return rc;
+}
+
+static int
+fi_load(struct fi_tables *t)
+{
+	struct {
+		struct nlmsghdr	h;
+		struct rtgenmsg	g;
+	} req;
+	int fd, rc = 0;
+
+	memset(t, 0, sizeof(*t));
+	lpm_init(&t->lpm4, 32);
+	lpm_init(&t->lpm6, 128);
+	if ((fd = nl_open(NETLINK_ROUTE, NULL, 0)) < 0) {
+		return -1;
+	}
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+	req.h.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.g.rtgen_family = AF_UNSPEC;
+
+	req.h.nlmsg_type = RTM_GETLINK;
+	rc = nl_talk(fd, &req.h, fi_link_cb, t);
+	if (rc == 0) {
+		req.h.nlmsg_type = RTM_GETADDR;
+		rc = nl_talk(fd, &req.h, fi_addr_cb, t);
+	}
+	if (rc == 0 && RouteFile) {
+		rc = fi_load_route_file(t);
+	} else if (rc == 0) {
+		req.h.nlmsg_type = RTM_GETROUTE;
+		rc = nl_talk(fd, &req.h, fi_route_cb, t);
+	}
+	close(fd);
+	if (rc != 0 || t->oom) {
+		fi_free(t);
+		return -1;
+	}
+	return 0;
+}
+
+/* findif.sh's ipcheck_ipv4: a dotted quad, not starting with 0 */
+static int
+fi_ipcheck_ipv4(const char *s)
+{
+	int i, n;
+
+	for (i = 0; i < 4; i++) {
+		const char *start = s;
+
+		n = 0;
+		while (isdigit((int)*s) && s - start < 3) {
+			n = n * 10 + (*s++ - '0');
+		}
+		if (s == start || n > 255 || (i == 0 && n == 0)
+		||	(i == 0 && *start == '0')) {
+			return 0;
+		}
+		if (*s != (i == 3 ? EOS : '.')) {
+			return 0;
+		}
+		s++;
+	}
+	return 1;
+}
+
+/* findif.sh's prefixcheck: one to three digits, 1 .. max */
+static int
+fi_prefixcheck(const char *s, int max)
+{
+	size_t len = strnlen(s, 4);
+	int bits;
+
+	if (len == 0 || len > 3 || strspn(s, "0123456789") != len) {
+		return 0;
+	}
+	bits = atoi(s);
+	return bits >= 1 && bits <= max;
+}
+
+static int
+fi_resolve(const struct fi_tables *t, const struct fi_query *q
+,	int validate, struct fi_result *r)
+{
+	unsigned char addr[16];
+	const struct fi_route *best = NULL;
+	const struct fi_link *link = NULL;
+	const struct fi_addr *fa;
+	int family, alen, have_addr;
+	int nm = -1;
+	size_t i;
+
+	memset(r, 0, sizeof(*r));
+	if (q->ip == NULL || *q->ip == EOS) {
+		snprintf(r->errmsg, sizeof(r->errmsg)
+		,	"IP address parameter is mandatory.");
+		return OCF_ERR_CONFIGURED;
+	}
+	family = strchr(q->ip, ':') ? AF_INET6 : AF_INET;
+	alen = family == AF_INET ? 4 : 16;
+	r->family = family == AF_INET ? "inet" : "inet6";
+	have_addr = inet_pton(family, q->ip, addr) > 0;
+
+	/* maybe_convert_dotted_quad_to_cidr */
+	if (q->netmask && *q->netmask != EOS) {
+		strncpy(r->netmask, q->netmask, sizeof(r->netmask) - 1);
+		if (strchr(q->netmask, '.') != NULL) {
+			struct in_addr m;
+			uint32_t hm, inv;
+
+			if (fi_ipcheck_ipv4(q->netmask) || strcmp(q->netmask, "0.0.0.0") == 0) {
+				inet_pton(AF_INET, q->netmask, &m);
+				hm = ntohl(m.s_addr);
+				inv = ~hm;
+				if ((inv & (inv + 1)) == 0) {
+					snprintf(r->netmask, sizeof(r->netmask), "%d"
+					,	netmask_bits(hm));
+					snprintf(r->warning, sizeof(r->warning)
+					,	"Please convert dotted quad netmask %s"
+						" to CIDR notation %s!"
+					,	q->netmask, r->netmask);
+				} else {
+					snprintf(r->warning, sizeof(r->warning)
+					,	"Bogus netmask: %s", q->netmask);
+				}
+			}
+		}
+	}
+
+	/* findif_check_params, on start and validate-all only */
+	if (validate) {
+		if (q->nic && *q->nic != EOS && fi_link_by_name(t, q->nic) == NULL) {
+			snprintf(r->errmsg, sizeof(r->errmsg)
+			,	"Invalid interface name [%s]: Device \"%s\" does not exist."
+			,	q->nic, q->nic);
+			return OCF_ERR_CONFIGURED;
+		}
+		if (family == AF_INET6) {
+			if (strspn(q->ip, "0123456789abcdefABCDEF:") != strlen(q->ip)) {
+				snprintf(r->errmsg, sizeof(r->errmsg)
+				,	"IP address [%s] not valid.", q->ip);
+				return OCF_ERR_CONFIGURED;
+			}
+			if ((q->nic == NULL || *q->nic == EOS)
+			&&	strncasecmp(q->ip, "fe80::", 6) == 0) {
+				snprintf(r->errmsg, sizeof(r->errmsg)
+				,	"'nic' parameter is mandatory for a link local address [%s]."
+				,	q->ip);
+				return OCF_ERR_CONFIGURED;
+			}
+		} else if (!fi_ipcheck_ipv4(q->ip)) {
+			snprintf(r->errmsg, sizeof(r->errmsg)
+			,	"IP address [%s] not valid.", q->ip);
+			return OCF_ERR_CONFIGURED;
+		}
+		if (*r->netmask != EOS && !fi_prefixcheck(r->netmask, alen * 8)) {
+			snprintf(r->errmsg, sizeof(r->errmsg)
+			,	"Invalid netmask specification [%s].", r->netmask);
+			return OCF_ERR_CONFIGURED;
+		}
+		if (family == AF_INET && q->broadcast && *q->broadcast != EOS
+		&&	!fi_ipcheck_ipv4(q->broadcast)
+		&&	strcmp(q->broadcast, "+") != 0 && strcmp(q->broadcast, "-") != 0) {
+			snprintf(r->errmsg, sizeof(r->errmsg)
+			,	"Invalid broadcast address [%s].", q->broadcast);
+			return OCF_ERR_CONFIGURED;
+		}
+	}
+	if (*r->netmask != EOS && fi_prefixcheck(r->netmask, alen * 8)) {
+		nm = atoi(r->netmask);
+	}
+	if (q->nic && *q->nic != EOS) {
+		link = fi_link_by_name(t, q->nic);
+	}
+
+	/*
+	 * "ip route list match ip[/netmask] [scope link]" in the main
+	 * table, through nic if given: the longest prefix wins, then the
+	 * lowest metric. Host and default routes are not considered, ip
+	 * prints them without a prefix length.
+	 */
+	if (have_addr) {
+		const struct lpm *lpm = family == AF_INET ? &t->lpm4 : &t->lpm6;
+		int32_t first[LPM_MAXBITS + 1], id;
+		size_t n, j;
+
+		n = lpm_lookup(lpm, addr, first, LPM_MAXBITS + 1);
+		for (j = 0; best == NULL && j < n; j++) {
+			for (id = first[j]; id != LPM_NONE; id = lpm->next[id]) {
+				const struct fi_route *rt = &t->routes[id];
+
+				if (rt->dst_len == 0 || rt->dst_len == alen * 8
+				||	(family == AF_INET && rt->scope != RT_SCOPE_LINK)
+				||	(nm >= 0 && rt->dst_len > nm)
+				||	(q->nic && *q->nic != EOS
+					&& (link == NULL || rt->oif != link->ifindex))) {
+					continue;
+				}
+				if (best == NULL || rt->metric < best->metric) {
+					best = rt;
+				}
+			}
+		}
+	}
+	/* no loopback route in the main table on some distributions */
+	if (best == NULL && have_addr && strncmp(q->ip, "127.", 4) == 0) {
+		for (i = 0; i < t->nroutes; i++) {
+			const struct fi_route *rt = &t->routes[i];
+
+			if (!rt->dead
+			&&	rt->family == AF_INET && rt->table == RT_TABLE_LOCAL
+			&&	rt->type == RTN_LOCAL && rt->scope == RT_SCOPE_HOST
+			&&	rt->dst_len > 0 && rt->dst_len < 32
+			&&	prefix_match(addr, rt->dst, rt->dst_len)) {
+				best = rt;
+				break;
+			}
+		}
+	}
+
+	if (q->nic && *q->nic != EOS) {
+		strncpy(r->nic, q->nic, sizeof(r->nic) - 1);
+	}
+	if (*r->nic == EOS || *r->netmask == EOS) {
+		const struct fi_link *dev;
+
+		if (best == NULL) {
+			snprintf(r->errmsg, sizeof(r->errmsg)
+			,	"Unable to find nic or netmask.");
+			return OCF_ERR_GENERIC;
+		}
+		dev = fi_link_by_index(t, best->oif);
+		if (*r->nic == EOS && dev) {
+			snprintf(r->nic, sizeof(r->nic), "%s", dev->name);
+		}
+		if (*r->netmask == EOS) {
+			snprintf(r->netmask, sizeof(r->netmask), "%d", best->dst_len);
+		}
+	}
+
+	/* the broadcast address of the route's source address */
+	if (family == AF_INET && q->broadcast && *q->broadcast != EOS) {
+		strncpy(r->broadcast, q->broadcast, sizeof(r->broadcast) - 1);
+	} else if (family == AF_INET && best && best->has_prefsrc
+	&&	best->table == RT_TABLE_MAIN) {
+		fa = fi_addr_find(t, AF_INET, best->prefsrc);
+		if (fa && fa->has_brd) {
+			inet_ntop(AF_INET, fa->brd, r->broadcast, sizeof(r->broadcast));
+		}
+	}
+
+	if (have_addr && (fa = fi_addr_find(t, family, addr)) != NULL) {
+		const struct fi_link *dev = fi_link_by_index(t, fa->ifindex);
+
+		if (dev) {
+			snprintf(r->assigned_nic, sizeof(r->assigned_nic), "%s", dev->name);
+		}
+		r->assigned_netmask = fa->prefixlen;
+		snprintf(r->assigned_label, sizeof(r->assigned_label), "%s", fa->label);
+	}
+	return OCF_SUCCESS;
+}
+
+/*
+ * findif -D: keep the tables of findif -e in memory, current through
+ * rtnetlink notifications, and answer queries of findif -e and
+ * --batch over a unix socket. Those use the daemon when it is there
+ * and read the tables themselves when it is not.
+ *
+ * One request per line, the fields separated by tabs,
+ *
+ *	validate ip netmask nic broadcast
+ *
+ * and one answer per line,
+ *
+ *	rc family nic netmask broadcast assigned_nic assigned_netmask
+ *	assigned_label warning errmsg
+ */
+#define FI_MAXCLIENTS	64
+#define FI_LINESIZE	1024
+#define FI_TIMEOUT	2	/* s, then the client does without */
+
+static const char *SocketPath=FI_SOCKET;
+
+/* the kernel flushes IPv4 routes of a link going down silently */
+static void
+fi_route_purge(struct fi_tables *t, int ifindex)
+{
+	size_t i;
+
+	for (i = 0; i < t->nroutes; i++) {
+		if (!t->routes[i].dead && t->routes[i].oif == ifindex) {
+			fi_route_del(t, (int32_t)i);
+		}
+	}
+}
+
+/* apply one notification to the tables */
+static void
+fi_update(struct fi_tables *t, const struct nlmsghdr *h)
+{
+	struct fi_route rt;
+	struct fi_addr fa;
+	struct fi_link link;
+	int32_t id;
+	size_t i;
+
+	switch (h->nlmsg_type) {
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		if (fi_route_parse(h, &rt) < 0) {
+			break;
+		}
+		if (h->nlmsg_type == RTM_DELROUTE) {
+			if ((id = fi_route_find(t, &rt, 1)) != LPM_NONE
+			||	(id = fi_route_find(t, &rt, 0)) != LPM_NONE) {
+				fi_route_del(t, id);
+			}
+		} else if (h->nlmsg_flags & NLM_F_REPLACE) {
+			if ((id = fi_route_find(t, &rt, 0)) != LPM_NONE) {
+				fi_route_del(t, id);
+			}
+			fi_route_add(t, &rt);
+		} else if (fi_route_find(t, &rt, 1) == LPM_NONE) {
+			/* or it was in the dump already */
+			fi_route_add(t, &rt);
+		}
+		break;
+
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		if (fi_addr_parse(h, &fa) < 0) {
+			break;
+		}
+		for (i = 0; i < t->naddrs; i++) {
+			if (t->addrs[i].family == fa.family
+			&&	t->addrs[i].ifindex == fa.ifindex
+			&&	t->addrs[i].prefixlen == fa.prefixlen
+			&&	memcmp(t->addrs[i].addr, fa.addr, sizeof(fa.addr)) == 0) {
+				break;
+			}
+		}
+		if (h->nlmsg_type == RTM_DELADDR) {
+			if (i < t->naddrs) {
+				t->addrs[i] = t->addrs[--t->naddrs];
+			}
+		} else if (i < t->naddrs) {
+			t->addrs[i] = fa;
+		} else {
+			fi_addr_cb(h, t);
+		}
+		break;
+
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		if (fi_link_parse(h, &link) < 0) {
+			break;
+		}
+		for (i = 0; i < t->nlinks; i++) {
+			if (t->links[i].ifindex == link.ifindex) {
+				break;
+			}
+		}
+		if (h->nlmsg_type == RTM_DELLINK || !(link.flags & IFF_UP)) {
+			fi_route_purge(t, link.ifindex);
+		}
+		if (h->nlmsg_type == RTM_DELLINK) {
+			if (i < t->nlinks) {
+				t->links[i] = t->links[--t->nlinks];
+			}
+		} else if (i < t->nlinks) {
+			t->links[i] = link;
+		} else {
+			fi_link_cb(h, t);
+		}
+		break;
+	}
+}
+
+static int
+fi_events_open(void)
+{
+	static const unsigned groups[] = {
+		RTNLGRP_LINK,
+		RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV6_IFADDR,
+		RTNLGRP_IPV4_ROUTE, RTNLGRP_IPV6_ROUTE,
+	};
+	int fd, sz = 4 * 1024 * 1024;
+
+	fd = nl_open(NETLINK_ROUTE, groups, sizeof(groups) / sizeof(groups[0]));
+	if (fd < 0) {
+		return -1;
+	}
+	/* room for a burst of route changes, as much as we are allowed */
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &sz, sizeof(sz)) < 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+	}
+	return fd;
+}
+
+/*
+ * Apply the pending notifications. Returns 0, 1 if some were lost
+ * (the tables have to be read again) or -1 on error.
+ */
+static int
+fi_events_read(int fd, struct fi_tables *t)
+{
+	static char buf[NL_BUFSIZE];
+
+	for (;;) {
+		struct nlmsghdr *h;
+		int len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			return errno == ENOBUFS ? 1 : -1;
+		}
+		for (h = (struct nlmsghdr *)(void *)buf; NLMSG_OK(h, (unsigned)len)
+		;	h = NLMSG_NEXT(h, len)) {
+			fi_update(t, h);
+		}
+		if (t->oom) {
+			return 1;
+		}
+	}
+}
+
+/* split s at tabs into at most n fields, return how many */
+static int
+fi_split(char *s, char **field, int n)
+{
+	int i = 0;
+
+	field[i++] = s;
+	while (i < n && (s = strchr(s, '\t')) != NULL) {
+		*s++ = EOS;
+		field[i++] = s;
+	}
+	return i;
+}
+
+static int
+fi_clean(const char *s)
+{
+	return s == NULL || strcspn(s, "\t\n") == strlen(s);
+}
+
+/* answer one request line into out */
+static void
+fi_answer(const struct fi_tables *t, char *req, char *out, size_t outlen)
+{
+	struct fi_query q;
+	struct fi_result r;
+	char *f[5];
+	int rc;
+
+	if (fi_split(req, f, 5) != 5) {
+		snprintf(out, outlen, "%d\t\t\t\t\t\t\t\t\tBad request\n"
+		,	OCF_ERR_ARGS);
+		return;
+	}
+	q.ip = f[1];
+	q.netmask = f[2];
+	q.nic = f[3];
+	q.broadcast = f[4];
+	rc = fi_resolve(t, &q, *f[0] == '1', &r);
+	snprintf(out, outlen, "%d\t%s\t%s\t%s\t%s\t%s\t%d\t%s\t%s\t%s\n"
+	,	rc, r.family ? r.family : "", r.nic, r.netmask, r.broadcast
+	,	r.assigned_nic, r.assigned_netmask, r.assigned_label
+	,	r.warning, r.errmsg);
+}
+
+struct fi_client {
+	int	fd;
+	size_t	len;
+	char	buf[FI_LINESIZE];
+};
+
+static volatile sig_atomic_t fi_stop;
+
+static void
+fi_stop_handler(int sig)
+{
+	(void)sig;
+	fi_stop = 1;
+}
+
+static int
+fi_listen(const char *path)
+{
+	struct sockaddr_un sun;
+	mode_t mask;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	/* someone answering there already? */
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0) {
+		close(fd);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	close(fd);
+	unlink(path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0
+	||	listen(fd, FI_MAXCLIENTS) < 0) {
+		umask(mask);
+		close(fd);
+		return -1;
+	}
+	umask(mask);
+	return fd;
+}
+
+static int
+FindIfDaemon(void)
+{
+	struct pollfd pfd[FI_MAXCLIENTS + 2];
+	struct fi_client *clients;
+	struct fi_tables t;
+	struct sigaction sa;
+	char out[FI_LINESIZE];
+	int nlfd, lfd, nclients = 0, npolled, i, rc;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = fi_stop_handler;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	/* subscribe first, so that nothing between dump and now is missed */
+	if ((nlfd = fi_events_open()) < 0) {
+		fprintf(stderr, "Cannot subscribe to rtnetlink: %s\n"
+		,	strerror(errno));
+		return OCF_ERR_GENERIC;
+	}
+	if (fi_load(&t) < 0) {
+		fprintf(stderr, "Cannot read the routing tables\n");
+		return OCF_ERR_GENERIC;
+	}
+	if ((lfd = fi_listen(SocketPath)) < 0) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", SocketPath
+		,	strerror(errno));
+		return OCF_ERR_GENERIC;
+	}
+	if ((clients = calloc(FI_MAXCLIENTS, sizeof(*clients))) == NULL) {
+		return OCF_ERR_GENERIC;
+	}
+
+	while (!fi_stop) {
+		pfd[0].fd = nlfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = lfd;
+		pfd[1].events = nclients < FI_MAXCLIENTS ? POLLIN : 0;
+		for (i = 0; i < nclients; i++) {
+			pfd[i + 2].fd = clients[i].fd;
+			pfd[i + 2].events = POLLIN;
+		}
+		npolled = nclients;
+		if (poll(pfd, npolled + 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		/* notifications first, answers are to be current */
+		if (pfd[0].revents) {
+			rc = fi_events_read(nlfd, &t);
+			if (rc < 0) {
+				break;
+			}
+			if (rc > 0) {
+				fi_free(&t);
+				if (fi_load(&t) < 0) {
+					fprintf(stderr, "Cannot read the routing tables\n");
+					break;
+				}
+			}
+		}
+		if (pfd[1].revents & POLLIN) {
+			int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+
+			if (fd >= 0) {
+				clients[nclients].fd = fd;
+				clients[nclients].len = 0;
+				nclients++;
+			}
+		}
+		/* a client accepted just now was not polled yet */
+		for (i = npolled - 1; i >= 0; i--) {
+			struct fi_client *c = &clients[i];
+			char *nl;
+			ssize_t n;
+			int drop = 0;
+
+			if (!pfd[i + 2].revents) {
+				continue;
+			}
+			n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1
+			,	MSG_DONTWAIT);
+			if (n <= 0) {
+				drop = n == 0 || (errno != EINTR && errno != EAGAIN);
+			} else {
+				c->len += n;
+				c->buf[c->len] = EOS;
+				while ((nl = strchr(c->buf, '\n')) != NULL) {
+					size_t used = nl - c->buf + 1;
+
+					*nl = EOS;
+					fi_answer(&t, c->buf, out, sizeof(out));
+					if (send(c->fd, out, strlen(out)
+					,	MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+						drop = 1;
+						break;
+					}
+					memmove(c->buf, c->buf + used, c->len - used + 1);
+					c->len -= used;
+				}
+				/* a line longer than any request */
+				if (c->len == sizeof(c->buf) - 1) {
+					drop = 1;
+				}
+			}
+			if (drop) {
+				close(c->fd);
+				clients[i] = clients[--nclients];
+			}
+		}
+	}
+
+	for (i = 0; i < nclients; i++) {
+		close(clients[i].fd);
+	}
+	free(clients);
+	close(lfd);
+	unlink(SocketPath);
+	close(nlfd);
+	fi_free(&t);
+	return fi_stop ? OCF_SUCCESS : OCF_ERR_GENERIC;
+}
+
+static int
+fi_daemon_open(void)
+{
+	struct sockaddr_un sun;
+	struct timeval tv;
+	int fd;
+
+	/* -R: the tables are not the kernel's */
+	if (RouteFile || strlen(SocketPath) >= sizeof(sun.sun_path)) {
+		return -1;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, SocketPath);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+		close(fd);
+		return -1;
+	}
+	tv.tv_sec = FI_TIMEOUT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	return fd;
+}
+
+/* the daemon's answer, or -1 to work it out here after all */
+static int
+fi_daemon_query(int fd, const struct fi_query *q, int validate
+,	struct fi_result *r)
+{
+	char buf[FI_LINESIZE];
+	char *f[10];
+	size_t len = 0;
+	ssize_t n;
+	int rc;
+
+	if (!fi_clean(q->ip) || !fi_clean(q->netmask) || !fi_clean(q->nic)
+	||	!fi_clean(q->broadcast)) {
+		return -1;
+	}
+	n = snprintf(buf, sizeof(buf), "%d\t%s\t%s\t%s\t%s\n", validate ? 1 : 0
+	,	q->ip ? q->ip : "", q->netmask ? q->netmask : ""
+	,	q->nic ? q->nic : "", q->broadcast ? q->broadcast : "");
+	if (n < 0 || (size_t)n >= sizeof(buf)
+	||	send(fd, buf, n, MSG_NOSIGNAL) != n) {
+		return -1;
+	}
+	while (len == 0 || buf[len - 1] != '\n') {
+		n = recv(fd, buf + len, sizeof(buf) - len - 1, 0);
+		if (n <= 0 || (len += n) == sizeof(buf) - 1) {
+			return -1;
+		}
+	}
+	buf[len - 1] = EOS;
+	if (fi_split(buf, f, 10) != 10) {
+		return -1;
+	}
+	memset(r, 0, sizeof(*r));
+	rc = atoi(f[0]);
+	r->family = strcmp(f[1], "inet") == 0 ? "inet"
+	:	strcmp(f[1], "inet6") == 0 ? "inet6" : NULL;
+	snprintf(r->nic, sizeof(r->nic), "%s", f[2]);
+	snprintf(r->netmask, sizeof(r->netmask), "%s", f[3]);
+	snprintf(r->broadcast, sizeof(r->broadcast), "%s", f[4]);
+	snprintf(r->assigned_nic, sizeof(r->assigned_nic), "%s", f[5]);
+	r->assigned_netmask = atoi(f[6]);
+	snprintf(r->assigned_label, sizeof(r->assigned_label), "%s", f[7]);
+	snprintf(r->warning, sizeof(r->warning), "%s", f[8]);
+	snprintf(r->errmsg, sizeof(r->errmsg), "%s", f[9]);
+	return rc;
+}
+
+/* answers from the daemon if there is one, else from tables read here */
+struct fi_resolver {
+	int		fd;
+	int		loaded;		/* -1: not tried yet */
+	struct fi_tables t;
+};
+
+static void
+fi_resolver_init(struct fi_resolver *rv)
+{
+	rv->fd = fi_daemon_open();
+	rv->loaded = -1;
+}
+
+static int
+fi_resolver_query(struct fi_resolver *rv, const struct fi_query *q
+,	int validate, struct fi_result *r)
+{
+	int rc;
+
+	if (rv->fd >= 0) {
+		if ((rc = fi_daemon_query(rv->fd, q, validate, r)) >= 0) {
+			return rc;
+		}
+		close(rv->fd);
+		rv->fd = -1;
+	}
+	if (rv->loaded < 0) {
+		rv->loaded = fi_load(&rv->t) == 0;
+	}
+	if (!rv->loaded) {
+		memset(r, 0, sizeof(*r));
+		snprintf(r->errmsg, sizeof(r->errmsg)
+		,	"Cannot read the routing tables.");
+		return OCF_ERR_GENERIC;
+	}
+	return fi_resolve(&rv->t, q, validate, r);
+}
+
+static void
+fi_resolver_close(struct fi_resolver *rv)
+{
+	if (rv->fd >= 0) {
+		close(rv->fd);
+	}
+	if (rv->loaded > 0) {
+		fi_free(&rv->t);
+	}
+}
+
+/* print name='value', quoted for the shell */
+static void
+fi_print_var(const char *name, const char *value)
+{
+	printf("%s='", name);
+	for (; *value; value++) {
+		if (*value == '\'') {
+			fputs("'\\''", stdout);
+		} else {
+			putchar(*value);
+		}
+	}
+	printf("'\n");
+}
+
+static int
+FindIfExport(int validate)
+{
+	struct fi_resolver rv;
+	struct fi_query q;
+	struct fi_result r;
+	char *ip, *netmask, *broadcast, *nic;
+	char nm[8] = "";
+	int rc;
+
+	GetAddress(&ip, &netmask, &broadcast, &nic);
+	q.ip = ip;
+	q.netmask = netmask;
+	q.broadcast = broadcast;
+	q.nic = nic;
+
+	fi_resolver_init(&rv);
+	rc = fi_resolver_query(&rv, &q, validate, &r);
+	fi_resolver_close(&rv);
+
+	if (r.assigned_nic[0] != EOS) {
+		snprintf(nm, sizeof(nm), "%d", r.assigned_netmask);
+	}
+	fi_print_var("family", r.family ? r.family : "");
+	fi_print_var("nic", r.nic);
+	fi_print_var("netmask", r.netmask);
+	fi_print_var("broadcast", r.broadcast);
+	fi_print_var("assigned_nic", r.assigned_nic);
+	fi_print_var("assigned_netmask", nm);
+	fi_print_var("assigned_label", r.assigned_label);
+	fi_print_var("warning", r.warning);
+	fi_print_var("errmsg", r.errmsg);
+	return rc;
+}
+
+/*
+ * findif --batch: one record per line on stdin,
+ *
+ *	address[/mask][,nic][,broadcast]
+ *
+ * answered with one line each, the tables being read only once
+ * (or by the findif -D daemon):
+ *
+ *	record<TAB>rc<TAB>nic<TAB>netmask<TAB>broadcast<TAB>message
+ *
+ * rc is the OCF code findif -e would exit with for that record and
+ * message its warning or error. Empty lines and lines starting with
+ * '#' are skipped. Exits 0 if all records resolved, 1 otherwise.
+ */
+static int
+FindIfBatch(int validate)
+{
+	struct fi_resolver rv;
+	struct fi_query q;
+	struct fi_result r;
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+	int rc, ret = OCF_SUCCESS;
+
+	fi_resolver_init(&rv);
+	while ((len = getline(&line, &linesz, stdin)) >= 0) {
+		char *rec, *field, *p;
+
+		while (len > 0 && isspace((int)line[len - 1])) {
+			line[--len] = EOS;
+		}
+		for (rec = line; isspace((int)*rec); rec++)
+			;
+		if (*rec == EOS || *rec == '#') {
+			continue;
+		}
+		printf("%s\t", rec);
+
+		/* split a copy, the record is echoed as it was */
+		memset(&q, 0, sizeof(q));
+		p = strdup(rec);
+		if (p == NULL) {
+			printf("%d\t\t\t\t%s\n", OCF_ERR_GENERIC, strerror(errno));
+			ret = OCF_ERR_GENERIC;
+			continue;
+		}
+		q.ip = field = p;
+		if ((field = strchr(field, ',')) != NULL) {
+			*field++ = EOS;
+			q.nic = field;
+			if ((field = strchr(field, ',')) != NULL) {
+				*field++ = EOS;
+				q.broadcast = field;
+			}
+		}
+		if ((field = strchr(p, DELIM)) != NULL) {
+			*field++ = EOS;
+			q.netmask = field;
+		}
+
+		rc = fi_resolver_query(&rv, &q, validate, &r);
+		if (rc == OCF_SUCCESS) {
+			printf("%d\t%s\t%s\t%s\t%s\n", rc, r.nic, r.netmask
+			,	r.broadcast, r.warning);
+		} else {
+			printf("%d\t\t\t\t%s\n", rc, r.errmsg);
+			ret = OCF_ERR_GENERIC;
+		}
+		free(p);
+	}
+	free(line);
+	fi_resolver_close(&rv);
+	return ret;
+}
+#endif /* __linux__ */
+
+int
+main(int argc, char ** argv) {
+
+	char *	address = NULL;
+	char *	bcast_arg = NULL;
+	char *	netmaskbits = NULL;
+	struct in_addr	in;
+	struct in_addr	addr_out;
+	unsigned long	netmask = 0;
+	char	best_if[MAXSTR];
+	char *	if_specified = NULL;
+	struct ifreq	ifr;
+	unsigned long	best_netmask = UINT_MAX;
+	int		argerrs	= 0;
+	int		nmbits;
+	int		ch;
+	char *		endp;
+	int		export = 0, validate = 0, batch = 0, daemon = 0;
+#ifdef __linux__
+	static const struct option long_options[] = {
+		{"batch", no_argument, NULL, 'b'},
+		{NULL, 0, NULL, 0}
+	};
+#else
+	static const struct option long_options[] = {
+		{NULL, 0, NULL, 0}
+	};
+#endif
+
+	cmdname=argv[0];
+
+
+	memset(&addr_out, 0, sizeof(addr_out));
+	memset(&in, 0, sizeof(in));
+	memset(&ifr, 0, sizeof(ifr));
+
+	while ((ch = getopt_long(argc, argv, "Ct:m:R:eVDS:", long_options, NULL)) != EOF) {
+		switch (ch) {
+		case 'C':
+			OutputInCIDR=1;
+			break;
+#ifdef __linux__
+		case 'e':
+			export=1;
+			break;
+		case 'V':
+			validate=1;
+			break;
+		case 'b':
+			batch=1;
+			break;
+		case 'D':
+			daemon=1;
+			break;
+		case 'S':
+			SocketPath = optarg;
+			break;
+#endif
+		case 't':
+			RouteTable = strtoul(optarg, &endp, 0);
+			if (*endp != EOS || RouteTable == 0) {
+				argerrs=1;
+			}
+			break;
+		case 'm':
+			RouteMark = strtoul(optarg, &endp, 0);
+			if (*endp != EOS) {
+				argerrs=1;
+			}
+			break;
+		case 'R':
+			RouteFile = optarg;
+			break;
+		default:
+			argerrs=1;
+			break;
+		}
+	}
+	if (optind != argc) {
+		argerrs=1;
+	}
+	if (argerrs) {
+		usage(OCF_ERR_ARGS);
+		/* not reached */
+		return(1);
+	}
+
+#ifdef __linux__
+	if (daemon) {
+		return FindIfDaemon();
+	}
+	if (batch) {
+		return FindIfBatch(validate);
+	}
+	if (export) {
+		return FindIfExport(validate);
+	}
+#endif
+
+	GetAddress (&address, &netmaskbits, &bcast_arg
+	,	 &if_specified);
+	if (address == NULL || *address == EOS) {
+		fprintf(stderr, "ERROR: IP address parameter is mandatory.");
+		usage(OCF_ERR_CONFIGURED);
+		/* not reached */
+	}
+
+	if (strchr(address, ':') != NULL) {
+#ifdef __linux__
+		return FindIf6(address, netmaskbits, if_specified);
+#else
+		fprintf(stderr, "IPv6 address [%s] not supported.", address);
+		usage(OCF_ERR_CONFIGURED);
+		/* not reached */
+#endif
+	}
+
 	/* Is the IP address we're supposed to find valid? */
 	 
 	if (inet_pton(AF_INET, address, (void *)&in) <= 0) {
@@ -764,16 +2559,32 @@ usage(int ec)
 	fprintf(stderr, "\n"
 		"%s version 2.99.1 Copyright Alan Robertson\n"
 		"\n"
-		"Usage: %s [-C]\n"
+		"Usage: %s [-C] [-t table] [-m fwmark] [-R file]\n"
+		"       %s [-R file] -e [-V]\n"
+		"       %s [-R file] --batch [-V]\n"
+		"       %s -D [-S socket]\n"
 		"Options:\n"
 		"    -C: Output netmask as the number of bits rather "
 			"than as 4 octets.\n"
+		"    -t: Look the route up in this routing table.\n"
+		"    -m: Look the route up with this firewall mark.\n"
+		"    -R: Read the IPv4 routes from this file, in the format\n"
+		"        of " PROCROUTE ", rather than from the kernel.\n"
+		"    -e: Work out nic, netmask and broadcast like findif.sh,\n"
+		"        print them as shell variable assignments.\n"
+		"    -V: With -e or --batch, check the parameters as on start.\n"
+		"    --batch: Read address[/mask][,nic][,broadcast] records\n"
+		"        from stdin, print for each one the record, the OCF\n"
+		"        code, nic, netmask, broadcast and a message.\n"
+		"    -D: Keep the tables -e and --batch need up to date and\n"
+		"        answer their queries, they use it when it runs.\n"
+		"    -S: The socket of -D, default " FI_SOCKET ".\n"
 		"Environment variables:\n"
 		"OCF_RESKEY_ip		 ip address (mandatory!)\n"
 		"OCF_RESKEY_cidr_netmask netmask of interface\n"
 		"OCF_RESKEY_broadcast	 broadcast address for interface\n"
 		"OCF_RESKEY_nic		 interface to assign to\n"
-	,	cmdname, cmdname);
+	,	cmdname, cmdname, cmdname, cmdname, cmdname);
 	exit(ec);
 }
 
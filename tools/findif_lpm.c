@@ -0,0 +1,379 @@
+/*
+ * findif_lpm.c: longest prefix match over a routing table
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <arpa/inet.h>
+
+#include "findif_lpm.h"
+
+#define PROC_RTF_GATEWAY	0x0002	/* RTF_GATEWAY in <linux/route.h> */
+
+/* do the first bits of a and b match? */
+static int
+lpm_prefix_match(const uint8_t *a, const uint8_t *b, unsigned bits)
+{
+	unsigned n = bits / 8;
+
+	if (memcmp(a, b, n) != 0) {
+		return 0;
+	}
+	if (bits % 8) {
+		uint8_t m = 0xff << (8 - bits % 8);
+		return (a[n] & m) == (b[n] & m);
+	}
+	return 1;
+}
+
+/* length of the common prefix of a and b, at most bits */
+static unsigned
+lpm_common(const uint8_t *a, const uint8_t *b, unsigned bits)
+{
+	unsigned i;
+
+	for (i = 0; i < bits / 8 && a[i] == b[i]; i++)
+		;
+	i *= 8;
+	while (i < bits && !((a[i / 8] ^ b[i / 8]) & (0x80 >> (i % 8)))) {
+		i++;
+	}
+	return i;
+}
+
+static int
+lpm_bit(const uint8_t *a, unsigned n)
+{
+	return (a[n / 8] >> (7 - n % 8)) & 1;
+}
+
+void
+lpm_init(struct lpm *t, unsigned bits)
+{
+	memset(t, 0, sizeof(*t));
+	t->bits = bits;
+	t->root = LPM_NONE;
+}
+
+void
+lpm_free(struct lpm *t)
+{
+	free(t->nodes);
+	free(t->next);
+	lpm_init(t, t->bits);
+}
+
+static int32_t
+lpm_node(struct lpm *t, const uint8_t *key, unsigned plen)
+{
+	struct lpm_node *n;
+
+	if (t->nnodes == t->maxnodes) {
+		size_t max = t->maxnodes ? t->maxnodes * 2 : 64;
+
+		n = realloc(t->nodes, max * sizeof(*n));
+		if (n == NULL) {
+			return LPM_NONE;
+		}
+		t->nodes = n;
+		t->maxnodes = max;
+	}
+	n = &t->nodes[t->nnodes];
+	memset(n->key, 0, sizeof(n->key));
+	memcpy(n->key, key, (plen + 7) / 8);
+	if (plen % 8) {
+		n->key[plen / 8] &= 0xff << (8 - plen % 8);
+	}
+	n->plen = plen;
+	n->child[0] = n->child[1] = LPM_NONE;
+	n->first = LPM_NONE;
+	return t->nnodes++;
+}
+
+/* add route id to the list of prefix node i */
+static int
+lpm_add(struct lpm *t, int32_t i, int32_t id)
+{
+	int32_t *p;
+
+	if ((size_t)id >= t->maxnext) {
+		size_t max = t->maxnext ? t->maxnext : 64;
+
+		while (max <= (size_t)id) {
+			max *= 2;
+		}
+		if ((p = realloc(t->next, max * sizeof(*p))) == NULL) {
+			return -1;
+		}
+		t->next = p;
+		t->maxnext = max;
+	}
+	/* append, so that routes keep the order they were inserted in */
+	t->next[id] = LPM_NONE;
+	for (p = &t->nodes[i].first; *p != LPM_NONE; p = &t->next[*p])
+		;
+	*p = id;
+	return 0;
+}
+
+/* hang node n where cur was: under parent, or at the root */
+static void
+lpm_link(struct lpm *t, int32_t parent, int side, int32_t n)
+{
+	if (parent == LPM_NONE) {
+		t->root = n;
+	} else {
+		t->nodes[parent].child[side] = n;
+	}
+}
+
+/*
+ * Insert the route with caller index id (0, 1, 2, ... each used once)
+ * under prefix/plen. Returns 0, or -1 if out of memory.
+ */
+int
+lpm_insert(struct lpm *t, const void *prefix, unsigned plen, int32_t id)
+{
+	const uint8_t *key = prefix;
+	int32_t parent = LPM_NONE, cur = t->root, n, leaf;
+	int side = 0;
+	unsigned common;
+
+	if (plen > t->bits || id < 0) {
+		return -1;
+	}
+	while (cur != LPM_NONE) {
+		common = lpm_common(key, t->nodes[cur].key
+		,	plen < t->nodes[cur].plen ? plen : t->nodes[cur].plen);
+		if (common < t->nodes[cur].plen) {
+			break;
+		}
+		if (common == plen) {
+			return lpm_add(t, cur, id);
+		}
+		parent = cur;
+		side = lpm_bit(key, common);
+		cur = t->nodes[cur].child[side];
+	}
+	if (cur == LPM_NONE) {
+		if ((n = lpm_node(t, key, plen)) == LPM_NONE) {
+			return -1;
+		}
+		lpm_link(t, parent, side, n);
+		return lpm_add(t, n, id);
+	}
+
+	/*
+	 * The new prefix and cur part ways after common bits: either the
+	 * new one is a prefix of cur and goes in front of it, or both hang
+	 * off a new branch node.
+	 */
+	if ((n = lpm_node(t, key, common)) == LPM_NONE) {
+		return -1;
+	}
+	t->nodes[n].child[lpm_bit(t->nodes[cur].key, common)] = cur;
+	lpm_link(t, parent, side, n);
+	if (common == plen) {
+		return lpm_add(t, n, id);
+	}
+	if ((leaf = lpm_node(t, key, plen)) == LPM_NONE) {
+		return -1;
+	}
+	t->nodes[n].child[lpm_bit(key, common)] = leaf;
+	return lpm_add(t, leaf, id);
+}
+
+/* the route list of exactly prefix/plen, or LPM_NONE */
+int32_t
+lpm_find(const struct lpm *t, const void *prefix, unsigned plen)
+{
+	int32_t cur = t->root;
+
+	while (cur != LPM_NONE) {
+		const struct lpm_node *node = &t->nodes[cur];
+
+		if (node->plen > plen
+		||	!lpm_prefix_match(prefix, node->key, node->plen)) {
+			return LPM_NONE;
+		}
+		if (node->plen == plen) {
+			return node->first;
+		}
+		cur = node->child[lpm_bit(prefix, node->plen)];
+	}
+	return LPM_NONE;
+}
+
+/*
+ * Take route id off the list of prefix/plen. The node stays, without
+ * routes it is just a branch point. Returns 0, or -1 if not found.
+ */
+int
+lpm_remove(struct lpm *t, const void *prefix, unsigned plen, int32_t id)
+{
+	int32_t cur = t->root, *p;
+
+	while (cur != LPM_NONE && t->nodes[cur].plen < plen) {
+		if (!lpm_prefix_match(prefix, t->nodes[cur].key, t->nodes[cur].plen)) {
+			return -1;
+		}
+		cur = t->nodes[cur].child[lpm_bit(prefix, t->nodes[cur].plen)];
+	}
+	if (cur == LPM_NONE || t->nodes[cur].plen != plen
+	||	!lpm_prefix_match(prefix, t->nodes[cur].key, plen)) {
+		return -1;
+	}
+	for (p = &t->nodes[cur].first; *p != LPM_NONE; p = &t->next[*p]) {
+		if (*p == id) {
+			*p = t->next[id];
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * The route lists of all prefixes containing addr, longest first,
+ * at most max of them (LPM_MAXBITS + 1 is always enough).
+ */
+size_t
+lpm_lookup(const struct lpm *t, const void *addr, int32_t *first, size_t max)
+{
+	int32_t path[LPM_MAXBITS + 1];
+	size_t n = 0, i;
+	int32_t cur = t->root;
+
+	while (cur != LPM_NONE) {
+		const struct lpm_node *node = &t->nodes[cur];
+
+		if (!lpm_prefix_match(addr, node->key, node->plen)) {
+			break;
+		}
+		if (node->first != LPM_NONE) {
+			path[n++] = node->first;
+		}
+		if (node->plen == t->bits) {
+			break;
+		}
+		cur = node->child[lpm_bit(addr, node->plen)];
+	}
+	for (i = 0; i < n && i < max; i++) {
+		first[i] = path[n - 1 - i];
+	}
+	return i;
+}
+
+size_t
+lpm_memory(const struct lpm *t)
+{
+	return t->maxnodes * sizeof(*t->nodes) + t->maxnext * sizeof(*t->next);
+}
+
+/*
+ * Read a /proc/net/route style table, header line included.
+ * Returns 0, or -1 with errmsg filled in.
+ */
+int
+proc_route_read(FILE *f, struct proc_route **routes, size_t *nroutes
+,	char *errmsg, int errmsglen)
+{
+	unsigned long	flags, refcnt, use, gw, mask, dest;
+	long		metric;
+	char		buf[2048];
+	char		interface[128];
+	struct proc_route *v = NULL, *nv;
+	size_t		n = 0, max = 0;
+	uint32_t	hmask;
+
+	/* Skip first (header) line */
+	if (fgets(buf, sizeof(buf), f) == NULL) {
+		snprintf(errmsg, errmsglen, "Cannot skip first line");
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		if (sscanf(buf, "%127[^\t]\t%lx%lx%lx%lx%lx%lx%lx"
+		,	interface, &dest, &gw, &flags, &refcnt, &use
+		,	&metric, &mask)
+		!= 8) {
+			snprintf(errmsg, errmsglen, "Bad line: %s", buf);
+			free(v);
+			return -1;
+		}
+		if (n == max) {
+			max = max ? max * 2 : 64;
+			if ((nv = realloc(v, max * sizeof(*v))) == NULL) {
+				snprintf(errmsg, errmsglen, "Out of memory");
+				free(v);
+				return -1;
+			}
+			v = nv;
+		}
+		/* the columns are the in-memory (network order) values */
+		hmask = ntohl((uint32_t)mask);
+		v[n].plen = 0;
+		while (v[n].plen < 32 && (hmask & (0x80000000U >> v[n].plen))) {
+			v[n].plen++;
+		}
+		v[n].dest = (uint32_t)dest & htonl(v[n].plen
+		?	0xffffffffU << (32 - v[n].plen) : 0);
+		v[n].metric = metric;
+		v[n].gateway = (flags & PROC_RTF_GATEWAY) != 0;
+		strncpy(v[n].ifname, interface, sizeof(v[n].ifname) - 1);
+		v[n].ifname[sizeof(v[n].ifname) - 1] = '\0';
+		n++;
+	}
+	*routes = v;
+	*nroutes = n;
+	return 0;
+}
+
+int
+proc_route_lpm(struct lpm *t, const struct proc_route *routes, size_t nroutes)
+{
+	size_t i;
+
+	lpm_init(t, 32);
+	for (i = 0; i < nroutes; i++) {
+		if (lpm_insert(t, &routes[i].dest, routes[i].plen, (int32_t)i) < 0) {
+			lpm_free(t);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* the longest matching prefix, lowest metric on ties, first one listed */
+const struct proc_route *
+proc_route_lookup(const struct lpm *t, const struct proc_route *routes
+,	uint32_t addr)
+{
+	const struct proc_route *best = NULL;
+	int32_t first, id;
+
+	if (lpm_lookup(t, &addr, &first, 1) == 0) {
+		return NULL;
+	}
+	for (id = first; id != LPM_NONE; id = t->next[id]) {
+		if (best == NULL || routes[id].metric < best->metric) {
+			best = &routes[id];
+		}
+	}
+	return best;
+}
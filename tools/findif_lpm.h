@@ -0,0 +1,83 @@
+/*
+ * findif_lpm.h: longest prefix match over a routing table
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FINDIF_LPM_H
+#define FINDIF_LPM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Path-compressed binary trie over the prefixes of one address family.
+ * Nodes only exist where a prefix ends or where two prefixes branch,
+ * so a lookup visits at most one node per prefix length on the path
+ * of the address, whatever the size of the table.
+ *
+ * The trie does not own the routes: each prefix carries a list of
+ * caller indices (several routes can share a prefix, through other
+ * interfaces or with other metrics) which the caller filters itself.
+ */
+#define LPM_NONE	(-1)
+#define LPM_MAXBITS	128
+
+struct lpm_node {
+	uint8_t		key[16];	/* the prefix, host bits cleared */
+	uint8_t		plen;
+	int32_t		child[2];
+	int32_t		first;		/* first route index, or LPM_NONE */
+};
+
+struct lpm {
+	unsigned	bits;		/* 32 or 128 */
+	int32_t		root;
+	struct lpm_node	*nodes;
+	size_t		nnodes, maxnodes;
+	int32_t		*next;		/* next route with the same prefix */
+	size_t		maxnext;
+};
+
+void lpm_init(struct lpm *t, unsigned bits);
+void lpm_free(struct lpm *t);
+int lpm_insert(struct lpm *t, const void *prefix, unsigned plen, int32_t id);
+int lpm_remove(struct lpm *t, const void *prefix, unsigned plen, int32_t id);
+int32_t lpm_find(const struct lpm *t, const void *prefix, unsigned plen);
+size_t lpm_lookup(const struct lpm *t, const void *addr
+,	int32_t *first, size_t max);
+size_t lpm_memory(const struct lpm *t);
+
+/*
+ * IPv4 routes in /proc/net/route format: the fallback mechanism of
+ * findif and the input of its benchmark.
+ */
+struct proc_route {
+	uint32_t	dest;		/* network byte order */
+	uint8_t		plen;
+	long		metric;
+	int		gateway;	/* RTF_GATEWAY */
+	char		ifname[16];
+};
+
+int proc_route_read(FILE *f, struct proc_route **routes, size_t *nroutes
+,	char *errmsg, int errmsglen);
+int proc_route_lpm(struct lpm *t, const struct proc_route *routes
+,	size_t nroutes);
+const struct proc_route *proc_route_lookup(const struct lpm *t
+,	const struct proc_route *routes, uint32_t addr);
+
+#endif /* FINDIF_LPM_H */
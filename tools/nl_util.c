@@ -0,0 +1,181 @@
+/*
+ * nl_util: the netlink requests shared by findif, IPv6addr, announced,
+ * send_arp, ethmonitor_check and tickle_tcp.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <nl_util.h>
+
+#ifdef __linux__
+#include <linux/rtnetlink.h>
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK	270
+#endif
+
+static unsigned nl_seq;
+
+int
+nl_open(int proto, const unsigned *groups, int ngroups)
+{
+	struct sockaddr_nl snl;
+	int fd, i;
+
+	if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, proto)) < 0) {
+		return -1;
+	}
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	if (bind(fd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		goto err;
+	}
+	for (i = 0; i < ngroups; i++) {
+		if (setsockopt(fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP
+		,	&groups[i], sizeof(groups[i])) < 0) {
+			goto err;
+		}
+	}
+	return fd;
+
+err:
+	i = errno;
+	close(fd);
+	errno = i;
+	return -1;
+}
+
+void
+nl_addattr(struct nlmsghdr *n, int type, const void *data, int alen)
+{
+	struct rtattr *rta;
+	int len = RTA_LENGTH(alen);
+
+	rta = (struct rtattr *)(((char *)n) + NLMSG_ALIGN(n->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = len;
+	memcpy(RTA_DATA(rta), data, alen);
+	n->nlmsg_len = NLMSG_ALIGN(n->nlmsg_len) + RTA_ALIGN(len);
+}
+
+int
+nl_talk(int fd, struct nlmsghdr *req
+,	void (*cb)(const struct nlmsghdr *, void *), void *arg)
+{
+	char *buf;
+	int done = 0, rc = 0;
+
+	req->nlmsg_seq = ++nl_seq;
+	if (send(fd, req, req->nlmsg_len, 0) < 0) {
+		return -1;
+	}
+	if ((buf = malloc(NL_BUFSIZE)) == NULL) {
+		return -1;
+	}
+	while (!done) {
+		struct nlmsghdr *h;
+		int len = recv(fd, buf, NL_BUFSIZE, 0);
+
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			rc = -1;
+			break;
+		}
+		for (h = (struct nlmsghdr *)(void *)buf; NLMSG_OK(h, (unsigned)len)
+		;	h = NLMSG_NEXT(h, len)) {
+			if (h->nlmsg_seq != req->nlmsg_seq) {
+				continue;
+			}
+			if (h->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (h->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(h);
+				rc = -e->error;
+				done = 1;
+				break;
+			}
+			if (cb) {
+				cb(h, arg);
+			}
+			if (!(h->nlmsg_flags & NLM_F_MULTI)) {
+				done = 1;
+			}
+		}
+	}
+	free(buf);
+	return rc;
+}
+
+int
+nl_talk_batch(int fd, char *req, int len, int count, int *errors)
+{
+	struct nlmsghdr *h;
+	unsigned first = nl_seq + 1;
+	char *buf;
+	int i, left, acked = 0;
+
+	for (h = (struct nlmsghdr *)(void *)req, left = len, i = 0
+	;	NLMSG_OK(h, (unsigned)left) && i < count
+	;	h = NLMSG_NEXT(h, left), i++) {
+		h->nlmsg_seq = ++nl_seq;
+		errors[i] = -1;
+	}
+	if (send(fd, req, len, 0) < 0) {
+		return -1;
+	}
+	if ((buf = malloc(NL_BUFSIZE)) == NULL) {
+		return -1;
+	}
+	while (acked < count) {
+		int n = recv(fd, buf, NL_BUFSIZE, 0);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		for (h = (struct nlmsghdr *)(void *)buf; NLMSG_OK(h, (unsigned)n)
+		;	h = NLMSG_NEXT(h, n)) {
+			struct nlmsgerr *e = NLMSG_DATA(h);
+
+			if (h->nlmsg_type != NLMSG_ERROR
+			||	h->nlmsg_seq - first >= (unsigned)count) {
+				continue;
+			}
+			errors[h->nlmsg_seq - first] = -e->error;
+			acked++;
+		}
+	}
+	free(buf);
+	return acked == count ? 0 : -1;
+}
+
+#endif /* __linux__ */
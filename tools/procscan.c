@@ -0,0 +1,451 @@
+/*
+ * procscan: find the processes that keep a file system busy.
+ *
+ *	For the "safe" force_unmount of the Filesystem resource agent:
+ *	the processes whose cwd, root, exe, open files or mappings are on
+ *	the file system mounted at the given directory. Like the find and
+ *	grep it replaces, it never looks anything up by path on that file
+ *	system, so a dead NFS server cannot hang it.
+ *
+ *	Files are matched by their mount, not by their path name: the
+ *	links under /proc/<pid> are stat'ed with AT_STATX_DONT_SYNC, which
+ *	tells NFS and the like not to ask their server, and compared by
+ *	mount id. Mappings are matched by the device in /proc/<pid>/maps,
+ *	and those on the device confirmed by mount id through
+ *	/proc/<pid>/map_files. Where there is no mount id to compare
+ *	(older kernels, map_files not readable), the device must match
+ *	and the path be under the mount point, which must then be given
+ *	as it is in /proc/mounts.
+ *
+ *	/proc is walked by a pool of threads, each taking a few processes
+ *	at a time. The pids found are printed once each, in order; with -s
+ *	they are sent the signal as well.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#undef _GNU_SOURCE
+#define _GNU_SOURCE
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#define MAX_THREADS	32
+#define CHUNK		16	/* processes taken by a thread at a time */
+#define MAPS_BUFSIZE	65536
+
+static const char *cmdname = "procscan";
+
+/* what a file must be on */
+static dev_t target_dev;
+static unsigned long long target_mnt_id;
+static int have_mnt_id;
+static char target_path[PATH_MAX];
+static size_t target_len;
+
+static pid_t *pids;
+static char *hit;
+static int npids;
+static int next_pid;	/* next index for a thread to take */
+
+#ifdef STATX_BASIC_STATS
+#ifndef STATX_MNT_ID
+#define STATX_MNT_ID	0
+#endif
+
+/* stat without asking a network file system's server */
+static int
+file_id(int dirfd, const char *name, dev_t *dev, unsigned long long *mnt_id)
+{
+	struct statx sx;
+
+	if (statx(dirfd, name, AT_STATX_DONT_SYNC, STATX_INO | STATX_MNT_ID
+	,	&sx) < 0) {
+		return -1;
+	}
+	*dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+	if (!STATX_MNT_ID || !(sx.stx_mask & STATX_MNT_ID)) {
+		return 0;
+	}
+	*mnt_id = sx.stx_mnt_id;
+	return 1;
+}
+#else
+static int
+file_id(int dirfd, const char *name, dev_t *dev, unsigned long long *mnt_id)
+{
+	struct stat st;
+
+	(void)mnt_id;
+	if (fstatat(dirfd, name, &st, 0) < 0) {
+		return -1;
+	}
+	*dev = st.st_dev;
+	return 0;
+}
+#endif
+
+/* is the path at or under the mount point? */
+static int
+path_on_target(const char *path)
+{
+	return !strncmp(path, target_path, target_len)
+	&&	(path[target_len] == '\0' || path[target_len] == '/'
+		|| target_len == 1);
+}
+
+/*
+ * Is the file name (relative to dirfd) on our mount? Without mount
+ * ids, the device alone would also match the rest of the file system
+ * of a bind mount, so the path the link points to must be under the
+ * mount point too, as with the shell walk.
+ */
+static int
+on_target(int dirfd, const char *name)
+{
+	dev_t dev;
+	unsigned long long mnt_id = 0;
+	char path[PATH_MAX];
+	ssize_t len;
+	int rc = file_id(dirfd, name, &dev, &mnt_id);
+
+	if (rc < 0) {
+		return 0;
+	}
+	if (rc > 0 && have_mnt_id) {
+		return mnt_id == target_mnt_id;
+	}
+	if (dev != target_dev
+	||	(len = readlinkat(dirfd, name, path, sizeof(path) - 1)) < 0) {
+		return 0;
+	}
+	path[len] = '\0';
+	return path_on_target(path);
+}
+
+/*
+ * A mapping on our device: its map_files link has the mount id. When
+ * that cannot be read (it takes CAP_SYS_ADMIN), the path of the maps
+ * line decides.
+ */
+static int
+map_on_target(int pfd, const char *name, const char *path)
+{
+	dev_t dev;
+	unsigned long long mnt_id = 0;
+	int rc = file_id(pfd, name, &dev, &mnt_id);
+
+	if (rc < 0) {
+		return errno != ENOENT && path_on_target(path);
+	}
+	if (rc > 0 && have_mnt_id) {
+		return mnt_id == target_mnt_id;
+	}
+	return path_on_target(path);
+}
+
+static int
+scan_fds(int pfd)
+{
+	DIR *d;
+	struct dirent *de;
+	int fd, found = 0;
+
+	fd = openat(pfd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || !(d = fdopendir(fd))) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return 0;
+	}
+	while (!found && (de = readdir(d)) != NULL) {
+		if (de->d_name[0] != '.') {
+			found = on_target(dirfd(d), de->d_name);
+		}
+	}
+	closedir(d);
+	return found;
+}
+
+/*
+ * maps lines are "start-end perms offset major:minor inode path".
+ * A mapping on our device is checked by mount id, through its
+ * map_files link.
+ */
+static int
+scan_maps(int pfd, char *buf)
+{
+	int fd, len, have = 0, found = 0;
+	char name[64];
+
+	fd = openat(pfd, "maps", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	while (!found && (len = read(fd, buf + have, MAPS_BUFSIZE - 1 - have)) > 0) {
+		char *line = buf, *nl;
+
+		have += len;
+		buf[have] = '\0';
+		while (!found && (nl = strchr(line, '\n')) != NULL) {
+			unsigned long start, end, ino;
+			unsigned maj, min;
+			int pos = 0;
+
+			*nl = '\0';
+			if (sscanf(line, "%lx-%lx %*s %*s %x:%x %lu %n"
+			,	&start, &end, &maj, &min, &ino, &pos) == 5
+			&&	ino && makedev(maj, min) == target_dev) {
+				snprintf(name, sizeof(name), "map_files/%lx-%lx"
+				,	start, end);
+				found = map_on_target(pfd, name, line + pos);
+			}
+			line = nl + 1;
+		}
+		/* keep the partial last line */
+		have -= line - buf;
+		memmove(buf, line, have);
+		if (have == MAPS_BUFSIZE - 1) {
+			have = 0;
+		}
+	}
+	close(fd);
+	return found;
+}
+
+static int
+scan_pid(pid_t pid, char *buf)
+{
+	char path[32];
+	int pfd, found;
+
+	snprintf(path, sizeof(path), "/proc/%d", (int)pid);
+	pfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (pfd < 0) {
+		return 0;
+	}
+	found = on_target(pfd, "cwd") || on_target(pfd, "root")
+	||	on_target(pfd, "exe") || scan_fds(pfd) || scan_maps(pfd, buf);
+	close(pfd);
+	return found;
+}
+
+static void *
+worker(void *arg)
+{
+	char *buf = malloc(MAPS_BUFSIZE);
+	int i, end;
+
+	(void)arg;
+	if (!buf) {
+		return NULL;
+	}
+	while ((i = __sync_fetch_and_add(&next_pid, CHUNK)) < npids) {
+		end = i + CHUNK < npids ? i + CHUNK : npids;
+		for (; i < end; i++) {
+			hit[i] = scan_pid(pids[i], buf);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+static int
+pid_cmp(const void *a, const void *b)
+{
+	pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int
+read_pids(void)
+{
+	DIR *d = opendir("/proc");
+	struct dirent *de;
+	pid_t self = getpid();
+	int max = 0;
+
+	if (!d) {
+		return -1;
+	}
+	while ((de = readdir(d)) != NULL) {
+		char *end;
+		long pid = strtol(de->d_name, &end, 10);
+
+		if (*end || pid <= 0 || pid == self) {
+			continue;
+		}
+		if (npids == max) {
+			pid_t *p;
+
+			max = max ? 2 * max : 1024;
+			if (!(p = realloc(pids, max * sizeof(*pids)))) {
+				closedir(d);
+				return -1;
+			}
+			pids = p;
+		}
+		pids[npids++] = pid;
+	}
+	closedir(d);
+	qsort(pids, npids, sizeof(*pids), pid_cmp);
+	return 0;
+}
+
+static int
+signal_number(const char *s)
+{
+	static const struct {
+		const char *name;
+		int sig;
+	} sigs[] = {
+		{"TERM", SIGTERM}, {"KILL", SIGKILL}, {"HUP", SIGHUP},
+		{"INT", SIGINT}, {"QUIT", SIGQUIT}, {"USR1", SIGUSR1},
+		{"USR2", SIGUSR2}, {"STOP", SIGSTOP}, {"CONT", SIGCONT},
+	};
+	char *end;
+	long n;
+	size_t i;
+
+	if (!strncmp(s, "SIG", 3)) {
+		s += 3;
+	}
+	for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++) {
+		if (!strcmp(s, sigs[i].name)) {
+			return sigs[i].sig;
+		}
+	}
+	n = strtol(s, &end, 10);
+	return *end || end == s || n < 0 || n >= NSIG ? -1 : (int)n;
+}
+
+static void
+usage(int ec)
+{
+	fprintf(stderr, "\n"
+		"Usage: %s [-j threads] [-s signal] mountpoint\n"
+		"Print the pids of the processes using the file system\n"
+		"mounted at mountpoint, one per line.\n"
+		"Options:\n"
+		"    -j: threads walking /proc (default: one per CPU, at most %d)\n"
+		"    -s: also send them this signal (name or number)\n"
+	,	cmdname, MAX_THREADS);
+	exit(ec);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t tid[MAX_THREADS];
+	unsigned long long mnt_id = 0;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int ch, i, rc, sig = 0, failed = 0;
+
+	while ((ch = getopt(argc, argv, "j:s:h")) != -1) {
+		switch (ch) {
+		case 'j':
+			nthreads = atol(optarg);
+			break;
+		case 's':
+			if ((sig = signal_number(optarg)) < 0) {
+				fprintf(stderr, "%s: invalid signal [%s]\n"
+				,	cmdname, optarg);
+				usage(2);
+			}
+			break;
+		case 'h':
+			usage(0);
+		default:
+			usage(2);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(2);
+	}
+	if (nthreads < 1) {
+		nthreads = 1;
+	}
+	if (nthreads > MAX_THREADS) {
+		nthreads = MAX_THREADS;
+	}
+
+	rc = file_id(AT_FDCWD, argv[optind], &target_dev, &mnt_id);
+	if (rc < 0) {
+		fprintf(stderr, "%s: %s: %s\n", cmdname, argv[optind]
+		,	strerror(errno));
+		return 1;
+	}
+	have_mnt_id = rc > 0;
+	target_mnt_id = mnt_id;
+	/* as in /proc/mounts, realpath() would look it up */
+	if (strlen(argv[optind]) >= sizeof(target_path)) {
+		fprintf(stderr, "%s: %s: %s\n", cmdname, argv[optind]
+		,	strerror(ENAMETOOLONG));
+		return 1;
+	}
+	strcpy(target_path, argv[optind]);
+	target_len = strlen(target_path);
+	while (target_len > 1 && target_path[target_len - 1] == '/') {
+		target_path[--target_len] = '\0';
+	}
+
+	if (read_pids() < 0 || !(hit = calloc(npids ? npids : 1, 1))) {
+		fprintf(stderr, "%s: /proc: %s\n", cmdname, strerror(errno));
+		return 1;
+	}
+	if (nthreads > (npids + CHUNK - 1) / CHUNK) {
+		nthreads = (npids + CHUNK - 1) / CHUNK;
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tid[i], NULL, worker, NULL) != 0) {
+			break;
+		}
+	}
+	nthreads = i;
+	/* with no thread at all, or to help them */
+	worker(NULL);
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	for (i = 0; i < npids; i++) {
+		if (!hit[i]) {
+			continue;
+		}
+		if (sig && kill(pids[i], sig) < 0) {
+			if (errno != ESRCH) {
+				fprintf(stderr, "%s: kill %d: %s\n", cmdname
+				,	(int)pids[i], strerror(errno));
+				failed = 1;
+			}
+			continue;
+		}
+		printf("%d\n", (int)pids[i]);
+	}
+	return failed;
+}
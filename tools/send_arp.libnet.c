@@ -5,6 +5,9 @@
  * hardware addresses suuplied by the user.  It uses the libnet libary from
  * Packet Factory (http://www.packetfactory.net/libnet/ ). It has been tested
  * on Linux, FreeBSD, and on Solaris.
+ *
+ * On Linux the packets go out through the packet socket code shared with
+ * send_arp.linux.c (arp_tx.c) instead, libnet being the fallback there.
  * 
  * This inspired by the sample application supplied by Packet Factory.
 
@@ -46,6 +49,18 @@
 #include <clplumbing/timers.h>
 #include <clplumbing/cl_signal.h>
 #include <clplumbing/cl_log.h>
+#include "arp_tx.h"
+
+#ifdef __linux__
+#	include <sys/ioctl.h>
+#	include <net/if.h>
+#	include <net/if_arp.h>
+#	include <arpa/inet.h>
+#	include <linux/if_ether.h>
+#	define NATIVE_UNAVAILABLE	(-2)
+	static int send_arp_native(const char *device, const char *ipaddr
+	,	const char *macaddr, int repeatcount, long msinterval);
+#endif
 
 #ifdef HAVE_LIBNET_1_0_API
 #	define	LTYPE	struct libnet_link_int
@@ -214,6 +229,14 @@ main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+#ifdef __linux__
+	c = send_arp_native(device, ipaddr, macaddr, repeatcount, msinterval);
+	if (c != NATIVE_UNAVAILABLE) {
+		unlink(pidfilename);
+		return c < 0  ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+#endif
+
 	if (!strcasecmp(macaddr, AUTO_MAC_ADDR)) {
 		if (get_hw_addr(device, src_mac) < 0) {
 			 cl_log(LOG_ERR, "Cannot find mac address for %s",
@@ -591,6 +614,98 @@ send_arp(libnet_t* lntag)
 #endif /* HAVE_LIBNET_1_1_API */
 
 
+#ifdef __linux__
+/*
+ * The native path, used instead of libnet on Linux. The same two frames
+ * the libnet path builds (see the notes on send_arp() below) are built
+ * once by arp_tx, and every repeat sends them on one packet socket.
+ * Each frame goes at an absolute time since the start: the request at
+ * j * msinterval, the reply half an interval later, so that neither the
+ * sending nor the rounding of the half interval adds up over the
+ * repeats.
+ *
+ * Returns NATIVE_UNAVAILABLE, having sent nothing, when the packet
+ * socket cannot be set up or the address needs resolving, so that
+ * libnet gets its chance.
+ */
+static int
+send_arp_native(const char *device, const char *ipaddr, const char *macaddr
+,	int repeatcount, long msinterval)
+{
+	struct arp_tx		tx;
+	struct sockaddr_ll	dst;
+	struct ifreq		ifr;
+	struct in_addr		ip;
+	struct timespec		t0;
+	u_char			src_mac[6];
+	u_char			zero_mac[6] = {0, 0, 0, 0, 0, 0};
+	int			fd, j, rc = 0;
+
+	if (!inet_aton(ipaddr, &ip) || strlen(device) >= IFNAMSIZ) {
+		return NATIVE_UNAVAILABLE;
+	}
+	fd = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return NATIVE_UNAVAILABLE;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, device, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0
+	||	ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER
+	||	ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+		close(fd);
+		return NATIVE_UNAVAILABLE;
+	}
+	if (!strcasecmp(macaddr, AUTO_MAC_ADDR)) {
+		/* SIOCGIFINDEX leaves the hardware address alone */
+		memcpy(src_mac, ifr.ifr_hwaddr.sa_data, 6);
+	}
+	else {
+		convert_macaddr((u_char *)macaddr, src_mac);
+	}
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sll_family = AF_PACKET;
+	dst.sll_protocol = htons(ETH_P_ARP);
+	dst.sll_ifindex = ifr.ifr_ifindex;
+	dst.sll_halen = 6;
+	memset(dst.sll_addr, 0xff, 6);
+
+	if (arp_tx_init(&tx, 2) < 0) {
+		close(fd);
+		return NATIVE_UNAVAILABLE;
+	}
+	arp_tx_dest(&tx, &dst);
+	arp_tx_add(&tx, ARPOP_REQUEST, ARPHRD_ETHER, 6, src_mac, ip
+	,	zero_mac, ip);
+	arp_tx_add(&tx, ARPOP_REPLY, ARPHRD_ETHER, 6, src_mac, ip
+	,	src_mac, ip);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (j=0; j < repeatcount; ++j) {
+		if (j) {
+			arp_tx_sleep_until(&t0, j * msinterval);
+		}
+		if (arp_tx_send(&tx, fd, 0, 1) != 1) {
+			cl_log(LOG_ERR, "sending ARP request on %s: %s"
+			,	device, strerror(errno));
+			rc = -1;
+			break;
+		}
+		arp_tx_sleep_until(&t0, j * msinterval + msinterval / 2);
+		if (arp_tx_send(&tx, fd, 1, 1) != 1) {
+			cl_log(LOG_ERR, "sending ARP reply on %s: %s"
+			,	device, strerror(errno));
+			rc = -1;
+			break;
+		}
+	}
+	arp_tx_free(&tx);
+	close(fd);
+	return rc;
+}
+#endif /* __linux__ */
+
 int
 create_pid_directory(const char *pidfilename)  
 {
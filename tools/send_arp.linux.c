@@ -40,6 +40,12 @@
 #include <linux/if_ether.h>
 #include <net/if_arp.h>
 #include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <stdint.h>
 #ifdef CAPABILITIES
 #include <sys/prctl.h>
 #include <sys/capability.h>
@@ -54,6 +60,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "announce.h"
+#include "nl_util.h"
+#include "arp_tx.h"
+
 #ifdef USE_SYSFS
 #include <sysfs/libsysfs.h>
 struct sysfs_devattr_values;
@@ -84,6 +94,9 @@ static void usage(void) __attribute__((noreturn));
 struct device {
 	const char *name;
 	int ifindex;
+	/* from find_device_by_netlink() */
+	unsigned char brd[32];
+	int brd_len;
 #ifndef WITHOUT_IFADDRS
 	struct ifaddrs *ifa;
 #endif
@@ -99,9 +112,14 @@ struct device device = {
 char *source;
 struct in_addr src, dst;
 char *target;
+struct in_addr *targets;	/* hb_mode: all of src_ip_addr, -D: all tested */
+int ntargets;
+int *conflicts;			/* -D: replies for each of targets */
 int dad, unsolicited, advert;
 int quiet;
+int verbose;
 int count=-1;
+int interval=1000;	/* ms between two rounds of requests */
 int timeout;
 int unicasting;
 int s;
@@ -122,18 +140,6 @@ static uid_t euid;
 #define MS_TDIFF(tv1,tv2) ( ((tv1).tv_sec-(tv2).tv_sec)*1000 + \
 			   ((tv1).tv_usec-(tv2).tv_usec)/1000 )
 
-#define OFFSET_OF(name,ele)	((size_t)&((name *)0)->ele)
-
-static socklen_t sll_len(size_t halen)
-{
-	socklen_t len = OFFSET_OF(struct sockaddr_ll, sll_addr) + halen;
-	if (len < sizeof(struct sockaddr_ll))
-		len = sizeof(struct sockaddr_ll);
-	return len;
-}
-
-#define SLL_LEN(hln)		sll_len(hln)
-
 #if 1 /* hb_mode: always print hb_mode usage in this binary */
 static char print_usage[]={
 "send_arp: sends out custom ARP packet.\n"
@@ -141,7 +147,8 @@ static char print_usage[]={
 "              device src_ip_addr src_hw_addr broadcast_ip_addr netmask\n"
 "\n"
 "  where:\n"
-"    repeatinterval-ms: ignored\n"
+"    repeatinterval-ms: milliseconds between two rounds of ARP packets\n"
+"                       (default 1000).\n"
 "\n"
 "    repeatcount: how many ARP packets to send.\n"
 "\n"
@@ -149,7 +156,9 @@ static char print_usage[]={
 "\n"
 "    device: network interface to use\n"
 "\n"
-"    src_ip_addr: source ip address\n"
+"    src_ip_addr: source ip address, or a comma separated list of them\n"
+"                 on the same device. Each round carries one ARP packet\n"
+"                 for every one of them.\n"
 "\n"
 "    src_hw_addr: only \"auto\" is supported.\n"
 "                 If other specified, it will exit without sending any ARP packets.\n"
@@ -158,6 +167,16 @@ static char print_usage[]={
 "\n"
 "    netmask: ignored\n"
 "\n"
+"  -v: report how the device was found and the startup time.\n"
+"\n"
+"  send_arp -D [-q] [-c count] [-w timeout] -I device ip[,ip...] [ip...]\n"
+"  checks all the addresses at once for duplicates, and prints\n"
+"  \"<ip> in use by <hwaddr>\" for each one taken. With -c 1, within a\n"
+"  second. Exits with 1 if any is taken.\n"
+"\n"
+"  When announced runs, the ARP packets are left to it and send_arp\n"
+"  returns once the first round is out.\n"
+"\n"
 "  Notes: Other options of iputils-arping may be accepted but it's not\n"
 "         intended to be supported in this binary.\n"
 "\n"
@@ -325,52 +344,111 @@ static void drop_capabilities(void)
 #endif
 }
 
-static int send_pack(int s, struct in_addr src, struct in_addr dst,
-	      struct sockaddr_ll *ME, struct sockaddr_ll *HE)
+/*
+ * The frames of a round are built once, and again only when the
+ * destination changes (a reply switches to unicast), then sent with
+ * one sendmmsg() by arp_tx. A TX ring (PACKET_TX_RING) would save a
+ * copy per frame, but costs more to set up than a few hundred frames
+ * take.
+ */
+struct round {
+	struct arp_tx tx;
+	int stale;
+	/* statistics, in us */
+	int rounds;
+	long long first, sum, min, max, late;
+};
+struct round burst = { .stale = 1 };
+
+static long long now_us(void)
 {
-	int err;
-	struct timeval now;
-	unsigned char buf[256];
-	struct arphdr *ah = (struct arphdr*)buf;
-	unsigned char *p = (unsigned char *)(ah+1);
+	struct timespec ts;
 
-	ah->ar_hrd = htons(ME->sll_hatype);
-	if (ah->ar_hrd == htons(ARPHRD_FDDI))
-		ah->ar_hrd = htons(ARPHRD_ETHER);
-	ah->ar_pro = htons(ETH_P_IP);
-	ah->ar_hln = ME->sll_halen;
-	ah->ar_pln = 4;
-	ah->ar_op  = advert ? htons(ARPOP_REPLY) : htons(ARPOP_REQUEST);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
-	memcpy(p, &ME->sll_addr, ah->ar_hln);
-	p+=ME->sll_halen;
+static void build_pack(struct in_addr src, struct in_addr dst,
+		       struct sockaddr_ll *ME, struct sockaddr_ll *HE)
+{
+	int hrd = ME->sll_hatype;
+
+	if (hrd == ARPHRD_FDDI)
+		hrd = ARPHRD_ETHER;
+	if (arp_tx_add(&burst.tx, advert ? ARPOP_REPLY : ARPOP_REQUEST,
+		       hrd, ME->sll_halen, ME->sll_addr, src,
+		       advert ? ME->sll_addr : HE->sll_addr, dst) < 0) {
+		fprintf(stderr, "arping: cannot build frame\n");
+		exit(2);
+	}
+}
 
-	memcpy(p, &src, 4);
-	p+=4;
+static void build_round(void)
+{
+	struct sockaddr_ll *ME = (struct sockaddr_ll *)&me;
+	struct sockaddr_ll *HE = (struct sockaddr_ll *)&he;
+	int i;
 
-	if (advert)
-		memcpy(p, &ME->sll_addr, ah->ar_hln);
+	if (!burst.tx.max &&
+	    arp_tx_init(&burst.tx, ntargets > 1 ? ntargets : 1) < 0) {
+		perror("malloc");
+		exit(2);
+	}
+	arp_tx_clear(&burst.tx);
+	if (ntargets > 1)
+		for (i = 0; i < ntargets; i++)
+			build_pack(dad ? src : targets[i], targets[i], ME, HE);
 	else
-		memcpy(p, &HE->sll_addr, ah->ar_hln);
-	p+=ah->ar_hln;
+		build_pack(src, dst, ME, HE);
+	arp_tx_dest(&burst.tx, HE);
+	burst.stale = 0;
+}
 
-	memcpy(p, &dst, 4);
-	p+=4;
+static void send_round(int s)
+{
+	struct timeval now;
+	long long t0, t1;
+	int rc;
+
+	if (burst.stale)
+		build_round();
 
 	gettimeofday(&now, NULL);
-	err = sendto(s, buf, p-buf, 0, (struct sockaddr*)HE, SLL_LEN(ah->ar_hln));
-	if (err == p-buf) {
+	t0 = now_us();
+	rc = arp_tx_send(&burst.tx, s, 0, burst.tx.n);
+	if (rc < burst.tx.n && !quiet)
+		perror("arping: sendmmsg");
+	t1 = now_us();
+	sent += rc;
+	if (!unicasting)
+		brd_sent += rc;
+	if (rc)
 		last = now;
-		sent++;
-		if (!unicasting)
-			brd_sent++;
+
+	if (!burst.rounds++) {
+		burst.first = t0;
+		burst.min = t1 - t0;
 	}
-	return err;
+	if (t1 - t0 < burst.min)
+		burst.min = t1 - t0;
+	if (t1 - t0 > burst.max)
+		burst.max = t1 - t0;
+	burst.sum += t1 - t0;
+	/* how far behind the schedule it started */
+	t0 -= burst.first + (burst.rounds - 1) * interval * 1000LL;
+	if (t0 > burst.late)
+		burst.late = t0;
 }
 
 static void finish(void)
 {
+	int i, taken = 0;
+
+	for (i = 0; conflicts && i < ntargets; i++)
+		taken += conflicts[i] > 0;
 	if (!quiet) {
+		if (conflicts)
+			printf("%d of %d address(es) in use\n", taken, ntargets);
 		printf("Sent %d probes (%d broadcast(s))\n", sent, brd_sent);
 		printf("Received %d response(s)", received);
 		if (brd_recv || req_recv) {
@@ -384,6 +462,11 @@ static void finish(void)
 			printf(")");
 		}
 		printf("\n");
+		if (burst.rounds)
+			printf("%d round(s) of %d, send min/avg/max %lld/%lld/%lld us,"
+			       " at most %lld us late\n", burst.rounds, burst.tx.n,
+			       burst.min, burst.sum / burst.rounds, burst.max,
+			       burst.late);
 		fflush(stdout);
 	}
 	fflush(stdout);
@@ -411,15 +494,170 @@ static void catcher(void)
 		finish();
 
 	timersub(&tv, &last, &tv_s);
-	tv_o.tv_sec = 0;
+	tv_o.tv_sec = interval / 2000;
+	tv_o.tv_usec = interval / 2 % 1000 * 1000;
 
 	if (last.tv_sec==0 || timercmp(&tv_s, &tv_o, >)) {
-		send_pack(s, src, dst,
-			  (struct sockaddr_ll *)&me, (struct sockaddr_ll *)&he);
+		send_round(s);
 		if (count == 0 && unsolicited)
 			finish();
 	}
-	alarm(1);
+}
+
+/* SIGINT: finish() from the main loop, not in the middle of recv_pack() */
+static volatile sig_atomic_t interrupted;
+
+static void interrupt(void)
+{
+	interrupted = 1;
+}
+
+/*
+ * catcher() used to be run by SIGALRM, re-armed with alarm(1) each
+ * time, so nothing could go faster than a round per second. The rounds
+ * are paced by a timerfd now, every "interval" ms from the first one,
+ * polled together with the packet socket.
+ */
+static int start_timer(void)
+{
+	struct itimerspec its;
+	int tfd;
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tfd < 0) {
+		perror("arping: timerfd_create");
+		exit(2);
+	}
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = interval % 1000 * 1000000L;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		perror("arping: timerfd_settime");
+		exit(2);
+	}
+	return tfd;
+}
+
+/*
+ * hb_mode: leave the gratuitous ARPs to announced (see announce.h),
+ * if it runs. Returns 0 if it took them.
+ */
+static int delegate(void)
+{
+	struct sockaddr_un sun;
+	char req[ANNOUNCE_MSG_MAX];
+	char reply[256];
+	int fd, len, n, i;
+
+	if (count <= 0)
+		return -1;
+	len = snprintf(req, sizeof(req), "announce %s %d %d",
+		       device.name, count, interval);
+	for (i = 0; i < ntargets && len < sizeof(req) - 16; i++)
+		len += sprintf(req + len, " %s", inet_ntoa(targets[i]));
+	if (i < ntargets)
+		return -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", ANNOUNCE_SOCKET);
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+	    send(fd, req, len, MSG_NOSIGNAL) < 0 ||
+	    (n = recv(fd, reply, sizeof(reply) - 1, 0)) <= 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	reply[n] = 0;
+	if (strncmp(reply, "ok", 2)) {
+		if (verbose)
+			fprintf(stderr, "send_arp: announced: %s\n", reply);
+		return -1;
+	}
+	if (verbose)
+		fprintf(stderr, "send_arp: left to announced\n");
+	return 0;
+}
+
+/* "ip[,ip...]"..., the hb_mode src_ip_addr or the addresses for -D */
+static void parse_targets(int argc, char **argv)
+{
+	char *p;
+	size_t n = argc;
+	int i;
+
+	for (i = 0; i < argc; i++)
+		for (p = argv[i]; *p; p++)
+			if (*p == ',')
+				n++;
+	targets = calloc(n, sizeof(*targets));
+	if (!targets) {
+		perror("malloc");
+		exit(2);
+	}
+	for (i = 0; i < argc; i++) {
+		for (p = strtok(argv[i], ","); p; p = strtok(NULL, ",")) {
+			if (inet_aton(p, &targets[ntargets]) != 1) {
+				fprintf(stderr, "send_arp: invalid address %s\n", p);
+				exit(2);
+			}
+			ntargets++;
+		}
+	}
+	if (!ntargets)
+		usage();
+}
+
+/*
+ * -D with several addresses: an open addressing table from the
+ * address to its index in targets, for recv_pack() to tell which one
+ * a reply is about.
+ */
+static int *target_hash;
+static unsigned int target_mask;
+
+static unsigned int target_slot(in_addr_t a)
+{
+	/* Fibonacci hashing, the low bits of addresses are close */
+	return ((uint32_t)a * 2654435769U >> 8) & target_mask;
+}
+
+static void hash_targets(void)
+{
+	unsigned int size = 4;
+	int i;
+
+	while (size < 2 * ntargets)
+		size *= 2;
+	target_mask = size - 1;
+	target_hash = malloc(size * sizeof(*target_hash));
+	conflicts = calloc(ntargets, sizeof(*conflicts));
+	if (!target_hash || !conflicts) {
+		perror("malloc");
+		exit(2);
+	}
+	memset(target_hash, -1, size * sizeof(*target_hash));
+	for (i = 0; i < ntargets; i++) {
+		unsigned int h = target_slot(targets[i].s_addr);
+
+		while (target_hash[h] >= 0 &&
+		       targets[target_hash[h]].s_addr != targets[i].s_addr)
+			h = (h + 1) & target_mask;
+		target_hash[h] = i;
+	}
+}
+
+static int target_index(struct in_addr a)
+{
+	unsigned int h = target_slot(a.s_addr);
+
+	for (; target_hash[h] >= 0; h = (h + 1) & target_mask)
+		if (targets[target_hash[h]].s_addr == a.s_addr)
+			return target_hash[h];
+	return -1;
 }
 
 static void print_hex(unsigned char *p, int len)
@@ -468,6 +706,30 @@ static int recv_pack(unsigned char *buf, int len, struct sockaddr_ll *FROM)
 		return 0;
 	memcpy(&src_ip, p+ah->ar_hln, 4);
 	memcpy(&dst_ip, p+ah->ar_hln+4+ah->ar_hln, 4);
+	if (dad && conflicts) {
+		/* as below, for whichever of the addresses it is */
+		int i = target_index(src_ip);
+
+		if (i < 0)
+			return 0;
+		if (memcmp(p, ((struct sockaddr_ll *)&me)->sll_addr, ((struct sockaddr_ll *)&me)->sll_halen) == 0)
+			return 0;
+		if (src.s_addr && src.s_addr != dst_ip.s_addr)
+			return 0;
+		if (!conflicts[i]++) {
+			printf("%s in use by ", inet_ntoa(src_ip));
+			print_hex(p, ah->ar_hln);
+			printf("\n");
+			fflush(stdout);
+		}
+		received++;
+		for (i = 0; i < ntargets && conflicts[i]; i++)
+			;
+		/* nothing left to find out */
+		if (i == ntargets)
+			finish();
+		return 1;
+	}
 	if (!dad) {
 		if (src_ip.s_addr != dst.s_addr)
 			return 0;
@@ -535,6 +797,7 @@ static int recv_pack(unsigned char *buf, int len, struct sockaddr_ll *FROM)
 	if(!broadcast_only) {
 		memcpy(((struct sockaddr_ll *)&he)->sll_addr, p, ((struct sockaddr_ll *)&me)->sll_halen);
 		unicasting=1;
+		burst.stale = 1;
 	}
 	return 1;
 }
@@ -657,6 +920,84 @@ static int check_ifflags(unsigned int ifflags, int fatal)
 	return 0;
 }
 
+struct link_query {
+	int ifindex;
+	int halen;	/* -1 until the answer is in */
+};
+
+static void link_cb(const struct nlmsghdr *h, void *arg)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(h);
+	const struct rtattr *rta;
+	struct link_query *q = arg;
+	int attrlen;
+
+	if (h->nlmsg_type != RTM_NEWLINK ||
+	    h->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)) ||
+	    ifi->ifi_index != q->ifindex)
+		return;
+	check_ifflags(ifi->ifi_flags, 1);
+	q->halen = 0;
+
+	attrlen = IFLA_PAYLOAD(h);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen);
+	     rta = RTA_NEXT(rta, attrlen)) {
+		if (rta->rta_type == IFLA_ADDRESS) {
+			q->halen = RTA_PAYLOAD(rta);
+		} else if (rta->rta_type == IFLA_BROADCAST &&
+			   RTA_PAYLOAD(rta) <= sizeof(device.brd)) {
+			device.brd_len = RTA_PAYLOAD(rta);
+			memcpy(device.brd, RTA_DATA(rta), device.brd_len);
+		}
+	}
+}
+
+/*
+ * by_netlink(): the named device only, with if_nametoindex() and one
+ * RTM_GETLINK for that ifindex, which has the flags and the hardware
+ * and broadcast addresses. getifaddrs() rather dumps every address of
+ * every interface, which is slow with thousands of them.
+ */
+static int find_device_by_netlink(void)
+{
+	struct {
+		struct nlmsghdr h;
+		struct ifinfomsg ifi;
+	} req;
+	struct link_query q;
+	int fd, rc;
+
+	if (!device.name)
+		return -1;
+	q.ifindex = if_nametoindex(device.name);
+	if (!q.ifindex)
+		return -1;
+	q.halen = -1;
+
+	fd = nl_open(NETLINK_ROUTE, NULL, 0);
+	if (fd < 0)
+		return -1;
+	memset(&req, 0, sizeof(req));
+	req.h.nlmsg_len = sizeof(req);
+	req.h.nlmsg_type = RTM_GETLINK;
+	req.h.nlmsg_flags = NLM_F_REQUEST;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = q.ifindex;
+	device.brd_len = 0;
+	rc = nl_talk(fd, &req.h, link_cb, &q);
+	close(fd);
+	if (rc != 0 || q.halen < 0)
+		return -1;
+
+	if (!q.halen || !device.brd_len) {
+		/* same as the others: not for ARP */
+		device.brd_len = 0;
+		return 1;
+	}
+	device.ifindex = q.ifindex;
+	return 0;
+}
+
 static int find_device_by_ifaddrs(void)
 {
 #ifndef WITHOUT_IFADDRS
@@ -978,6 +1319,13 @@ out:
 static int find_device(void)
 {
 	int rc;
+	rc = find_device_by_netlink();
+	if (rc == 0) {
+		if (verbose)
+			fprintf(stderr, "send_arp: %s found by netlink\n",
+				device.name);
+		goto out;
+	}
 	rc = find_device_by_ifaddrs();
 	if (rc >= 0)
 		goto out;
@@ -1024,6 +1372,14 @@ static int set_device_broadcast_ifaddrs_one(struct device *device, unsigned char
 	return -1;
 #endif
 }
+static int set_device_broadcast_netlink(struct device *device, unsigned char *ba, size_t balen)
+{
+	if (!device || device->brd_len != balen)
+		return -1;
+	memcpy(ba, device->brd, balen);
+	return 0;
+}
+
 static int set_device_broadcast_sysfs(struct device *device, unsigned char *ba, size_t balen)
 {
 #ifdef USE_SYSFS
@@ -1052,6 +1408,8 @@ static int set_device_broadcast_fallback(struct device *device, unsigned char *b
 
 static void set_device_broadcast(struct device *dev, unsigned char *ba, size_t balen)
 {
+	if (!set_device_broadcast_netlink(dev, ba, balen))
+		return;
 	if (!set_device_broadcast_ifaddrs_one(dev, ba, balen, 0))
 		return;
 	if (!set_device_broadcast_sysfs(dev, ba, balen))
@@ -1065,6 +1423,10 @@ main(int argc, char **argv)
 	int socket_errno;
 	int ch;
 	int hb_mode = 0;
+	struct pollfd pfd[2];
+	struct timeval t_start, t_dev, t_now;
+
+	gettimeofday(&t_start, NULL);
 
 	signal(SIGTERM, byebye);
 	signal(SIGPIPE, byebye);
@@ -1082,7 +1444,7 @@ main(int argc, char **argv)
 
 	disable_capability_raw();
 
-	while ((ch = getopt(argc, argv, "h?bfDUAqc:w:s:I:Vr:i:p:")) != EOF) {
+	while ((ch = getopt(argc, argv, "h?bfDUAqvc:w:s:I:Vr:i:p:")) != EOF) {
 		switch(ch) {
 		case 'b':
 			broadcast_only=1;
@@ -1101,6 +1463,9 @@ main(int argc, char **argv)
 		case 'q':
 			quiet++;
 			break;
+		case 'v':
+			verbose++;
+			break;
 		case 'r': /* send_arp.libnet compatibility option */
 			hb_mode = 1;
 			/* fall-through */
@@ -1122,10 +1487,17 @@ main(int argc, char **argv)
 		case 'V':
 			printf("send_arp utility, based on arping from iputils-%s\n", SNAPSHOT);
 			exit(0);
-		case 'p':
 		case 'i':
 		    hb_mode = 1;
-		    /* send_arp.libnet compatibility options, ignore */
+		    interval = atoi(optarg);
+		    if (interval <= 0) {
+			fprintf(stderr, "send_arp: invalid interval %s\n", optarg);
+			exit(2);
+		    }
+		    break;
+		case 'p':
+		    hb_mode = 1;
+		    /* send_arp.libnet compatibility option, ignore */
 		    break;
 		case 'h':
 		case '?':
@@ -1150,20 +1522,44 @@ main(int argc, char **argv)
 
 	    unsolicited = 1;
 	    device.name = argv[optind];
-	    target = argv[optind+1];
+	    parse_targets(1, &argv[optind+1]);
+	    /* inet_ntoa() reuses its buffer, delegate() calls it again */
+	    target = strdup(inet_ntoa(targets[0]));
+	    if (!target) {
+		perror("strdup");
+		exit(2);
+	    }
             if (strcmp(argv[optind+2], "auto")) {
 		fprintf(stderr, "send_arp.linux: Gratuitous ARPs are not sent in the Cluster IP configuration\n");
                 /* return success to suppress an error log by the RA */
 		exit(0);
             }
+	    if (delegate() == 0)
+		exit(0);
 
 	} else {
 	    argc -= optind;
 	    argv += optind;
-	    if (argc != 1)
+	    if (argc < 1)
 		usage();
 
-	    target = *argv;
+	    if (argc == 1 && !strchr(*argv, ','))
+		target = *argv;
+	    else if (dad || unsolicited) {
+		/* several at once */
+		parse_targets(argc, argv);
+		target = strdup(inet_ntoa(targets[0]));
+		if (!target) {
+		    perror("strdup");
+		    exit(2);
+		}
+		if (dad) {
+		    hash_targets();
+		    quit_on_reply = 0;
+		    broadcast_only = 1;
+		}
+	    } else
+		usage();
 	}
 	
 	if (device.name && !*device.name)
@@ -1175,8 +1571,15 @@ main(int argc, char **argv)
 		exit(2);
 	}
 
+	gettimeofday(&t_dev, NULL);
 	if (find_device() < 0)
 		exit(2);
+	if (verbose) {
+		gettimeofday(&t_now, NULL);
+		timersub(&t_now, &t_dev, &t_dev);
+		fprintf(stderr, "send_arp: device lookup %ld us\n",
+			t_dev.tv_sec * 1000000L + t_dev.tv_usec);
+	}
 
 	if (!device.ifindex) {
 		if (device.name) {
@@ -1222,6 +1625,26 @@ main(int argc, char **argv)
 	if (!dad && unsolicited && src.s_addr == 0)
 		src = dst;
 
+	/* the first source goes last, and stays */
+	for (ch = dad ? 0 : ntargets - 1; ch > 0; ch--) {
+		struct sockaddr_in saddr;
+		int probe_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+		if (probe_fd < 0) {
+			perror("socket");
+			exit(2);
+		}
+		memset(&saddr, 0, sizeof(saddr));
+		saddr.sin_family = AF_INET;
+		saddr.sin_addr = targets[ch];
+		if (bind(probe_fd, (struct sockaddr*)&saddr, sizeof(saddr)) == -1) {
+			fprintf(stderr, "arping: %s: ", inet_ntoa(targets[ch]));
+			perror("bind");
+			exit(2);
+		}
+		close(probe_fd);
+	}
+
 	if (!dad || src.s_addr) {
 		struct sockaddr_in saddr;
 		int probe_fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -1296,7 +1719,10 @@ main(int argc, char **argv)
 
 	if (!quiet) {
 		printf("ARPING %s ", inet_ntoa(dst));
-		printf("from %s %s\n",  inet_ntoa(src), device.name ? : "");
+		printf("from %s %s", inet_ntoa(src), device.name ? : "");
+		if (ntargets > 1)
+			printf(" and %d more", ntargets - 1);
+		printf("\n");
 	}
 
 	if (!src.s_addr && !dad) {
@@ -1306,30 +1732,49 @@ main(int argc, char **argv)
 
 	drop_capabilities();
 
-	set_signal(SIGINT, finish);
-	set_signal(SIGALRM, catcher);
+	set_signal(SIGINT, interrupt);
+
+	if (verbose) {
+		gettimeofday(&t_now, NULL);
+		timersub(&t_now, &t_start, &t_now);
+		fprintf(stderr, "send_arp: startup %ld us\n",
+			t_now.tv_sec * 1000000L + t_now.tv_usec);
+	}
+
+	pfd[0].fd = s;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = start_timer();
+	pfd[1].events = POLLIN;
 
 	catcher();
 
 	while(1) {
-		sigset_t sset, osset;
 		unsigned char packet[4096];
 		struct sockaddr_storage from;
 		socklen_t alen = sizeof(from);
+		uint64_t expired;
 		int cc;
 
-		if ((cc = recvfrom(s, packet, sizeof(packet), 0,
-				   (struct sockaddr *)&from, &alen)) < 0) {
-			perror("arping: recvfrom");
+		if (interrupted)
+			finish();
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno != EINTR)
+				perror("arping: poll");
 			continue;
 		}
 
-		sigemptyset(&sset);
-		sigaddset(&sset, SIGALRM);
-		sigaddset(&sset, SIGINT);
-		sigprocmask(SIG_BLOCK, &sset, &osset);
-		recv_pack(packet, cc, (struct sockaddr_ll *)&from);
-		sigprocmask(SIG_SETMASK, &osset, NULL);
+		/* late rounds are not caught up with */
+		if ((pfd[1].revents & POLLIN) &&
+		    read(pfd[1].fd, &expired, sizeof(expired)) == sizeof(expired))
+			catcher();
+		if (pfd[0].revents & POLLIN) {
+			cc = recvfrom(s, packet, sizeof(packet), MSG_DONTWAIT,
+				      (struct sockaddr *)&from, &alen);
+			if (cc < 0)
+				perror("arping: recvfrom");
+			else
+				recv_pack(packet, cc, (struct sockaddr_ll *)&from);
+		}
 	}
 }
 
@@ -0,0 +1,461 @@
+/*
+   Tickle TCP connections tool: connection state list
+
+   Reads the list of established connections either from the historic
+   text format ("ip:port<TAB>ip:port" per line) or from the compact
+   binary format described in tickle_state.h, and writes the latter.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "tickle_state.h"
+
+static int parse_ipv4(const char *s, unsigned port, struct sockaddr_in *sin);
+static int parse_ipv6(const char *s, const char *iface, unsigned port, sock_addr *saddr);
+static int tuple4_cmp(const void *a, const void *b);
+static int tuple6_cmp(const void *a, const void *b);
+static size_t uniq(void *base, size_t n, size_t size);
+static int tickle_list_map(struct tickle_list *l, int fd, size_t len);
+
+static int parse_ipv4(const char *s, unsigned port, struct sockaddr_in *sin)
+{
+	sin->sin_family = AF_INET;
+	sin->sin_port   = htons(port);
+
+	if (inet_pton(AF_INET, s, &sin->sin_addr) != 1) {
+		fprintf(stderr, "Failed to translate %s into sin_addr\n", s);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int parse_ipv6(const char *s, const char *iface, unsigned port, sock_addr *saddr)
+{
+	saddr->ip6.sin6_family   = AF_INET6;
+	saddr->ip6.sin6_port     = htons(port);
+	saddr->ip6.sin6_flowinfo = 0;
+	saddr->ip6.sin6_scope_id = 0;
+
+	if (inet_pton(AF_INET6, s, &saddr->ip6.sin6_addr) != 1) {
+		fprintf(stderr, "Failed to translate %s into sin6_addr\n", s);
+		return -1;
+	}
+
+	if (iface && IN6_IS_ADDR_LINKLOCAL(&saddr->ip6.sin6_addr)) {
+		saddr->ip6.sin6_scope_id = if_nametoindex(iface);
+	}
+
+        return 0;
+}
+
+int parse_ip(const char *addr, const char *iface, unsigned port, sock_addr *saddr)
+{
+	char *p;
+	int ret;
+
+	p = index(addr, ':');
+	if (!p)
+		ret = parse_ipv4(addr, port, &saddr->ip);
+	else
+		ret = parse_ipv6(addr, iface, port, saddr);
+
+	return ret;
+}
+
+int parse_ip_port(const char *addr, sock_addr *saddr)
+{
+	char *s, *p;
+	unsigned port;
+	char *endp = NULL;
+	int ret;
+
+	s = strdup(addr);
+	if (!s) {
+		fprintf(stderr, "Failed strdup()\n");
+		return -1;
+	}
+
+	p = rindex(s, ':');
+	if (!p) {
+		fprintf(stderr, "This addr: %s does not contain a port number\n", s);
+		free(s);
+		return -1;
+	}
+
+	port = strtoul(p+1, &endp, 10);
+	if (!endp || *endp != 0) {
+		fprintf(stderr, "Trailing garbage after the port in %s\n", s);
+		free(s);
+		return -1;
+	}
+	*p = 0;
+
+	ret = parse_ip(s, NULL, port, saddr);
+	free(s);
+	return ret;
+}
+
+void tickle_list_init(struct tickle_list *l)
+{
+	memset(l, 0, sizeof(*l));
+}
+
+void tickle_list_free(struct tickle_list *l)
+{
+	if (l->map) {
+		munmap(l->map, l->maplen);
+	} else {
+		free(l->v4);
+		free(l->v6);
+	}
+	tickle_list_init(l);
+}
+
+int tickle_list_add(struct tickle_list *l, const sock_addr *src, const sock_addr *dst)
+{
+	void *p;
+
+	if (l->map) {
+		fprintf(stderr, "Cannot add to a mapped state file\n");
+		return -1;
+	}
+	if (src->sa.sa_family != dst->sa.sa_family) {
+		fprintf(stderr, "Address family mismatch in connection tuple\n");
+		return -1;
+	}
+
+	switch (src->sa.sa_family) {
+	case AF_INET:
+		if (l->n4 == l->max4) {
+			size_t max = l->max4 ? l->max4 * 2 : 64;
+			p = realloc(l->v4, max * sizeof(*l->v4));
+			if (!p) {
+				fprintf(stderr, "Failed realloc()\n");
+				return -1;
+			}
+			l->v4 = p;
+			l->max4 = max;
+		}
+		l->v4[l->n4].saddr = src->ip.sin_addr.s_addr;
+		l->v4[l->n4].daddr = dst->ip.sin_addr.s_addr;
+		l->v4[l->n4].sport = src->ip.sin_port;
+		l->v4[l->n4].dport = dst->ip.sin_port;
+		l->n4++;
+		break;
+
+	case AF_INET6:
+		if (l->n6 == l->max6) {
+			size_t max = l->max6 ? l->max6 * 2 : 64;
+			p = realloc(l->v6, max * sizeof(*l->v6));
+			if (!p) {
+				fprintf(stderr, "Failed realloc()\n");
+				return -1;
+			}
+			l->v6 = p;
+			l->max6 = max;
+		}
+		memcpy(l->v6[l->n6].saddr, &src->ip6.sin6_addr, 16);
+		memcpy(l->v6[l->n6].daddr, &dst->ip6.sin6_addr, 16);
+		l->v6[l->n6].sport = src->ip6.sin6_port;
+		l->v6[l->n6].dport = dst->ip6.sin6_port;
+		l->n6++;
+		break;
+
+	default:
+		fprintf(stderr, "Not an ipv4/v6 address\n");
+		return -1;
+	}
+	return 0;
+}
+
+int tickle_list_read_text(struct tickle_list *l, FILE *f)
+{
+	sock_addr src, dst;
+	char addrline[128], addr1[64], addr2[64];
+
+	while (fgets(addrline, sizeof(addrline), f)) {
+		if (sscanf(addrline, "%63s %63s", addr1, addr2) != 2)
+			continue;
+
+		memset(&src, 0, sizeof(src));
+		memset(&dst, 0, sizeof(dst));
+		if (parse_ip_port(addr1, &src)) {
+			fprintf(stderr, "Bad IP:port '%s'\n", addr1);
+			return -1;
+		}
+		if (parse_ip_port(addr2, &dst)) {
+			fprintf(stderr, "Bad IP:port '%s'\n", addr2);
+			return -1;
+		}
+		if (tickle_list_add(l, &src, &dst))
+			return -1;
+	}
+	return 0;
+}
+
+static int tickle_list_map(struct tickle_list *l, int fd, size_t len)
+{
+	const struct tickle_state_hdr *hdr;
+	const struct tickle_section_hdr *sec;
+	const unsigned char *p, *end;
+	uint32_t i, nsections;
+
+	l->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (l->map == MAP_FAILED) {
+		l->map = NULL;
+		fprintf(stderr, "Failed mmap (%s)\n", strerror(errno));
+		return -1;
+	}
+	l->maplen = len;
+
+	p = l->map;
+	end = p + len;
+	hdr = (const struct tickle_state_hdr *)(const void *)p;
+	if (ntohl(hdr->version) != TICKLE_STATE_VERSION) {
+		fprintf(stderr, "Unsupported state file version %u\n",
+			(unsigned)ntohl(hdr->version));
+		goto bad;
+	}
+	nsections = ntohl(hdr->nsections);
+	p += sizeof(*hdr);
+
+	for (i = 0; i < nsections; i++) {
+		uint16_t family, tuple_size;
+		size_t count;
+
+		if ((size_t)(end - p) < sizeof(*sec))
+			goto truncated;
+		sec = (const struct tickle_section_hdr *)(const void *)p;
+		family = ntohs(sec->family);
+		tuple_size = ntohs(sec->tuple_size);
+		count = ntohl(sec->count);
+		p += sizeof(*sec);
+
+		if (tuple_size == 0 || count > (size_t)(end - p) / tuple_size)
+			goto truncated;
+
+		/* The tuples are never written to; the cast only drops
+		 * the const the mapping carries.
+		 */
+		if (family == TICKLE_SECTION_INET
+		&&  tuple_size == sizeof(struct tickle_tuple4)) {
+			l->v4 = (struct tickle_tuple4 *)(uintptr_t)p;
+			l->n4 = count;
+		} else if (family == TICKLE_SECTION_INET6
+		&&  tuple_size == sizeof(struct tickle_tuple6)) {
+			l->v6 = (struct tickle_tuple6 *)(uintptr_t)p;
+			l->n6 = count;
+		}
+		/* else: a section from a newer writer, skip it */
+
+		p += count * tuple_size;
+	}
+	return 0;
+
+truncated:
+	fprintf(stderr, "Truncated or corrupt state file\n");
+bad:
+	tickle_list_free(l);
+	return -1;
+}
+
+/*
+ * Load a state file. A NULL path means stdin. Binary files are
+ * recognised by their magic and mapped; anything else is parsed
+ * as text.
+ */
+int tickle_list_load(struct tickle_list *l, const char *path)
+{
+	struct stat st;
+	char magic[TICKLE_STATE_MAGIC_LEN];
+	FILE *f;
+	int fd, ret;
+
+	fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s (%s)\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+	&&  (size_t)st.st_size >= sizeof(struct tickle_state_hdr)
+	&&  pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+	&&  memcmp(magic, TICKLE_STATE_MAGIC, sizeof(magic)) == 0) {
+		ret = tickle_list_map(l, fd, st.st_size);
+		if (path)
+			close(fd);
+		return ret;
+	}
+
+	if (!path)
+		return tickle_list_read_text(l, stdin);
+
+	f = fdopen(fd, "r");
+	if (!f) {
+		fprintf(stderr, "Failed fdopen (%s)\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	ret = tickle_list_read_text(l, f);
+	fclose(f);
+	return ret;
+}
+
+static int tuple4_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct tickle_tuple4));
+}
+
+static int tuple6_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct tickle_tuple6));
+}
+
+/* squeeze adjacent duplicates out of a sorted array */
+static size_t uniq(void *base, size_t n, size_t size)
+{
+	unsigned char *p = base;
+	size_t i, j;
+
+	if (n == 0)
+		return 0;
+	for (i = 0, j = 1; j < n; j++) {
+		if (memcmp(p + i * size, p + j * size, size) != 0) {
+			i++;
+			if (i != j)
+				memcpy(p + i * size, p + j * size, size);
+		}
+	}
+	return i + 1;
+}
+
+void tickle_list_sort(struct tickle_list *l)
+{
+	if (l->map)
+		return; /* written sorted and unique */
+
+	qsort(l->v4, l->n4, sizeof(*l->v4), tuple4_cmp);
+	l->n4 = uniq(l->v4, l->n4, sizeof(*l->v4));
+	qsort(l->v6, l->n6, sizeof(*l->v6), tuple6_cmp);
+	l->n6 = uniq(l->v6, l->n6, sizeof(*l->v6));
+}
+
+/*
+ * Write the list to path in the binary format. The file is written
+ * under a temporary name, synced and renamed into place, so readers
+ * on this or another node never see a partial file.
+ */
+int tickle_list_write(struct tickle_list *l, const char *path)
+{
+	struct tickle_state_hdr hdr;
+	struct tickle_section_hdr sec;
+	char *tmp;
+	FILE *f;
+	int fd;
+
+	tickle_list_sort(l);
+
+	tmp = malloc(strlen(path) + sizeof(".new"));
+	if (!tmp) {
+		fprintf(stderr, "Failed malloc()\n");
+		return -1;
+	}
+	sprintf(tmp, "%s.new", path);
+
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+		fprintf(stderr, "Failed to open %s (%s)\n", tmp, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		free(tmp);
+		return -1;
+	}
+
+	memcpy(hdr.magic, TICKLE_STATE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htonl(TICKLE_STATE_VERSION);
+	hdr.nsections = htonl((l->n4 ? 1 : 0) + (l->n6 ? 1 : 0));
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	if (l->n4) {
+		sec.family = htons(TICKLE_SECTION_INET);
+		sec.tuple_size = htons(sizeof(*l->v4));
+		sec.count = htonl(l->n4);
+		fwrite(&sec, sizeof(sec), 1, f);
+		fwrite(l->v4, sizeof(*l->v4), l->n4, f);
+	}
+	if (l->n6) {
+		sec.family = htons(TICKLE_SECTION_INET6);
+		sec.tuple_size = htons(sizeof(*l->v6));
+		sec.count = htonl(l->n6);
+		fwrite(&sec, sizeof(sec), 1, f);
+		fwrite(l->v6, sizeof(*l->v6), l->n6, f);
+	}
+
+	if (fflush(f) != 0 || ferror(f) || fsync(fd) != 0) {
+		fprintf(stderr, "Failed to write %s (%s)\n", tmp, strerror(errno));
+		fclose(f);
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	fclose(f);
+
+	if (rename(tmp, path) != 0) {
+		fprintf(stderr, "Failed to rename %s to %s (%s)\n",
+			tmp, path, strerror(errno));
+		unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
+	return 0;
+}
+
+void tickle_tuple4_addrs(const struct tickle_tuple4 *t, sock_addr *src, sock_addr *dst)
+{
+	memset(src, 0, sizeof(*src));
+	memset(dst, 0, sizeof(*dst));
+	src->ip.sin_family = AF_INET;
+	src->ip.sin_addr.s_addr = t->saddr;
+	src->ip.sin_port = t->sport;
+	dst->ip.sin_family = AF_INET;
+	dst->ip.sin_addr.s_addr = t->daddr;
+	dst->ip.sin_port = t->dport;
+}
+
+void tickle_tuple6_addrs(const struct tickle_tuple6 *t, sock_addr *src, sock_addr *dst)
+{
+	memset(src, 0, sizeof(*src));
+	memset(dst, 0, sizeof(*dst));
+	src->ip6.sin6_family = AF_INET6;
+	memcpy(&src->ip6.sin6_addr, t->saddr, 16);
+	src->ip6.sin6_port = t->sport;
+	dst->ip6.sin6_family = AF_INET6;
+	memcpy(&dst->ip6.sin6_addr, t->daddr, 16);
+	dst->ip6.sin6_port = t->dport;
+}
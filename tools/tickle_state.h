@@ -0,0 +1,112 @@
+/*
+   Tickle TCP connections tool: connection state list
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TICKLE_STATE_H
+#define TICKLE_STATE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+typedef union {
+	struct sockaddr     sa;
+	struct sockaddr_in  ip;
+	struct sockaddr_in6 ip6;
+} sock_addr;
+
+/*
+ * Binary state file layout. All integers are in network byte order,
+ * so that a file written on one cluster node can be read on any other.
+ *
+ *	struct tickle_state_hdr
+ *	nsections * {
+ *		struct tickle_section_hdr
+ *		count * tuple_size bytes of tuples, sorted and unique
+ *	}
+ *
+ * A tuple is the "src" (local, VIP side) and "dst" (remote, client side)
+ * address and port of one established connection, in the same order as
+ * the columns of the text format "ip:port<TAB>ip:port".
+ */
+#define TICKLE_STATE_MAGIC	"TICKLE\r\n"
+#define TICKLE_STATE_MAGIC_LEN	8
+#define TICKLE_STATE_VERSION	1
+
+#define TICKLE_SECTION_INET	4
+#define TICKLE_SECTION_INET6	6
+
+struct tickle_state_hdr {
+	char		magic[TICKLE_STATE_MAGIC_LEN];
+	uint32_t	version;
+	uint32_t	nsections;
+};
+
+struct tickle_section_hdr {
+	uint16_t	family;
+	uint16_t	tuple_size;
+	uint32_t	count;
+};
+
+struct tickle_tuple4 {
+	uint32_t	saddr;
+	uint32_t	daddr;
+	uint16_t	sport;
+	uint16_t	dport;
+};
+
+struct tickle_tuple6 {
+	uint8_t		saddr[16];
+	uint8_t		daddr[16];
+	uint16_t	sport;
+	uint16_t	dport;
+};
+
+/*
+ * The tuples either live in malloc()ed arrays (text input, or a list
+ * built up by the caller), or point straight into a mmap()ed binary
+ * state file, in which case the list is read-only.
+ */
+struct tickle_list {
+	struct tickle_tuple4	*v4;
+	size_t			n4;
+	size_t			max4;
+	struct tickle_tuple6	*v6;
+	size_t			n6;
+	size_t			max6;
+	void			*map;
+	size_t			maplen;
+};
+
+int parse_ip(const char *addr, const char *iface, unsigned port, sock_addr *saddr);
+int parse_ip_port(const char *addr, sock_addr *saddr);
+
+void tickle_list_init(struct tickle_list *l);
+void tickle_list_free(struct tickle_list *l);
+int tickle_list_add(struct tickle_list *l, const sock_addr *src, const sock_addr *dst);
+int tickle_list_read_text(struct tickle_list *l, FILE *f);
+int tickle_list_load(struct tickle_list *l, const char *path);
+void tickle_list_sort(struct tickle_list *l);
+int tickle_list_write(struct tickle_list *l, const char *path);
+void tickle_tuple4_addrs(const struct tickle_tuple4 *t, sock_addr *src, sock_addr *dst);
+void tickle_tuple6_addrs(const struct tickle_tuple6 *t, sock_addr *src, sock_addr *dst);
+
+/* tickle_track.c */
+int tickle_track(const char *ip, const char *statefile, int interval,
+		 const char *sync_cmd, const char *pidfile);
+
+#endif /* TICKLE_STATE_H */
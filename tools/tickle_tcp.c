@@ -32,28 +32,58 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <net/if.h>
-
-#define discard_const(ptr) ((void *)((intptr_t)(ptr)))
-
-typedef union {
-	struct sockaddr     sa;
-	struct sockaddr_in  ip;
-	struct sockaddr_in6 ip6;
-} sock_addr;
-
-uint32_t uint16_checksum(uint16_t *data, size_t n);
+#include <ifaddrs.h>
+#include <getopt.h>
+
+#include "tickle_state.h"
+
+#define TRACK_INTERVAL 5
+
+/* packets handed to the kernel with one sendmmsg() */
+#define TICKLE_BATCH 64
+
+struct tickle_pkt4 {
+	struct iphdr ip;
+	struct tcphdr tcp;
+};
+
+struct tickle_pkt6 {
+	struct ip6_hdr ip6;
+	struct tcphdr tcp;
+};
+
+/*
+ * Both raw sockets are opened once, and packets are queued per
+ * family and sent in batches. IPv6 goes out header-included as well
+ * (IPPROTO_RAW), since with -R the source address is not ours.
+ */
+struct tickle_sender {
+	int			s4;
+	int			s6;
+	unsigned		n4;
+	unsigned		n6;
+	struct ifaddrs		*ifa;
+	int			ifa_loaded;
+	uint32_t		csum_base[2];	/* without and with RST */
+	struct tickle_pkt4	pkt4[TICKLE_BATCH];
+	struct sockaddr_in	to4[TICKLE_BATCH];
+	struct tickle_pkt6	pkt6[TICKLE_BATCH];
+	struct sockaddr_in6	to6[TICKLE_BATCH];
+	struct iovec		iov[TICKLE_BATCH];
+	struct mmsghdr		msg[TICKLE_BATCH];
+};
+
+uint32_t uint16_checksum(const uint16_t *data, size_t n);
 void set_nonblocking(int fd);
 void set_close_on_exec(int fd);
-static int parse_ipv4(const char *s, unsigned port, struct sockaddr_in *sin);
-static int parse_ipv6(const char *s, const char *iface, unsigned port, sock_addr *saddr);
-int parse_ip(const char *addr, const char *iface, unsigned port, sock_addr *saddr);
-int parse_ip_port(const char *addr, sock_addr *saddr);
-int send_tickle_ack(const sock_addr *dst, 
-		    const sock_addr *src, 
-		    uint32_t seq, uint32_t ack, int rst);
+static int tickle_sender_init(struct tickle_sender *ts);
+static void tickle_sender_close(struct tickle_sender *ts);
+static int tickle_queue(struct tickle_sender *ts, const sock_addr *dst,
+			const sock_addr *src, uint32_t seq, uint32_t ack, int rst);
+static int tickle_flush(struct tickle_sender *ts);
 static void usage(void);
 
-uint32_t uint16_checksum(uint16_t *data, size_t n)
+uint32_t uint16_checksum(const uint16_t *data, size_t n)
 {
 	uint32_t sum=0;
 	while (n >= 2) {
@@ -62,20 +92,15 @@ uint32_t uint16_checksum(uint16_t *data, size_t n)
 		n -= 2;
 	}                      
 	if (n == 1) {
-		sum += (uint32_t)ntohs(*(uint8_t *)data);
+		sum += (uint32_t)ntohs(*(const uint8_t *)data);
 	}
 	return sum;
 }       
 
-static uint16_t tcp_checksum(uint16_t *data, size_t n, struct iphdr *ip)
+static uint16_t csum_fold(uint32_t sum)
 {
-	uint32_t sum = uint16_checksum(data, n);
 	uint16_t sum2;
-	sum += uint16_checksum((uint16_t *)(void *)&ip->saddr,
-				sizeof(ip->saddr));
-	sum += uint16_checksum((uint16_t *)(void *)&ip->daddr,
-				sizeof(ip->daddr));
-	sum += ip->protocol + n;
+
 	sum = (sum & 0xFFFF) + (sum >> 16);
 	sum = (sum & 0xFFFF) + (sum >> 16);
 	sum2 = htons(sum);
@@ -86,29 +111,41 @@ static uint16_t tcp_checksum(uint16_t *data, size_t n, struct iphdr *ip)
 	return sum2;
 }
 
-static uint16_t tcp_checksum6(uint16_t *data, size_t n, struct ip6_hdr *ip6)
+/* the TCP header fields which are the same for every tickle */
+static void tcp_fixed_fields(struct tcphdr *tcp, int rst)
 {
-	uint32_t phdr[2];
-	uint32_t sum = 0;
-	uint16_t sum2;
+	tcp->ack    = 1;
+	tcp->rst    = rst ? 1 : 0;
+	tcp->doff   = sizeof(*tcp)/4;
+	tcp->window = htons(1234);
+}
 
-	sum += uint16_checksum((uint16_t *)(void *)&ip6->ip6_src, 16);
-	sum += uint16_checksum((uint16_t *)(void *)&ip6->ip6_dst, 16);
+/*
+ * The part of the TCP checksum which is the same for every tickle with
+ * or without RST: protocol, length and the fixed header fields. It is
+ * worked out once per sender; the addresses, ports and sequence numbers
+ * are added per packet.
+ */
+static uint32_t tcp_checksum_base(int rst)
+{
+	struct tcphdr t;
 
-	phdr[0] = htonl(n);
-	phdr[1] = htonl(ip6->ip6_nxt);
-	sum += uint16_checksum((uint16_t *)phdr, 8);
+	memset(&t, 0, sizeof(t));
+	tcp_fixed_fields(&t, rst);
+	return uint16_checksum((const uint16_t *)(const void *)&t, sizeof(t))
+		+ IPPROTO_TCP + sizeof(t);
+}
 
-	sum += uint16_checksum(data, n);
+static uint16_t tcp_checksum(uint32_t base, const struct tcphdr *tcp,
+			     const void *saddr, const void *daddr, size_t alen)
+{
+	uint32_t sum = base;
 
-	sum = (sum & 0xFFFF) + (sum >> 16);
-	sum = (sum & 0xFFFF) + (sum >> 16);
-	sum2 = htons(sum);
-	sum2 = ~sum2;
-	if (sum2 == 0) {
-		return 0xFFFF;
-	}
-	return sum2;
+	sum += uint16_checksum(saddr, alen);
+	sum += uint16_checksum(daddr, alen);
+	sum += ntohs(tcp->source) + ntohs(tcp->dest);
+	sum += uint16_checksum((const uint16_t *)(const void *)&tcp->seq, 8);
+	return csum_fold(sum);
 }
 
 void set_nonblocking(int fd)
@@ -125,221 +162,327 @@ void set_close_on_exec(int fd)
 	fcntl(fd, F_SETFD, v | FD_CLOEXEC);
 }
 
-static int parse_ipv4(const char *s, unsigned port, struct sockaddr_in *sin)
+static int tickle_sender_init(struct tickle_sender *ts)
 {
-	sin->sin_family = AF_INET;
-	sin->sin_port   = htons(port);
+	uint32_t one = 1;
+
+	memset(ts, 0, sizeof(*ts));
+	ts->s4 = ts->s6 = -1;
+	ts->csum_base[0] = tcp_checksum_base(0);
+	ts->csum_base[1] = tcp_checksum_base(1);
 
-	if (inet_pton(AF_INET, s, &sin->sin_addr) != 1) {
-		fprintf(stderr, "Failed to translate %s into sin_addr\n", s);
+	ts->s4 = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
+	if (ts->s4 == -1) {
+		fprintf(stderr, "Failed to open raw socket (%s)\n", strerror(errno));
 		return -1;
 	}
-
-	return 0;
-}
-
-static int parse_ipv6(const char *s, const char *iface, unsigned port, sock_addr *saddr)
-{
-	saddr->ip6.sin6_family   = AF_INET6;
-	saddr->ip6.sin6_port     = htons(port);
-	saddr->ip6.sin6_flowinfo = 0;
-	saddr->ip6.sin6_scope_id = 0;
-
-	if (inet_pton(AF_INET6, s, &saddr->ip6.sin6_addr) != 1) {
-		fprintf(stderr, "Failed to translate %s into sin6_addr\n", s);
+	if (setsockopt(ts->s4, SOL_IP, IP_HDRINCL, &one, sizeof(one)) != 0) {
+		fprintf(stderr, "Failed to setup IP headers (%s)\n", strerror(errno));
+		tickle_sender_close(ts);
 		return -1;
 	}
-
-	if (iface && IN6_IS_ADDR_LINKLOCAL(&saddr->ip6.sin6_addr)) {
-		saddr->ip6.sin6_scope_id = if_nametoindex(iface);
+	set_close_on_exec(ts->s4);
+
+	/* no IPv6 on this host is only an error if there are IPv6 tickles */
+	ts->s6 = socket(AF_INET6, SOCK_RAW, IPPROTO_RAW);
+	if (ts->s6 != -1) {
+#ifdef IPV6_HDRINCL
+		/* implied by IPPROTO_RAW, but say so where we can */
+		setsockopt(ts->s6, IPPROTO_IPV6, IPV6_HDRINCL, &one, sizeof(one));
+#endif
+		set_close_on_exec(ts->s6);
 	}
-
-        return 0;
+	return 0;
 }
 
-int parse_ip(const char *addr, const char *iface, unsigned port, sock_addr *saddr)
+static void tickle_sender_close(struct tickle_sender *ts)
 {
-	char *p;
-	int ret;
-
-	p = index(addr, ':');
-	if (!p)
-		ret = parse_ipv4(addr, port, &saddr->ip);
-	else
-		ret = parse_ipv6(addr, iface, port, saddr);
-
-	return ret;
+	if (ts->s4 != -1)
+		close(ts->s4);
+	if (ts->s6 != -1)
+		close(ts->s6);
+	if (ts->ifa)
+		freeifaddrs(ts->ifa);
+	ts->s4 = ts->s6 = -1;
+	ts->ifa = NULL;
 }
 
-int parse_ip_port(const char *addr, sock_addr *saddr)
+/*
+ * Link-local destinations need a scope to be routed, which the
+ * connection list does not carry: take the interface which has either
+ * end of the connection configured.
+ */
+static uint32_t tickle_scope(struct tickle_sender *ts, const sock_addr *dst,
+			     const sock_addr *src)
 {
-	char *s, *p;
-	unsigned port;
-	char *endp = NULL;
-	int ret;
+	struct ifaddrs *i;
 
-	s = strdup(addr);
-	if (!s) {
-		fprintf(stderr, "Failed strdup()\n");
-		return -1;
-	}
+	if (dst->ip6.sin6_scope_id || !IN6_IS_ADDR_LINKLOCAL(&dst->ip6.sin6_addr))
+		return dst->ip6.sin6_scope_id;
+	if (src->ip6.sin6_scope_id)
+		return src->ip6.sin6_scope_id;
 
-	p = rindex(s, ':');
-	if (!p) {
-		fprintf(stderr, "This addr: %s does not contain a port number\n", s);
-		free(s);
-		return -1;
+	if (!ts->ifa_loaded) {
+		ts->ifa_loaded = 1;
+		if (getifaddrs(&ts->ifa) != 0)
+			ts->ifa = NULL;
 	}
-	
-	port = strtoul(p+1, &endp, 10);
-	if (!endp || *endp != 0) {
-		fprintf(stderr, "Trailing garbage after the port in %s\n", s);
-		free(s);
-		return -1;
+	for (i = ts->ifa; i; i = i->ifa_next) {
+		const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)(void *)i->ifa_addr;
+
+		if (!a || a->sin6_family != AF_INET6)
+			continue;
+		if (IN6_ARE_ADDR_EQUAL(&a->sin6_addr, &src->ip6.sin6_addr)
+		||  IN6_ARE_ADDR_EQUAL(&a->sin6_addr, &dst->ip6.sin6_addr))
+			return a->sin6_scope_id ? a->sin6_scope_id
+						: if_nametoindex(i->ifa_name);
 	}
-	*p = 0;
-
-	ret = parse_ip(s, NULL, port, saddr);
-	free(s);
-	return ret;
+	return 0;
 }
 
-int send_tickle_ack(const sock_addr *dst, 
-		    const sock_addr *src, 
-		    uint32_t seq, uint32_t ack, int rst)
+static int tickle_queue(struct tickle_sender *ts, const sock_addr *dst,
+			const sock_addr *src, uint32_t seq, uint32_t ack, int rst)
 {
-	int s;
-	int ret;
-	uint32_t one = 1;
-	uint16_t tmpport;
-	sock_addr *tmpdest;
-	struct {
-		struct iphdr ip;
-		struct tcphdr tcp;
-	} ip4pkt;
-	struct {
-		struct ip6_hdr ip6;
-		struct tcphdr tcp;
-	} ip6pkt;
+	struct tcphdr *tcp;
+	uint32_t base = ts->csum_base[rst ? 1 : 0];
 
 	switch (src->ip.sin_family) {
 	case AF_INET:
-		memset(&ip4pkt, 0, sizeof(ip4pkt));
-		ip4pkt.ip.version  = 4;
-		ip4pkt.ip.ihl      = sizeof(ip4pkt.ip)/4;
-		ip4pkt.ip.tot_len  = htons(sizeof(ip4pkt));
-		ip4pkt.ip.ttl      = 255;
-		ip4pkt.ip.protocol = IPPROTO_TCP;
-		ip4pkt.ip.saddr    = src->ip.sin_addr.s_addr;
-		ip4pkt.ip.daddr    = dst->ip.sin_addr.s_addr;
-		ip4pkt.ip.check    = 0;
-
-		ip4pkt.tcp.source  = src->ip.sin_port;
-		ip4pkt.tcp.dest    = dst->ip.sin_port;
-		ip4pkt.tcp.seq     = seq;
-		ip4pkt.tcp.ack_seq = ack;
-		ip4pkt.tcp.ack     = 1;
-		if (rst)
-			ip4pkt.tcp.rst = 1;
-		ip4pkt.tcp.doff    = sizeof(ip4pkt.tcp)/4;
-		ip4pkt.tcp.window   = htons(1234);
-		ip4pkt.tcp.check    = tcp_checksum((uint16_t *)&ip4pkt.tcp, sizeof(ip4pkt.tcp), &ip4pkt.ip);
-
-		s = socket(AF_INET, SOCK_RAW, IPPROTO_RAW);
-		if (s == -1) {
-			fprintf(stderr, "Failed to open raw socket (%s)\n", strerror(errno));
+		if (ts->n4 == TICKLE_BATCH && tickle_flush(ts))
 			return -1;
-		}
+		memset(&ts->pkt4[ts->n4], 0, sizeof(ts->pkt4[0]));
+		ts->pkt4[ts->n4].ip.version  = 4;
+		ts->pkt4[ts->n4].ip.ihl      = sizeof(struct iphdr)/4;
+		ts->pkt4[ts->n4].ip.tot_len  = htons(sizeof(struct tickle_pkt4));
+		ts->pkt4[ts->n4].ip.ttl      = 255;
+		ts->pkt4[ts->n4].ip.protocol = IPPROTO_TCP;
+		ts->pkt4[ts->n4].ip.saddr    = src->ip.sin_addr.s_addr;
+		ts->pkt4[ts->n4].ip.daddr    = dst->ip.sin_addr.s_addr;
+		ts->pkt4[ts->n4].ip.check    = 0; /* filled in by the kernel */
+		tcp = &ts->pkt4[ts->n4].tcp;
+		tcp->source  = src->ip.sin_port;
+		tcp->dest    = dst->ip.sin_port;
+		break;
 
-		ret = setsockopt(s, SOL_IP, IP_HDRINCL, &one, sizeof(one));
-		if (ret != 0) {
-			fprintf(stderr, "Failed to setup IP headers (%s)\n", strerror(errno));
-			close(s);
+	case AF_INET6:
+		if (ts->s6 == -1) {
+			fprintf(stderr, "Failed to open sending socket\n");
 			return -1;
 		}
-
-		set_nonblocking(s);
-		set_close_on_exec(s);
-
-		ret = sendto(s, &ip4pkt, sizeof(ip4pkt), 0, 
-			     (const struct sockaddr *)&dst->ip, sizeof(dst->ip));
-		close(s);
-		if (ret != sizeof(ip4pkt)) {
-			fprintf(stderr, "Failed sendto (%s)\n", strerror(errno));
+		if (ts->n6 == TICKLE_BATCH && tickle_flush(ts))
 			return -1;
-		}
+		memset(&ts->pkt6[ts->n6], 0, sizeof(ts->pkt6[0]));
+		ts->pkt6[ts->n6].ip6.ip6_vfc  = 0x60;
+		ts->pkt6[ts->n6].ip6.ip6_plen = htons(sizeof(struct tcphdr));
+		ts->pkt6[ts->n6].ip6.ip6_nxt  = IPPROTO_TCP;
+		ts->pkt6[ts->n6].ip6.ip6_hlim = 64;
+		ts->pkt6[ts->n6].ip6.ip6_src  = src->ip6.sin6_addr;
+		ts->pkt6[ts->n6].ip6.ip6_dst  = dst->ip6.sin6_addr;
+		tcp = &ts->pkt6[ts->n6].tcp;
+		tcp->source  = src->ip6.sin6_port;
+		tcp->dest    = dst->ip6.sin6_port;
 		break;
 
-        case AF_INET6:
-		memset(&ip6pkt, 0, sizeof(ip6pkt));
-		ip6pkt.ip6.ip6_vfc  = 0x60;
-		ip6pkt.ip6.ip6_plen = htons(20);
-		ip6pkt.ip6.ip6_nxt  = IPPROTO_TCP;
-		ip6pkt.ip6.ip6_hlim = 64;
-		ip6pkt.ip6.ip6_src  = src->ip6.sin6_addr;
-		ip6pkt.ip6.ip6_dst  = dst->ip6.sin6_addr;
-
-		ip6pkt.tcp.source   = src->ip6.sin6_port;
-		ip6pkt.tcp.dest     = dst->ip6.sin6_port;
-		ip6pkt.tcp.seq      = seq;
-		ip6pkt.tcp.ack_seq  = ack;
-		ip6pkt.tcp.ack      = 1;
-		if (rst)
-			ip6pkt.tcp.rst      = 1;
-		ip6pkt.tcp.doff     = sizeof(ip6pkt.tcp)/4;
-		ip6pkt.tcp.window   = htons(1234);
-		ip6pkt.tcp.check    = tcp_checksum6((uint16_t *)&ip6pkt.tcp, sizeof(ip6pkt.tcp), &ip6pkt.ip6);
-
-		s = socket(PF_INET6, SOCK_RAW, IPPROTO_RAW);
-		if (s == -1) {
-			fprintf(stderr, "Failed to open sending socket\n");
-			return -1;
-                }
+	default:
+		fprintf(stderr, "Not an ipv4/v6 address\n");
+		return -1;
+	}
 
-		tmpdest = discard_const(dst);
-		tmpport = tmpdest->ip6.sin6_port;
+	tcp->seq     = seq;
+	tcp->ack_seq = ack;
+	tcp_fixed_fields(tcp, rst);
+
+	if (src->ip.sin_family == AF_INET) {
+		tcp->check = tcp_checksum(base, tcp, &src->ip.sin_addr,
+					  &dst->ip.sin_addr, 4);
+		ts->to4[ts->n4] = dst->ip;
+		ts->n4++;
+	} else {
+		tcp->check = tcp_checksum(base, tcp, &src->ip6.sin6_addr,
+					  &dst->ip6.sin6_addr, 16);
+		/* a raw IPv6 socket wants the port to be 0 or its protocol */
+		ts->to6[ts->n6] = dst->ip6;
+		ts->to6[ts->n6].sin6_port = 0;
+		ts->to6[ts->n6].sin6_scope_id = tickle_scope(ts, dst, src);
+		ts->n6++;
+	}
+	return 0;
+}
 
-		tmpdest->ip6.sin6_port = 0;
-		ret = sendto(s, &ip6pkt, sizeof(ip6pkt), 0, (const struct sockaddr *)&dst->ip6, sizeof(dst->ip6));
-		tmpdest->ip6.sin6_port = tmpport;
-		close(s);
+static int tickle_sendmmsg(struct tickle_sender *ts, int s, void *pkts,
+			   size_t pktlen, void *to, socklen_t tolen, unsigned n)
+{
+	unsigned i, sent = 0;
+	int ret;
 
-		if (ret != sizeof(ip6pkt)) {
-			fprintf(stderr, "Failed sendto (%s)\n", strerror(errno));
-			return -1;
+	for (i = 0; i < n; i++) {
+		ts->iov[i].iov_base = (char *)pkts + i * pktlen;
+		ts->iov[i].iov_len  = pktlen;
+		memset(&ts->msg[i], 0, sizeof(ts->msg[i]));
+		ts->msg[i].msg_hdr.msg_name    = (char *)to + i * tolen;
+		ts->msg[i].msg_hdr.msg_namelen = tolen;
+		ts->msg[i].msg_hdr.msg_iov     = &ts->iov[i];
+		ts->msg[i].msg_hdr.msg_iovlen  = 1;
+	}
+
+	while (sent < n) {
+		ret = sendmmsg(s, &ts->msg[sent], n - sent, 0);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			return sent;
 		}
-		break;
+		sent += ret;
+	}
+	return sent;
+}
 
-	default:
-		fprintf(stderr, "Not an ipv4/v6 address\n");
-		return -1;
+static void tickle_error(const sock_addr *src, const sock_addr *dst)
+{
+	char s1[INET6_ADDRSTRLEN], s2[INET6_ADDRSTRLEN];
+
+	if (src->sa.sa_family == AF_INET) {
+		inet_ntop(AF_INET, &src->ip.sin_addr, s1, sizeof(s1));
+		inet_ntop(AF_INET, &dst->ip.sin_addr, s2, sizeof(s2));
+	} else {
+		inet_ntop(AF_INET6, &src->ip6.sin6_addr, s1, sizeof(s1));
+		inet_ntop(AF_INET6, &dst->ip6.sin6_addr, s2, sizeof(s2));
 	}
+	fprintf(stderr, "Error while sending tickle ack from '%s:%u' to '%s:%u'\n",
+		s1, ntohs(src->ip.sin_port), s2, ntohs(dst->ip.sin_port));
+}
 
+static int tickle_flush(struct tickle_sender *ts)
+{
+	sock_addr src, dst;
+	unsigned sent;
+
+	if (ts->n4) {
+		sent = tickle_sendmmsg(ts, ts->s4, ts->pkt4, sizeof(ts->pkt4[0]),
+				       ts->to4, sizeof(ts->to4[0]), ts->n4);
+		if (sent < ts->n4) {
+			fprintf(stderr, "Failed sendto (%s)\n", strerror(errno));
+			memset(&src, 0, sizeof(src));
+			src.ip.sin_family = AF_INET;
+			src.ip.sin_addr.s_addr = ts->pkt4[sent].ip.saddr;
+			src.ip.sin_port = ts->pkt4[sent].tcp.source;
+			dst.ip = ts->to4[sent];
+			dst.ip.sin_port = ts->pkt4[sent].tcp.dest;
+			tickle_error(&src, &dst);
+			ts->n4 = 0;
+			return -1;
+		}
+		ts->n4 = 0;
+	}
+	if (ts->n6) {
+		sent = tickle_sendmmsg(ts, ts->s6, ts->pkt6, sizeof(ts->pkt6[0]),
+				       ts->to6, sizeof(ts->to6[0]), ts->n6);
+		if (sent < ts->n6) {
+			fprintf(stderr, "Failed sendto (%s)\n", strerror(errno));
+			memset(&src, 0, sizeof(src));
+			src.ip6.sin6_family = AF_INET6;
+			src.ip6.sin6_addr = ts->pkt6[sent].ip6.ip6_src;
+			src.ip6.sin6_port = ts->pkt6[sent].tcp.source;
+			dst.ip6 = ts->to6[sent];
+			dst.ip6.sin6_port = ts->pkt6[sent].tcp.dest;
+			tickle_error(&src, &dst);
+			ts->n6 = 0;
+			return -1;
+		}
+		ts->n6 = 0;
+	}
 	return 0;
 }
 
 static void usage(void)
 {
-	printf("Usage: /usr/lib/heartbeat/tickle_tcp [ -n num ]\n");
+	printf("Usage: /usr/lib/heartbeat/tickle_tcp [ -n num ] [ -R ] [ -f file ]\n");
+	printf("       /usr/lib/heartbeat/tickle_tcp -d file [ -f file ]\n");
 	printf("Please note that this program need to read the list of\n");
-	printf("{local_ip:port remote_ip:port} from stdin.\n");
+	printf("{local_ip:port remote_ip:port} from stdin, or from the\n");
+	printf("file given with -f. Either may be a text list or a binary\n");
+	printf("state file as written by -d.\n");
+	printf("  -n, --num num     send num tickle ACKs per connection\n");
+	printf("  -R, --reverse     swap local and remote, to tickle ourselves\n");
+	printf("  -f, --file file   read the connection list from file\n");
+	printf("  -d, --dump file   do not send, write the list to file in the\n");
+	printf("                    binary state format instead\n");
+	printf("       /usr/lib/heartbeat/tickle_tcp -t ip -d file [ -i sec ] [ -s cmd ] [ -p pidfile ]\n");
+	printf("  -t, --track ip    stay in the foreground, track the established\n");
+	printf("                    connections of ip and keep file up to date\n");
+	printf("  -i, --interval s  snapshot interval in seconds (default %d)\n", TRACK_INTERVAL);
+	printf("  -s, --sync cmd    run \"cmd file\" after each snapshot\n");
+	printf("  -p, --pidfile f   write the tracker pid to f\n");
+	printf("  SIGUSR1 writes a snapshot now, SIGTERM writes one and exits.\n");
 	exit(1);
 }
 
-#define OPTION_STRING "n:h"
+static int send_tickles(struct tickle_sender *ts, const sock_addr *src,
+			const sock_addr *dst, int num)
+{
+	int i;
+
+	for (i = 1; i <= num; i++) {
+		if (tickle_queue(ts, dst, src, 0, 0, 0))
+			return -1;
+	}
+	return 0;
+}
+
+#define OPTION_STRING "n:Rf:d:t:i:s:p:h"
+
+static const struct option long_options[] = {
+	{ "num",	required_argument,	NULL, 'n' },
+	{ "reverse",	no_argument,		NULL, 'R' },
+	{ "file",	required_argument,	NULL, 'f' },
+	{ "dump",	required_argument,	NULL, 'd' },
+	{ "track",	required_argument,	NULL, 't' },
+	{ "interval",	required_argument,	NULL, 'i' },
+	{ "sync",	required_argument,	NULL, 's' },
+	{ "pidfile",	required_argument,	NULL, 'p' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ NULL,		0,			NULL, 0 }
+};
 
 int main(int argc, char *argv[])
 {
-	int optchar, i, num = 1, cont = 1;
+	int optchar, num = 1, cont = 1, reverse = 0;
+	const char *infile = NULL, *dumpfile = NULL;
+	const char *track_ip = NULL, *sync_cmd = NULL, *pidfile = NULL;
+	int interval = TRACK_INTERVAL;
+	struct tickle_list list;
+	struct tickle_sender *ts;
 	sock_addr src, dst;
-	char addrline[128], addr1[64], addr2[64];
+	size_t i;
+	int ret = 0;
 
 	while(cont) {
-		optchar = getopt(argc, argv, OPTION_STRING);
+		optchar = getopt_long(argc, argv, OPTION_STRING, long_options, NULL);
 		switch(optchar) {
 		case 'n':
 			num = atoi(optarg);
 			break;
+		case 'R':
+			reverse = 1;
+			break;
+		case 'f':
+			infile = optarg;
+			break;
+		case 'd':
+			dumpfile = optarg;
+			break;
+		case 't':
+			track_ip = optarg;
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 's':
+			sync_cmd = optarg;
+			break;
+		case 'p':
+			pidfile = optarg;
+			break;
 		case 'h':
 			usage();
 			exit(EXIT_SUCCESS);
@@ -354,26 +497,46 @@ int main(int argc, char *argv[])
 		};
 	}
 
-	while(fgets(addrline, sizeof(addrline), stdin)) {
-		sscanf(addrline, "%s %s", addr1, addr2);
-
-		if (parse_ip_port(addr1, &src)) {
-			fprintf(stderr, "Bad IP:port '%s'\n", addr1);
-			return -1;
-		}
-		if (parse_ip_port(addr2, &dst)) {
-			fprintf(stderr, "Bad IP:port '%s'\n", addr2);
-			return -1;
-		}
-	
-		for (i = 1; i <= num; i++) {
-			if (send_tickle_ack(&dst, &src, 0, 0, 0)) {
-				fprintf(stderr, "Error while sending tickle ack from '%s' to '%s'\n",
-					addr1, addr2);
-				return -1;
-			}
+	if (track_ip) {
+		if (!dumpfile || interval <= 0) {
+			fprintf(stderr, "--track needs -d file and a positive interval\n");
+			exit(EXIT_FAILURE);
 		}
+		return tickle_track(track_ip, dumpfile, interval, sync_cmd, pidfile);
+	}
 
+	tickle_list_init(&list);
+	if (tickle_list_load(&list, infile))
+		return -1;
+
+	if (dumpfile) {
+		ret = tickle_list_write(&list, dumpfile);
+		tickle_list_free(&list);
+		return ret;
 	}
-	return 0;
+
+	ts = malloc(sizeof(*ts));
+	if (!ts || tickle_sender_init(ts)) {
+		free(ts);
+		tickle_list_free(&list);
+		return -1;
+	}
+
+	for (i = 0; i < list.n4 && ret == 0; i++) {
+		tickle_tuple4_addrs(&list.v4[i], &src, &dst);
+		ret = reverse ? send_tickles(ts, &dst, &src, num)
+			      : send_tickles(ts, &src, &dst, num);
+	}
+	for (i = 0; i < list.n6 && ret == 0; i++) {
+		tickle_tuple6_addrs(&list.v6[i], &src, &dst);
+		ret = reverse ? send_tickles(ts, &dst, &src, num)
+			      : send_tickles(ts, &src, &dst, num);
+	}
+	if (ret == 0)
+		ret = tickle_flush(ts);
+
+	tickle_sender_close(ts);
+	free(ts);
+	tickle_list_free(&list);
+	return ret;
 }
@@ -0,0 +1,733 @@
+/*
+   Tickle TCP connections tool: live connection tracker
+
+   Keeps the list of established TCP connections of one (virtual) IP
+   address up to date in memory, instead of having the resource agent
+   poll netstat on every monitor:
+
+   - the table is seeded from one sock_diag dump, filtered in the
+     kernel on the VIP, and re-seeded that way on every interval,
+   - in between, conntrack NEW/UPDATE/DESTROY events (where conntrack
+     is in use) add and remove connections as they happen,
+   - sock_diag TCP destroy events remove connections as they close.
+
+   A snapshot in the binary state format is written every interval if
+   the table changed, on SIGUSR1, and on SIGTERM before exiting.
+   SIGHUP forces a re-seed.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+#include <linux/netfilter/nf_conntrack_tcp.h>
+
+#include <nl_util.h>
+#include "tickle_state.h"
+
+#define TRACK_NLBUF	65536
+#define TRACK_RCVBUF	(4 * 1024 * 1024)
+#define TRACK_MINSIZE	1024
+
+#define SLOT_EMPTY	0
+#define SLOT_USED	1
+#define SLOT_DELETED	2
+
+/*
+ * One tracked connection. IPv4 addresses are kept in the first
+ * four bytes of the IPv6 sized address fields.
+ */
+struct track_slot {
+	uint8_t			state;
+	uint8_t			family;
+	struct tickle_tuple6	t;
+};
+
+struct track_table {
+	struct track_slot	*slots;
+	size_t			size;	/* power of two */
+	size_t			used;	/* live entries */
+	size_t			fill;	/* live entries and tombstones */
+};
+
+struct tracker {
+	struct track_table	table;
+	sock_addr		vip;
+	int			dirty;
+	const char		*statefile;
+	const char		*sync_cmd;
+	unsigned char		*buf;
+};
+
+static uint32_t slot_hash(const struct track_slot *k);
+static struct track_slot *table_lookup(struct track_table *tbl, const struct track_slot *k, int for_insert);
+static int table_resize(struct track_table *tbl, size_t size);
+static int table_insert(struct track_table *tbl, const struct track_slot *k);
+static int table_remove(struct track_table *tbl, const struct track_slot *k);
+static int vip_match(const sock_addr *vip, int family, const void *addr);
+static int make_key(const sock_addr *vip, int family,
+		    const void *a, uint16_t aport, const void *b, uint16_t bport,
+		    struct track_slot *k);
+static void parse_attrs(const struct nlattr **tb, int max, const struct nlattr *a, int len);
+static int diag_seed(struct tracker *tr);
+static void diag_event(struct tracker *tr, const struct nlmsghdr *h);
+static void ct_event(struct tracker *tr, const struct nlmsghdr *h);
+static int events_open(int proto, const unsigned *groups, int ngroups);
+static int nl_drain(struct tracker *tr, int fd,
+		    void (*cb)(struct tracker *, const struct nlmsghdr *));
+static int snapshot(struct tracker *tr);
+
+#define NLA_DATA(a)	((const void *)((const char *)(a) + NLA_HDRLEN))
+#define NLA_LEN(a)	((int)(a)->nla_len - NLA_HDRLEN)
+
+static uint32_t slot_hash(const struct track_slot *k)
+{
+	const unsigned char *p = (const unsigned char *)&k->t;
+	uint32_t h = 2166136261U ^ k->family;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(k->t); i++) {
+		h ^= p[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static struct track_slot *table_lookup(struct track_table *tbl, const struct track_slot *k, int for_insert)
+{
+	size_t mask = tbl->size - 1;
+	size_t i = slot_hash(k) & mask;
+	struct track_slot *tomb = NULL;
+	struct track_slot *s;
+
+	for (;;) {
+		s = &tbl->slots[i];
+		if (s->state == SLOT_EMPTY)
+			return for_insert ? (tomb ? tomb : s) : NULL;
+		if (s->state == SLOT_DELETED) {
+			if (!tomb)
+				tomb = s;
+		} else if (s->family == k->family
+		&&  memcmp(&s->t, &k->t, sizeof(s->t)) == 0) {
+			return s;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+static int table_resize(struct track_table *tbl, size_t size)
+{
+	struct track_table n;
+	size_t i;
+
+	n.slots = calloc(size, sizeof(*n.slots));
+	if (!n.slots) {
+		fprintf(stderr, "Failed calloc()\n");
+		return -1;
+	}
+	n.size = size;
+	n.used = n.fill = 0;
+
+	for (i = 0; i < tbl->size; i++) {
+		if (tbl->slots[i].state == SLOT_USED) {
+			*table_lookup(&n, &tbl->slots[i], 1) = tbl->slots[i];
+			n.used++;
+			n.fill++;
+		}
+	}
+	free(tbl->slots);
+	*tbl = n;
+	return 0;
+}
+
+/* returns 1 if the connection was not known yet */
+static int table_insert(struct track_table *tbl, const struct track_slot *k)
+{
+	struct track_slot *s;
+
+	if ((tbl->fill + 1) * 2 > tbl->size) {
+		size_t size = tbl->size;
+		while ((tbl->used + 1) * 4 > size)
+			size *= 2;
+		if (table_resize(tbl, size) < 0)
+			return -1;
+	}
+
+	s = table_lookup(tbl, k, 1);
+	if (s->state == SLOT_USED)
+		return 0;
+	if (s->state == SLOT_EMPTY)
+		tbl->fill++;
+	*s = *k;
+	s->state = SLOT_USED;
+	tbl->used++;
+	return 1;
+}
+
+/* returns 1 if the connection was known */
+static int table_remove(struct track_table *tbl, const struct track_slot *k)
+{
+	struct track_slot *s = table_lookup(tbl, k, 0);
+
+	if (!s)
+		return 0;
+	s->state = SLOT_DELETED;
+	tbl->used--;
+	return 1;
+}
+
+static int vip_match(const sock_addr *vip, int family, const void *addr)
+{
+	if (family != vip->sa.sa_family)
+		return 0;
+	if (family == AF_INET)
+		return memcmp(addr, &vip->ip.sin_addr, 4) == 0;
+	return memcmp(addr, &vip->ip6.sin6_addr, 16) == 0;
+}
+
+/*
+ * Build the table key for a connection between a and b (ports in
+ * network byte order), with the VIP side as "src". IPv4-mapped IPv6
+ * addresses (IPv4 clients of a dual stack listener) are folded into
+ * plain IPv4. Returns -1 if neither end is the VIP.
+ */
+static int make_key(const sock_addr *vip, int family,
+		    const void *a, uint16_t aport, const void *b, uint16_t bport,
+		    struct track_slot *k)
+{
+	size_t alen = 16;
+
+	if (family == AF_INET6
+	&&  IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)a)
+	&&  IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)b)) {
+		family = AF_INET;
+		a = (const unsigned char *)a + 12;
+		b = (const unsigned char *)b + 12;
+	}
+	if (family == AF_INET)
+		alen = 4;
+
+	memset(k, 0, sizeof(*k));
+	k->family = family;
+	if (vip_match(vip, family, a)) {
+		memcpy(k->t.saddr, a, alen);
+		memcpy(k->t.daddr, b, alen);
+		k->t.sport = aport;
+		k->t.dport = bport;
+	} else if (vip_match(vip, family, b)) {
+		memcpy(k->t.saddr, b, alen);
+		memcpy(k->t.daddr, a, alen);
+		k->t.sport = bport;
+		k->t.dport = aport;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static void parse_attrs(const struct nlattr **tb, int max, const struct nlattr *a, int len)
+{
+	memset(tb, 0, sizeof(*tb) * (max + 1));
+	while (len >= (int)sizeof(*a) && a->nla_len >= sizeof(*a)
+	&&     a->nla_len <= len) {
+		int type = a->nla_type & NLA_TYPE_MASK;
+
+		if (type <= max)
+			tb[type] = a;
+		len -= NLA_ALIGN(a->nla_len);
+		a = (const struct nlattr *)((const char *)a + NLA_ALIGN(a->nla_len));
+	}
+}
+
+/* an event socket, with room for the bursts of a failover */
+static int events_open(int proto, const unsigned *groups, int ngroups)
+{
+	int fd, rcvbuf = TRACK_RCVBUF;
+
+	fd = nl_open(proto, groups, ngroups);
+	if (fd < 0)
+		return -1;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	return fd;
+}
+
+/*
+ * Read everything that is queued on an event socket. Returns -1 if
+ * events were lost (ENOBUFS), so that the caller re-seeds.
+ */
+static int nl_drain(struct tracker *tr, int fd,
+		    void (*cb)(struct tracker *, const struct nlmsghdr *))
+{
+	const struct nlmsghdr *h;
+	ssize_t len;
+	int lost = 0;
+
+	for (;;) {
+		len = recv(fd, tr->buf, TRACK_NLBUF, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				lost = 1;
+				continue;
+			}
+			break;
+		}
+		for (h = (const struct nlmsghdr *)(const void *)tr->buf;
+		     NLMSG_OK(h, (size_t)len); h = NLMSG_NEXT(h, len)) {
+			cb(tr, h);
+		}
+	}
+	return lost ? -1 : 0;
+}
+
+static void diag_add(struct tracker *tr, const struct inet_diag_msg *m)
+{
+	struct track_slot k;
+
+	if (make_key(&tr->vip, m->idiag_family,
+		     m->id.idiag_src, m->id.idiag_sport,
+		     m->id.idiag_dst, m->id.idiag_dport, &k) == 0) {
+		table_insert(&tr->table, &k);
+	}
+}
+
+/* sock_diag TCP destroy notification */
+static void diag_event(struct tracker *tr, const struct nlmsghdr *h)
+{
+	const struct inet_diag_msg *m;
+	struct track_slot k;
+
+	if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY
+	||  h->nlmsg_len < NLMSG_LENGTH(sizeof(*m)))
+		return;
+	m = NLMSG_DATA(h);
+	if (make_key(&tr->vip, m->idiag_family,
+		     m->id.idiag_src, m->id.idiag_sport,
+		     m->id.idiag_dst, m->id.idiag_dport, &k) == 0) {
+		if (table_remove(&tr->table, &k))
+			tr->dirty = 1;
+	}
+}
+
+/*
+ * (Re)build the table from one sock_diag dump of established TCP
+ * sockets per address family.
+ */
+static int diag_seed(struct tracker *tr)
+{
+	static const int families[] = { AF_INET, AF_INET6 };
+	struct {
+		struct nlmsghdr		nlh;
+		struct inet_diag_req_v2	r;
+		struct nlattr		bc_attr;
+		unsigned char		bc[sizeof(struct inet_diag_bc_op)
+					   + sizeof(struct inet_diag_hostcond) + 16];
+	} req;
+	struct inet_diag_bc_op op;
+	struct inet_diag_hostcond cond;
+	size_t alen, bclen;
+	struct sockaddr_nl sa;
+	const struct nlmsghdr *h;
+	struct track_table old;
+	unsigned i;
+	size_t j;
+	ssize_t len;
+	int fd, done;
+
+	fd = nl_open(NETLINK_SOCK_DIAG, NULL, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open sock_diag socket (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	old = tr->table;
+	memset(&tr->table, 0, sizeof(tr->table));
+	if (table_resize(&tr->table, old.size) < 0) {
+		tr->table = old;
+		close(fd);
+		return -1;
+	}
+
+	/*
+	 * Let the kernel do the filtering: a single "source is the VIP"
+	 * condition, which also matches IPv4-mapped addresses of IPv6
+	 * sockets.
+	 */
+	alen = tr->vip.sa.sa_family == AF_INET ? 4 : 16;
+	bclen = sizeof(op) + sizeof(cond) + alen;
+	op.code = INET_DIAG_BC_S_COND;
+	op.yes = bclen;
+	op.no = bclen + 4;
+	cond.family = tr->vip.sa.sa_family;
+	cond.prefix_len = alen * 8;
+	cond.port = -1;
+
+	for (i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+		memset(&req, 0, sizeof(req));
+		memcpy(req.bc, &op, sizeof(op));
+		memcpy(req.bc + sizeof(op), &cond, sizeof(cond));
+		if (alen == 4)
+			memcpy(req.bc + sizeof(op) + sizeof(cond), &tr->vip.ip.sin_addr, 4);
+		else
+			memcpy(req.bc + sizeof(op) + sizeof(cond), &tr->vip.ip6.sin6_addr, 16);
+		req.bc_attr.nla_type = INET_DIAG_REQ_BYTECODE;
+		req.bc_attr.nla_len = NLA_HDRLEN + bclen;
+		req.nlh.nlmsg_len = (req.bc - (unsigned char *)&req) + bclen;
+		req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+		req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		req.nlh.nlmsg_seq = i + 1;
+		req.r.sdiag_family = families[i];
+		req.r.sdiag_protocol = IPPROTO_TCP;
+		req.r.idiag_states = 1 << TCP_ESTABLISHED;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.nl_family = AF_NETLINK;
+		if (sendto(fd, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+			fprintf(stderr, "Failed sock_diag request (%s)\n", strerror(errno));
+			close(fd);
+			free(tr->table.slots);
+			tr->table = old;
+			return -1;
+		}
+
+		for (done = 0; !done; ) {
+			len = recv(fd, tr->buf, TRACK_NLBUF, 0);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				fprintf(stderr, "Failed sock_diag recv (%s)\n", strerror(errno));
+				close(fd);
+				free(tr->table.slots);
+				tr->table = old;
+				return -1;
+			}
+			for (h = (const struct nlmsghdr *)(const void *)tr->buf;
+			     NLMSG_OK(h, (size_t)len); h = NLMSG_NEXT(h, len)) {
+				if (h->nlmsg_type == NLMSG_DONE
+				||  h->nlmsg_type == NLMSG_ERROR) {
+					/* no IPv6 is not an error */
+					done = 1;
+					break;
+				}
+				if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(struct inet_diag_msg)))
+					diag_add(tr, NLMSG_DATA(h));
+			}
+		}
+	}
+	close(fd);
+
+	/* only a changed set of connections needs a new snapshot */
+	if (tr->table.used != old.used)
+		tr->dirty = 1;
+	for (j = 0; j < old.size && !tr->dirty; j++) {
+		if (old.slots[j].state == SLOT_USED
+		&&  !table_lookup(&tr->table, &old.slots[j], 0))
+			tr->dirty = 1;
+	}
+	free(old.slots);
+	return 0;
+}
+
+/* conntrack NEW/UPDATE/DESTROY notification */
+static void ct_event(struct tracker *tr, const struct nlmsghdr *h)
+{
+	const struct nlattr *cta[CTA_MAX + 1];
+	const struct nlattr *tup[CTA_TUPLE_MAX + 1];
+	const struct nlattr *ip[CTA_IP_MAX + 1];
+	const struct nlattr *proto[CTA_PROTO_MAX + 1];
+	const struct nlattr *pinfo[CTA_PROTOINFO_MAX + 1];
+	const struct nlattr *tcp[CTA_PROTOINFO_TCP_MAX + 1];
+	const void *src, *dst;
+	uint16_t sport, dport;
+	struct track_slot k;
+	int type, family, state = -1;
+
+	if (NFNL_SUBSYS_ID(h->nlmsg_type) != NFNL_SUBSYS_CTNETLINK
+	||  h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg)))
+		return;
+	type = NFNL_MSG_TYPE(h->nlmsg_type);
+
+	parse_attrs(cta, CTA_MAX,
+		    (const struct nlattr *)((const char *)NLMSG_DATA(h) + NLMSG_ALIGN(sizeof(struct nfgenmsg))),
+		    h->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+	if (!cta[CTA_TUPLE_ORIG])
+		return;
+	parse_attrs(tup, CTA_TUPLE_MAX, NLA_DATA(cta[CTA_TUPLE_ORIG]), NLA_LEN(cta[CTA_TUPLE_ORIG]));
+	if (!tup[CTA_TUPLE_IP] || !tup[CTA_TUPLE_PROTO])
+		return;
+	parse_attrs(proto, CTA_PROTO_MAX, NLA_DATA(tup[CTA_TUPLE_PROTO]), NLA_LEN(tup[CTA_TUPLE_PROTO]));
+	if (!proto[CTA_PROTO_NUM] || !proto[CTA_PROTO_SRC_PORT] || !proto[CTA_PROTO_DST_PORT]
+	||  *(const uint8_t *)NLA_DATA(proto[CTA_PROTO_NUM]) != IPPROTO_TCP)
+		return;
+	memcpy(&sport, NLA_DATA(proto[CTA_PROTO_SRC_PORT]), sizeof(sport));
+	memcpy(&dport, NLA_DATA(proto[CTA_PROTO_DST_PORT]), sizeof(dport));
+
+	parse_attrs(ip, CTA_IP_MAX, NLA_DATA(tup[CTA_TUPLE_IP]), NLA_LEN(tup[CTA_TUPLE_IP]));
+	if (ip[CTA_IP_V4_SRC] && ip[CTA_IP_V4_DST]) {
+		family = AF_INET;
+		src = NLA_DATA(ip[CTA_IP_V4_SRC]);
+		dst = NLA_DATA(ip[CTA_IP_V4_DST]);
+	} else if (ip[CTA_IP_V6_SRC] && ip[CTA_IP_V6_DST]) {
+		family = AF_INET6;
+		src = NLA_DATA(ip[CTA_IP_V6_SRC]);
+		dst = NLA_DATA(ip[CTA_IP_V6_DST]);
+	} else {
+		return;
+	}
+
+	if (make_key(&tr->vip, family, src, sport, dst, dport, &k) < 0)
+		return;
+
+	if (cta[CTA_PROTOINFO]) {
+		parse_attrs(pinfo, CTA_PROTOINFO_MAX, NLA_DATA(cta[CTA_PROTOINFO]), NLA_LEN(cta[CTA_PROTOINFO]));
+		if (pinfo[CTA_PROTOINFO_TCP]) {
+			parse_attrs(tcp, CTA_PROTOINFO_TCP_MAX,
+				    NLA_DATA(pinfo[CTA_PROTOINFO_TCP]), NLA_LEN(pinfo[CTA_PROTOINFO_TCP]));
+			if (tcp[CTA_PROTOINFO_TCP_STATE])
+				state = *(const uint8_t *)NLA_DATA(tcp[CTA_PROTOINFO_TCP_STATE]);
+		}
+	}
+
+	if (type == IPCTNL_MSG_CT_DELETE
+	||  state >= TCP_CONNTRACK_TIME_WAIT) {
+		if (table_remove(&tr->table, &k))
+			tr->dirty = 1;
+	} else if (state == TCP_CONNTRACK_ESTABLISHED) {
+		if (table_insert(&tr->table, &k) > 0)
+			tr->dirty = 1;
+	}
+}
+
+static int snapshot(struct tracker *tr)
+{
+	struct tickle_list list;
+	sock_addr src, dst;
+	struct tickle_tuple4 t4;
+	pid_t pid;
+	size_t i;
+	int ret = 0;
+
+	tickle_list_init(&list);
+	for (i = 0; i < tr->table.size && ret == 0; i++) {
+		const struct track_slot *s = &tr->table.slots[i];
+
+		if (s->state != SLOT_USED)
+			continue;
+		if (s->family == AF_INET) {
+			memcpy(&t4.saddr, s->t.saddr, 4);
+			memcpy(&t4.daddr, s->t.daddr, 4);
+			t4.sport = s->t.sport;
+			t4.dport = s->t.dport;
+			tickle_tuple4_addrs(&t4, &src, &dst);
+		} else {
+			tickle_tuple6_addrs(&s->t, &src, &dst);
+		}
+		ret = tickle_list_add(&list, &src, &dst);
+	}
+	if (ret == 0)
+		ret = tickle_list_write(&list, tr->statefile);
+	tickle_list_free(&list);
+	if (ret)
+		return ret;
+	tr->dirty = 0;
+
+	if (!tr->sync_cmd)
+		return 0;
+
+	/* hand the snapshot to the sync_script, the same way portblock does */
+	pid = fork();
+	if (pid == 0) {
+		char *cmd = malloc(strlen(tr->sync_cmd) + strlen(tr->statefile) + 2);
+		int devnull = open("/dev/null", O_RDWR);
+
+		if (devnull >= 0) {
+			dup2(devnull, STDOUT_FILENO);
+			dup2(devnull, STDERR_FILENO);
+		}
+		if (!cmd)
+			_exit(1);
+		sprintf(cmd, "%s %s", tr->sync_cmd, tr->statefile);
+		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+		_exit(127);
+	} else if (pid < 0) {
+		fprintf(stderr, "Failed fork (%s)\n", strerror(errno));
+	}
+	return 0;
+}
+
+static int write_pidfile(const char *pidfile)
+{
+	FILE *f = fopen(pidfile, "w");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s (%s)\n", pidfile, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "%u\n", (unsigned)getpid());
+	if (fclose(f) != 0) {
+		fprintf(stderr, "Failed to write %s (%s)\n", pidfile, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int tickle_track(const char *ip, const char *statefile, int interval,
+		 const char *sync_cmd, const char *pidfile)
+{
+	static const unsigned ct_groups[] = {
+		NFNLGRP_CONNTRACK_NEW, NFNLGRP_CONNTRACK_UPDATE, NFNLGRP_CONNTRACK_DESTROY
+	};
+	static const unsigned diag_groups[] = {
+		SKNLGRP_INET_TCP_DESTROY, SKNLGRP_INET6_TCP_DESTROY
+	};
+	struct tracker tr;
+	struct itimerspec its;
+	struct signalfd_siginfo si;
+	struct pollfd pfd[4];
+	sigset_t mask;
+	int sfd, tfd, ctfd, dfd, nfds, i;
+	int ret = 0, quit = 0;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.statefile = statefile;
+	tr.sync_cmd = sync_cmd;
+	if (parse_ip(ip, NULL, 0, &tr.vip))
+		return -1;
+	tr.buf = malloc(TRACK_NLBUF);
+	if (!tr.buf || table_resize(&tr.table, TRACK_MINSIZE) < 0) {
+		fprintf(stderr, "Failed malloc()\n");
+		return -1;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	/* reap the sync_script children */
+	signal(SIGCHLD, SIG_IGN);
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = its.it_interval.tv_sec = interval;
+	if (sfd < 0 || tfd < 0 || timerfd_settime(tfd, 0, &its, NULL) < 0) {
+		fprintf(stderr, "Failed to set up signals and timer (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	/* subscribe before seeding, so nothing falls in between */
+	ctfd = events_open(NETLINK_NETFILTER, ct_groups, 3);
+	dfd = events_open(NETLINK_SOCK_DIAG, diag_groups, 2);
+
+	if (diag_seed(&tr) < 0 || snapshot(&tr) < 0)
+		return -1;
+	if (pidfile && write_pidfile(pidfile) < 0)
+		return -1;
+
+	nfds = 0;
+	pfd[nfds].fd = sfd;
+	pfd[nfds++].events = POLLIN;
+	pfd[nfds].fd = tfd;
+	pfd[nfds++].events = POLLIN;
+	if (ctfd >= 0) {
+		pfd[nfds].fd = ctfd;
+		pfd[nfds++].events = POLLIN;
+	}
+	if (dfd >= 0) {
+		pfd[nfds].fd = dfd;
+		pfd[nfds++].events = POLLIN;
+	}
+
+	while (!quit) {
+		int resync = 0, flush = 0, tick = 0;
+
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Failed poll (%s)\n", strerror(errno));
+			ret = -1;
+			break;
+		}
+		for (i = 0; i < nfds; i++) {
+			if (!pfd[i].revents)
+				continue;
+			if (pfd[i].fd == sfd) {
+				if (read(sfd, &si, sizeof(si)) != sizeof(si))
+					continue;
+				switch (si.ssi_signo) {
+				case SIGUSR1:
+					flush = 1;
+					break;
+				case SIGHUP:
+					resync = 1;
+					break;
+				default:
+					quit = flush = 1;
+					break;
+				}
+			} else if (pfd[i].fd == tfd) {
+				uint64_t ticks;
+
+				if (read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks))
+					continue;
+				/* conntrack may be loaded but not see the
+				 * VIP's traffic, so never rely on it alone
+				 */
+				resync = tick = 1;
+			} else if (pfd[i].fd == ctfd) {
+				if (nl_drain(&tr, ctfd, ct_event) < 0)
+					resync = 1;
+			} else if (pfd[i].fd == dfd) {
+				if (nl_drain(&tr, dfd, diag_event) < 0)
+					resync = 1;
+			}
+		}
+		if (resync && diag_seed(&tr) < 0)
+			ret = -1;
+		if (tick && tr.dirty)
+			flush = 1;
+		if (flush && snapshot(&tr) < 0)
+			ret = -1;
+	}
+
+	if (pidfile)
+		unlink(pidfile);
+	free(tr.table.slots);
+	free(tr.buf);
+	return ret;
+}